@@ -46,12 +46,14 @@
 
 #include <limits>
 #include <cmath>
+#include <algorithm>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 #include <opencv2/contrib/contrib.hpp>
 
 #include <chrono>
+#include <future>
 #include <iostream>
 #include <vector>
 
@@ -107,6 +109,11 @@ static double _keep_lane_right_distance;
 static double _max_boundingbox_side;
 static double _remove_points_upto;
 
+static bool _use_polar_grid;
+static double _grid_range_resolution;
+static double _grid_angular_resolution;
+static double _grid_max_range;
+
 void transformBoundingBox(const jsk_recognition_msgs::BoundingBox& in_boundingbox, jsk_recognition_msgs::BoundingBox& out_boundingbox, const std::string& in_target_frame, const std_msgs::Header& in_header)
 {
 	geometry_msgs::PoseStamped pose_in, pose_out;
@@ -318,6 +325,12 @@ std::vector<ClusterPtr> clusterAndColor(const pcl::PointCloud<pcl::PointXYZ>::Pt
 
 }
 
+void collectClusters(const std::vector<ClusterPtr>& all_clusters,
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
+		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
+		lidar_tracker::centroids& in_out_centroids,
+		lidar_tracker::CloudClusterArray& in_out_clusters);
+
 void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
 		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
@@ -333,45 +346,88 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 	//3 => 45-60 d=2.1
 	//4 => >60   d=2.6
 
-	std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> cloud_segments_array(5);
+	const unsigned int segments_num = 5;
+	std::vector<pcl::PointCloud<pcl::PointXYZ>::Ptr> cloud_segments_array(segments_num);
+
+	//label every point with its segment first, so each segment is allocated once
+	std::vector<unsigned char> point_segments(in_cloud_ptr->points.size());
+	std::vector<size_t> segment_sizes(segments_num, 0);
+	float squared_distances[segments_num - 1];
+	for(unsigned int i=0; i<segments_num - 1; i++)
+		squared_distances[i] = _clustering_distances[i] * _clustering_distances[i];
 
-	for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+	for (unsigned int i=0; i<in_cloud_ptr->points.size(); i++)
 	{
-		pcl::PointCloud<pcl::PointXYZ>::Ptr tmp_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-		cloud_segments_array[i] = tmp_cloud;
+		const pcl::PointXYZ& current_point = in_cloud_ptr->points[i];
+		float squared_origin_distance = current_point.x*current_point.x + current_point.y*current_point.y;
+
+		unsigned int segment = 0;
+		while (segment < segments_num - 1 && squared_origin_distance >= squared_distances[segment])
+			segment++;
+
+		point_segments[i] = segment;
+		segment_sizes[segment]++;
 	}
 
+	for(unsigned int i=0; i<segments_num; i++)
+	{
+		cloud_segments_array[i].reset(new pcl::PointCloud<pcl::PointXYZ>);
+		cloud_segments_array[i]->points.reserve(segment_sizes[i]);
+	}
 	for (unsigned int i=0; i<in_cloud_ptr->points.size(); i++)
 	{
-		pcl::PointXYZ current_point;
-		current_point.x = in_cloud_ptr->points[i].x;
-		current_point.y = in_cloud_ptr->points[i].y;
-		current_point.z = in_cloud_ptr->points[i].z;
-
-		float origin_distance = sqrt( pow(current_point.x,2) + pow(current_point.y,2) );
+		cloud_segments_array[point_segments[i]]->points.push_back(in_cloud_ptr->points[i]);
+	}
+	for(unsigned int i=0; i<segments_num; i++)
+	{
+		cloud_segments_array[i]->width = cloud_segments_array[i]->points.size();
+		cloud_segments_array[i]->height = 1;
+	}
 
-		if 		(origin_distance < _clustering_distances[0] )	{cloud_segments_array[0]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[1])		{cloud_segments_array[1]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[2])		{cloud_segments_array[2]->points.push_back (current_point);}
-		else if(origin_distance < _clustering_distances[3])		{cloud_segments_array[3]->points.push_back (current_point);}
-		else													{cloud_segments_array[4]->points.push_back (current_point);}
+	//the segments are independent, cluster them concurrently, each one with its own kd-tree
+	//(clusterAndColor only reads the output arguments and the tuning parameters)
+	std::vector< std::future< std::vector<ClusterPtr> > > segment_clusters(segments_num);
+	for(unsigned int i=0; i<segments_num; i++)
+	{
+		if (cloud_segments_array[i]->points.empty())
+			continue;
+		segment_clusters[i] = std::async(std::launch::async, clusterAndColor, cloud_segments_array[i], out_cloud_ptr,
+								std::ref(in_out_boundingbox_array), std::ref(in_out_centroids), _clustering_thresholds[i]);
 	}
 
+	//collect in segment order, so the output does not depend on thread timing
 	std::vector <ClusterPtr> all_clusters;
-	for(unsigned int i=0; i<cloud_segments_array.size(); i++)
+	for(unsigned int i=0; i<segments_num; i++)
 	{
-		std::vector<ClusterPtr> local_clusters = clusterAndColor(cloud_segments_array[i], out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, _clustering_thresholds[i]);
+		if (!segment_clusters[i].valid())
+			continue;
+		std::vector<ClusterPtr> local_clusters = segment_clusters[i].get();
 
 		all_clusters.insert(all_clusters.end(), local_clusters.begin(), local_clusters.end());
 	}
 
+	collectClusters(all_clusters, out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, in_out_clusters);
+}
+
+void collectClusters(const std::vector<ClusterPtr>& all_clusters,
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
+		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
+		lidar_tracker::centroids& in_out_centroids,
+		lidar_tracker::CloudClusterArray& in_out_clusters)
+{
 	//Clusters can be merged or checked in here
 	//....
 	//Get final PointCloud to be published
 
+	size_t clustered_points_num = 0;
+	for(unsigned int i=0; i<all_clusters.size(); i++)
+		clustered_points_num += all_clusters[i]->GetCloud()->points.size();
+	out_cloud_ptr->points.reserve(out_cloud_ptr->points.size() + clustered_points_num);
+
 	for(unsigned int i=0; i<all_clusters.size(); i++)
 	{
-		*out_cloud_ptr = *out_cloud_ptr + *(all_clusters[i]->GetCloud());
+		const pcl::PointCloud<pcl::PointXYZRGB>::Ptr cluster_cloud = all_clusters[i]->GetCloud();
+		out_cloud_ptr->points.insert(out_cloud_ptr->points.end(), cluster_cloud->points.begin(), cluster_cloud->points.end());
 
 		jsk_recognition_msgs::BoundingBox bounding_box = all_clusters[i]->GetBoundingBox();
 		pcl::PointXYZ min_point = all_clusters[i]->GetMinPoint();
@@ -396,6 +452,122 @@ void segmentByDistance(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
 			in_out_clusters.clusters.push_back(cloud_cluster);
 		}
 	}
+	out_cloud_ptr->width = out_cloud_ptr->points.size();
+	out_cloud_ptr->height = 1;
+}
+
+std::vector<ClusterPtr> clusterPolarGrid(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr)
+{
+	//project the points on a 2D polar grid around the sensor and label the connected occupied cells,
+	//cells grow with the distance as the euclidean thresholds of segmentByDistance do.
+	//Every step is linear in the number of points or cells, no kd-tree is needed
+	const unsigned int points_num = in_cloud_ptr->points.size();
+	const int angular_cells = std::max(1, (int)ceil(2*M_PI / _grid_angular_resolution));
+
+	float max_range = 0;
+	std::vector<float> ranges(points_num);
+	for (unsigned int i=0; i<points_num; i++)
+	{
+		const pcl::PointXYZ& p = in_cloud_ptr->points[i];
+		ranges[i] = sqrt(p.x*p.x + p.y*p.y);
+		if (!std::isfinite(ranges[i]) || !std::isfinite(p.z) || ranges[i] > _grid_max_range)
+			ranges[i] = -1;	//skipped below
+		else if (ranges[i] > max_range)
+			max_range = ranges[i];
+	}
+	const size_t range_cells = (size_t)(max_range / _grid_range_resolution) + 1;
+	if (range_cells > (size_t)(std::numeric_limits<int>::max() - 1) / angular_cells)
+	{
+		ROS_ERROR("Polar grid of %zu x %d cells is too large, check grid_max_range and the grid resolutions", range_cells, angular_cells);
+		return std::vector<ClusterPtr>();
+	}
+	const int cells_num = (int)range_cells * angular_cells;
+
+	//bucket the points by cell (counting sort)
+	std::vector<int> point_cells(points_num);
+	std::vector<int> cell_start(cells_num + 1, 0);
+	for (unsigned int i=0; i<points_num; i++)
+	{
+		const pcl::PointXYZ& p = in_cloud_ptr->points[i];
+		if (ranges[i] < 0)
+		{
+			point_cells[i] = -1;
+			continue;
+		}
+		int range_index = (int)(ranges[i] / _grid_range_resolution);
+		int angular_index = (int)((atan2(p.y, p.x) + M_PI) / _grid_angular_resolution);
+		if (angular_index >= angular_cells)
+			angular_index = angular_cells - 1;
+		point_cells[i] = range_index * angular_cells + angular_index;
+		cell_start[point_cells[i] + 1]++;
+	}
+	for (int c=0; c<cells_num; c++)
+		cell_start[c + 1] += cell_start[c];
+	std::vector<int> cell_points(points_num);
+	std::vector<int> cell_fill(cell_start.begin(), cell_start.end() - 1);
+	for (unsigned int i=0; i<points_num; i++)
+		if (point_cells[i] >= 0)
+			cell_points[cell_fill[point_cells[i]]++] = i;
+
+	//connected components over the 8-neighborhood of each occupied cell, wrapping around in azimuth
+	std::vector<int> cell_labels(cells_num, -1);
+	std::vector<int> stack;
+	std::vector<ClusterPtr> clusters;
+	unsigned int k = 0;
+	for (int seed=0; seed<cells_num; seed++)
+	{
+		if (cell_labels[seed] >= 0 || cell_start[seed] == cell_start[seed + 1])
+			continue;
+
+		std::vector<int> cluster_indices;
+		cell_labels[seed] = k;
+		stack.push_back(seed);
+		while (!stack.empty())
+		{
+			int cell = stack.back();
+			stack.pop_back();
+			cluster_indices.insert(cluster_indices.end(), cell_points.begin() + cell_start[cell], cell_points.begin() + cell_start[cell + 1]);
+
+			int range_index = cell / angular_cells;
+			int angular_index = cell % angular_cells;
+			for (int dr=-1; dr<=1; dr++)
+			{
+				int r = range_index + dr;
+				if (r < 0 || r >= (int)range_cells)
+					continue;
+				for (int da=-1; da<=1; da++)
+				{
+					int a = (angular_index + da + angular_cells) % angular_cells;
+					int neighbor = r * angular_cells + a;
+					if (cell_labels[neighbor] < 0 && cell_start[neighbor] != cell_start[neighbor + 1])
+					{
+						cell_labels[neighbor] = k;
+						stack.push_back(neighbor);
+					}
+				}
+			}
+		}
+
+		if ((int)cluster_indices.size() < _cluster_size_min || (int)cluster_indices.size() > _cluster_size_max)
+			continue;
+
+		const cv::Scalar& color = _colors[k % _colors.size()];
+		ClusterPtr cluster(new Cluster());
+		cluster->SetCloud(in_cloud_ptr, cluster_indices, _velodyne_header, k, (int)color.val[0], (int)color.val[1], (int)color.val[2], "", _pose_estimation);
+		clusters.push_back(cluster);
+		k++;
+	}
+
+	return clusters;
+}
+
+void segmentByPolarGrid(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr out_cloud_ptr,
+		jsk_recognition_msgs::BoundingBoxArray& in_out_boundingbox_array,
+		lidar_tracker::centroids& in_out_centroids,
+		lidar_tracker::CloudClusterArray& in_out_clusters)
+{
+	collectClusters(clusterPolarGrid(in_cloud_ptr), out_cloud_ptr, in_out_boundingbox_array, in_out_centroids, in_out_clusters);
 }
 
 void removeFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr, pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr, pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr, float in_max_height=0.2, float in_floor_max_angle=0.35)
@@ -590,7 +762,10 @@ void velodyne_callback(const sensor_msgs::PointCloud2ConstPtr& in_sensor_cloud)
 		else
 			diffnormals_cloud_ptr = clipped_cloud_ptr;
 
-		segmentByDistance(diffnormals_cloud_ptr, colored_clustered_cloud_ptr, boundingbox_array, centroids, cloud_clusters);
+		if (_use_polar_grid)
+			segmentByPolarGrid(diffnormals_cloud_ptr, colored_clustered_cloud_ptr, boundingbox_array, centroids, cloud_clusters);
+		else
+			segmentByDistance(diffnormals_cloud_ptr, colored_clustered_cloud_ptr, boundingbox_array, centroids, cloud_clusters);
 		publishColorCloud(&_pub_cluster_cloud, colored_clustered_cloud_ptr);
 		// Publish BB
 		boundingbox_array.header = _velodyne_header;
@@ -726,6 +901,18 @@ int main (int argc, char** argv)
 	private_nh.param("max_boundingbox_side", _max_boundingbox_side, 10.0);			ROS_INFO("_max_boundingbox_side: %f", _max_boundingbox_side);
 	private_nh.param<std::string>("output_frame", _output_frame, "velodyne");			ROS_INFO("output_frame: %s", _output_frame.c_str());
 	private_nh.param("remove_points_upto", _remove_points_upto, 0.0);		ROS_INFO("remove_points_upto: %f", _remove_points_upto);
+	private_nh.param("use_polar_grid", _use_polar_grid, false);		ROS_INFO("use_polar_grid: %d", _use_polar_grid);
+	private_nh.param("grid_range_resolution", _grid_range_resolution, 0.5);	ROS_INFO("grid_range_resolution: %f", _grid_range_resolution);
+	private_nh.param("grid_angular_resolution", _grid_angular_resolution, 1.0);	ROS_INFO("grid_angular_resolution: %f", _grid_angular_resolution);
+	private_nh.param("grid_max_range", _grid_max_range, 200.0);	ROS_INFO("grid_max_range: %f", _grid_max_range);
+
+	if (_grid_range_resolution <= 0)
+		_grid_range_resolution = 0.5;
+	if (_grid_angular_resolution <= 0)
+		_grid_angular_resolution = 1.0;
+	if (!(_grid_max_range > 0))
+		_grid_max_range = 200.0;
+	_grid_angular_resolution *= M_PI / 180.0;	//degrees in the parameter
 
 	_velodyne_transform_available = false;
 
@@ -46,11 +46,23 @@
 #include <Eigen/Dense>
 #include <Eigen/Cholesky>
 
+#include <algorithm>
+#include <utility>
+#if defined (_OPENMP) && defined (__GNUC__)
+#include <parallel/algorithm>
+#endif
+
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> void
 pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
 {
-  voxel_centroids_leaf_indices_.clear ();
+  cell_keys_.clear ();
+  cell_nr_points_.clear ();
+  cell_means_.clear ();
+  cell_covs_.clear ();
+  cell_icovs_.clear ();
+  cell_hash_keys_.clear ();
+  cell_hash_cells_.clear ();
 
   // Has the input dataset been set already?
   if (!input_)
@@ -97,30 +109,11 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
   div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
   div_b_[3] = 0;
 
-  // Clear the leaves
-  leaves_.clear ();
-
   // Set up the division multiplier
   divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
 
-  int centroid_size = 4;
-
-  if (downsample_all_data_)
-    centroid_size = boost::mpl::size<FieldList>::value;
-
-  // ---[ RGB special case
-  std::vector<pcl::PCLPointField> fields;
-  int rgba_index = -1;
-  rgba_index = pcl::getFieldIndex (*input_, "rgb", fields);
-  if (rgba_index == -1)
-    rgba_index = pcl::getFieldIndex (*input_, "rgba", fields);
-  if (rgba_index >= 0)
-  {
-    rgba_index = fields[rgba_index].offset;
-    centroid_size += 3;
-  }
-
   // If we don't want to process the entire cloud, but rather filter points far away from the viewpoint first...
+  int distance_offset = -1;
   if (!filter_field_name_.empty ())
   {
     // Get the distance field index
@@ -128,21 +121,34 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
     int distance_idx = pcl::getFieldIndex (*input_, filter_field_name_, fields);
     if (distance_idx == -1)
       PCL_WARN ("[pcl::%s::applyFilter] Invalid filter field name. Index is %d.\n", getClassName ().c_str (), distance_idx);
+    else
+      distance_offset = fields[distance_idx].offset;
+  }
 
-    // First pass: go over all points and insert them into the right leaf
-    for (size_t cp = 0; cp < input_->points.size (); ++cp)
-    {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[cp].x) ||
-            !pcl_isfinite (input_->points[cp].y) ||
-            !pcl_isfinite (input_->points[cp].z))
-          continue;
+  // First pass: compute the voxel index of every point, invalid and filtered points get -1
+  int nr_input = static_cast<int> (input_->points.size ());
+  std::vector<std::pair<int, int> > point_keys (nr_input);
 
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int cp = 0; cp < nr_input; ++cp)
+  {
+    const PointT &pt = input_->points[cp];
+    point_keys[cp] = std::make_pair (-1, cp);
+
+    if (!input_->is_dense)
+      // Check if the point is invalid
+      if (!pcl_isfinite (pt.x) ||
+          !pcl_isfinite (pt.y) ||
+          !pcl_isfinite (pt.z))
+        continue;
+
+    if (distance_offset >= 0)
+    {
       // Get the distance value
-      const uint8_t* pt_data = reinterpret_cast<const uint8_t*> (&input_->points[cp]);
       float distance_value = 0;
-      memcpy (&distance_value, pt_data + fields[distance_idx].offset, sizeof (float));
+      memcpy (&distance_value, reinterpret_cast<const uint8_t*> (&pt) + distance_offset, sizeof (float));
 
       if (filter_limit_negative_)
       {
@@ -156,223 +162,381 @@ pcl::VoxelGridCovariance<PointT>::applyFilter (PointCloud &output)
         if ((distance_value > filter_limit_max_) || (distance_value < filter_limit_min_))
           continue;
       }
+    }
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+    int ijk0 = static_cast<int> (floor (pt.x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+    int ijk1 = static_cast<int> (floor (pt.y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+    int ijk2 = static_cast<int> (floor (pt.z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+    // Compute the centroid leaf index
+    point_keys[cp].first = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+  }
 
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
+  // Group the points of each voxel together, ordered by voxel index
+#if defined (_OPENMP) && defined (__GNUC__)
+  __gnu_parallel::sort (point_keys.begin (), point_keys.end ());
+#else
+  std::sort (point_keys.begin (), point_keys.end ());
+#endif
+
+  // Find the range of points belonging to each voxel, skipping the invalid points sorted to the front
+  int first = static_cast<int> (std::lower_bound (point_keys.begin (), point_keys.end (), std::make_pair (0, 0)) - point_keys.begin ());
+  std::vector<int> run_begin;
+  for (int i = first; i < nr_input; ++i)
+    if (i == first || point_keys[i].first != point_keys[i - 1].first)
+      run_begin.push_back (i);
+  run_begin.push_back (nr_input);
+
+  int nr_runs = static_cast<int> (run_begin.size ()) - 1;
+
+  cell_keys_.resize (nr_runs);
+  cell_nr_points_.resize (nr_runs);
+  cell_means_.resize (nr_runs);
+  cell_covs_.resize (nr_runs);
+  cell_icovs_.resize (nr_runs);
+
+  // Second pass: compute the centroid and covariance of each voxel, cells with too few points or near singular
+  // covariance are flagged by a point count of -1
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+  for (int r = 0; r < nr_runs; ++r)
+  {
+    int nr_points = run_begin[r + 1] - run_begin[r];
+    cell_keys_[r] = point_keys[run_begin[r]].first;
+    cell_nr_points_[r] = -1;
+
+    // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
+    if (nr_points < min_points_per_voxel_)
+      continue;
 
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
+    // Accumulation starts from identity as the leaf structure did, which keeps the resulting distributions unchanged
+    Eigen::Vector3d pt_sum (Eigen::Vector3d::Zero ());
+    Eigen::Matrix3d cov (Eigen::Matrix3d::Identity ());
+    for (int i = run_begin[r]; i < run_begin[r + 1]; ++i)
+    {
+      const PointT &pt = input_->points[point_keys[i].second];
+      Eigen::Vector3d pt3d (pt.x, pt.y, pt.z);
       // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
+      pt_sum += pt3d;
       // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
+      cov += pt3d * pt3d.transpose ();
+    }
 
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
+    Eigen::Vector3d mean = pt_sum / nr_points;
+
+    // Single pass covariance calculation
+    cov = (cov - 2 * (pt_sum * mean.transpose ())) / nr_points + mean * mean.transpose ();
+    cov *= (nr_points - 1.0) / nr_points;
+
+    //Normalize Eigen Val such that max no more than 100x min.
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver (cov);
+    Eigen::Matrix3d eigen_val = eigensolver.eigenvalues ().asDiagonal ();
+    Eigen::Matrix3d evecs = eigensolver.eigenvectors ();
+
+    if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
+      continue;
+
+    // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+    double min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
+    if (eigen_val (0, 0) < min_covar_eigvalue)
+    {
+      eigen_val (0, 0) = min_covar_eigvalue;
+
+      if (eigen_val (1, 1) < min_covar_eigvalue)
       {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // fill r/g/b data
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
+        eigen_val (1, 1) = min_covar_eigvalue;
       }
-      ++leaf.nr_points;
+
+      cov = evecs * eigen_val * evecs.inverse ();
     }
+
+    Eigen::Matrix3d icov = cov.inverse ();
+    if (icov.maxCoeff () == std::numeric_limits<float>::infinity ( )
+        || icov.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
+      continue;
+
+    cell_nr_points_[r] = nr_points;
+    cell_means_[r] = mean;
+    cell_covs_[r] = cov;
+    cell_icovs_[r] = icov;
   }
-  // No distance filtering, process all data
-  else
+
+  // The per point keys are no longer needed, release them before the cells are compacted
+  std::vector<std::pair<int, int> > ().swap (point_keys);
+
+  if (save_leaf_layout_)
+    leaf_layout_.assign (div_b_[0] * div_b_[1] * div_b_[2], -1);
+
+  // Compact the usable cells in place, keeping them sorted by voxel index
+  int nr_cells = 0;
+  for (int r = 0; r < nr_runs; ++r)
   {
-    // First pass: go over all points and insert them into the right leaf
-    for (size_t cp = 0; cp < input_->points.size (); ++cp)
-    {
-      if (!input_->is_dense)
-        // Check if the point is invalid
-        if (!pcl_isfinite (input_->points[cp].x) ||
-            !pcl_isfinite (input_->points[cp].y) ||
-            !pcl_isfinite (input_->points[cp].z))
-          continue;
+    if (cell_nr_points_[r] < 0)
+      continue;
 
-      int ijk0 = static_cast<int> (floor (input_->points[cp].x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
-      int ijk1 = static_cast<int> (floor (input_->points[cp].y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
-      int ijk2 = static_cast<int> (floor (input_->points[cp].z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+    if (nr_cells != r)
+    {
+      cell_keys_[nr_cells] = cell_keys_[r];
+      cell_nr_points_[nr_cells] = cell_nr_points_[r];
+      cell_means_[nr_cells] = cell_means_[r];
+      cell_covs_[nr_cells] = cell_covs_[r];
+      cell_icovs_[nr_cells] = cell_icovs_[r];
+    }
 
-      // Compute the centroid leaf index
-      int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
+    if (save_leaf_layout_)
+      leaf_layout_[cell_keys_[nr_cells]] = nr_cells;
 
-      //int idx = (((input_->points[cp].getArray4fmap () * inverse_leaf_size_).template cast<int> ()).matrix () - min_b_).dot (divb_mul_);
-      Leaf& leaf = leaves_[idx];
-      if (leaf.nr_points == 0)
-      {
-        leaf.centroid.resize (centroid_size);
-        leaf.centroid.setZero ();
-      }
+    nr_cells++;
+  }
 
-      Eigen::Vector3d pt3d (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z);
-      // Accumulate point sum for centroid calculation
-      leaf.mean_ += pt3d;
-      // Accumulate x*xT for single pass covariance calculation
-      leaf.cov_ += pt3d * pt3d.transpose ();
+  cell_keys_.resize (nr_cells);
+  cell_nr_points_.resize (nr_cells);
+  cell_means_.resize (nr_cells);
+  cell_covs_.resize (nr_cells);
+  cell_icovs_.resize (nr_cells);
 
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        Eigen::Vector4f pt (input_->points[cp].x, input_->points[cp].y, input_->points[cp].z, 0);
-        leaf.centroid.template head<4> () += pt;
-      }
-      else
-      {
-        // Copy all the fields
-        Eigen::VectorXf centroid = Eigen::VectorXf::Zero (centroid_size);
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // Fill r/g/b data, assuming that the order is BGRA
-          int rgb;
-          memcpy (&rgb, reinterpret_cast<const char*> (&input_->points[cp]) + rgba_index, sizeof (int));
-          centroid[centroid_size - 3] = static_cast<float> ((rgb >> 16) & 0x0000ff);
-          centroid[centroid_size - 2] = static_cast<float> ((rgb >> 8) & 0x0000ff);
-          centroid[centroid_size - 1] = static_cast<float> ((rgb) & 0x0000ff);
-        }
-        pcl::for_each_type<FieldList> (NdCopyPointEigenFunctor<PointT> (input_->points[cp], centroid));
-        leaf.centroid += centroid;
-      }
-      ++leaf.nr_points;
-    }
+  // Output centroids in cell order, so that kdtree indices are cell indices
+  output.points.resize (nr_cells);
+  for (int c = 0; c < nr_cells; ++c)
+  {
+    output.points[c].x = static_cast<float> (cell_means_[c] (0));
+    output.points[c].y = static_cast<float> (cell_means_[c] (1));
+    output.points[c].z = static_cast<float> (cell_means_[c] (2));
   }
 
-  // Second pass: go over all leaves and compute centroids and covariance matrices
-  output.points.reserve (leaves_.size ());
+  output.width = static_cast<uint32_t> (output.points.size ());
+
+  // Hash of cells for direct neighbor search
   if (searchable_)
-    voxel_centroids_leaf_indices_.reserve (leaves_.size ());
-  int cp = 0;
-  if (save_leaf_layout_)
-    leaf_layout_.resize (div_b_[0] * div_b_[1] * div_b_[2], -1);
+    buildCellHash ();
+}
 
-  // Eigen values and vectors calculated to prevent near singluar matrices
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigensolver;
-  Eigen::Matrix3d eigen_val;
-  Eigen::Vector3d pt_sum;
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::applyMerge (const std::vector<const VoxelGridCovariance<PointT>*> &grids, PointCloud &output)
+{
+  cell_keys_.clear ();
+  cell_nr_points_.clear ();
+  cell_means_.clear ();
+  cell_covs_.clear ();
+  cell_icovs_.clear ();
+  cell_hash_keys_.clear ();
+  cell_hash_cells_.clear ();
+
+  output.height = 1;
+  output.is_dense = true;
+  output.points.clear ();
+  output.width = 0;
+
+  // Bounding box of all cells, in voxel coordinates
+  bool empty = true;
+  for (size_t g = 0; g < grids.size (); ++g)
+  {
+    const VoxelGridCovariance<PointT> &grid = *grids[g];
+    if (grid.cell_keys_.empty ())
+      continue;
 
-  // Eigen values less than a threshold of max eigen value are inflated to a set fraction of the max eigen value.
-  double min_covar_eigvalue;
+    if (grid.leaf_size_ != leaf_size_)
+    {
+      PCL_WARN ("[pcl::%s::applyMerge] Grid %d has a different leaf size, skipping it.\n", getClassName ().c_str (), static_cast<int> (g));
+      continue;
+    }
 
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+    if (empty)
+    {
+      min_b_ = grid.min_b_;
+      max_b_ = grid.max_b_;
+      empty = false;
+    }
+    else
+    {
+      min_b_ = min_b_.cwiseMin (grid.min_b_);
+      max_b_ = max_b_.cwiseMax (grid.max_b_);
+    }
+  }
+
+  if (empty)
   {
+    min_b_.setZero ();
+    max_b_.setZero ();
+    div_b_ = Eigen::Vector4i (1, 1, 1, 0);
+    divb_mul_ = Eigen::Vector4i (1, 1, 1, 0);
+    return;
+  }
 
-    // Normalize the centroid
-    Leaf& leaf = it->second;
+  // Check that the merged grid can still be indexed with 32 bit integers
+  int64_t dx = static_cast<int64_t> (max_b_[0] - min_b_[0]) + 1;
+  int64_t dy = static_cast<int64_t> (max_b_[1] - min_b_[1]) + 1;
+  int64_t dz = static_cast<int64_t> (max_b_[2] - min_b_[2]) + 1;
 
-    // Normalize the centroid
-    leaf.centroid /= static_cast<float> (leaf.nr_points);
-    // Point sum used for single pass covariance calculation
-    pt_sum = leaf.mean_;
-    // Normalize mean
-    leaf.mean_ /= leaf.nr_points;
+  if ((dx*dy*dz) > std::numeric_limits<int32_t>::max())
+  {
+    PCL_WARN("[pcl::%s::applyMerge] Leaf size is too small for the merged grids. Integer indices would overflow.", getClassName().c_str());
+    return;
+  }
 
-    // If the voxel contains sufficient points, its covariance is calculated and is added to the voxel centroids and output clouds.
-    // Points with less than the minimum points will have a can not be accuratly approximated using a normal distribution.
-    if (leaf.nr_points >= min_points_per_voxel_)
-    {
-      if (save_leaf_layout_)
-        leaf_layout_[it->first] = cp++;
+  div_b_ = max_b_ - min_b_ + Eigen::Vector4i::Ones ();
+  div_b_[3] = 0;
+  divb_mul_ = Eigen::Vector4i (1, div_b_[0], div_b_[0] * div_b_[1], 0);
 
-      output.push_back (PointT ());
+  // Re-index the cells of every grid in the merged bounding box, (voxel index, (grid, cell))
+  std::vector<std::pair<int, std::pair<int, int> > > cell_refs;
+  for (size_t g = 0; g < grids.size (); ++g)
+  {
+    const VoxelGridCovariance<PointT> &grid = *grids[g];
+    if (grid.cell_keys_.empty () || grid.leaf_size_ != leaf_size_)
+      continue;
 
-      // Do we need to process all the fields?
-      if (!downsample_all_data_)
-      {
-        output.points.back ().x = leaf.centroid[0];
-        output.points.back ().y = leaf.centroid[1];
-        output.points.back ().z = leaf.centroid[2];
-      }
-      else
-      {
-        pcl::for_each_type<FieldList> (pcl::NdCopyEigenPointFunctor<PointT> (leaf.centroid, output.back ()));
-        // ---[ RGB special case
-        if (rgba_index >= 0)
-        {
-          // pack r/g/b into rgb
-          float r = leaf.centroid[centroid_size - 3], g = leaf.centroid[centroid_size - 2], b = leaf.centroid[centroid_size - 1];
-          int rgb = (static_cast<int> (r)) << 16 | (static_cast<int> (g)) << 8 | (static_cast<int> (b));
-          memcpy (reinterpret_cast<char*> (&output.points.back ()) + rgba_index, &rgb, sizeof (float));
-        }
-      }
+    for (size_t c = 0; c < grid.cell_keys_.size (); ++c)
+    {
+      int key = grid.cell_keys_[c];
+      Eigen::Vector4i ijk (key % grid.div_b_[0],
+                           (key / grid.divb_mul_[1]) % grid.div_b_[1],
+                           key / grid.divb_mul_[2], 0);
+      ijk += grid.min_b_ - min_b_;
+      cell_refs.push_back (std::make_pair (ijk.dot (divb_mul_), std::make_pair (static_cast<int> (g), static_cast<int> (c))));
+    }
+  }
 
-      // Stores the voxel indice for fast access searching
-      if (searchable_)
-        voxel_centroids_leaf_indices_.push_back (static_cast<int> (it->first));
+  // Sorting by voxel index then by grid keeps the first grid first among duplicates
+#if defined (_OPENMP) && defined (__GNUC__)
+  __gnu_parallel::sort (cell_refs.begin (), cell_refs.end ());
+#else
+  std::sort (cell_refs.begin (), cell_refs.end ());
+#endif
 
-      // Single pass covariance calculation
-      leaf.cov_ = (leaf.cov_ - 2 * (pt_sum * leaf.mean_.transpose ())) / leaf.nr_points + leaf.mean_ * leaf.mean_.transpose ();
-      leaf.cov_ *= (leaf.nr_points - 1.0) / leaf.nr_points;
+  int nr_cells = 0;
+  for (size_t r = 0; r < cell_refs.size (); ++r)
+    if (r == 0 || cell_refs[r].first != cell_refs[r - 1].first)
+      nr_cells++;
 
-      //Normalize Eigen Val such that max no more than 100x min.
-      eigensolver.compute (leaf.cov_);
-      eigen_val = eigensolver.eigenvalues ().asDiagonal ();
-      leaf.evecs_ = eigensolver.eigenvectors ();
+  cell_keys_.resize (nr_cells);
+  cell_nr_points_.resize (nr_cells);
+  cell_means_.resize (nr_cells);
+  cell_covs_.resize (nr_cells);
+  cell_icovs_.resize (nr_cells);
 
-      if (eigen_val (0, 0) < 0 || eigen_val (1, 1) < 0 || eigen_val (2, 2) <= 0)
-      {
-        leaf.nr_points = -1;
-        continue;
-      }
+  if (save_leaf_layout_)
+    leaf_layout_.assign (div_b_[0] * div_b_[1] * div_b_[2], -1);
 
-      // Avoids matrices near singularities (eq 6.11)[Magnusson 2009]
+  int cell = 0;
+  for (size_t r = 0; r < cell_refs.size (); ++r)
+  {
+    if (r > 0 && cell_refs[r].first == cell_refs[r - 1].first)
+      continue;
 
-      min_covar_eigvalue = min_covar_eigvalue_mult_ * eigen_val (2, 2);
-      if (eigen_val (0, 0) < min_covar_eigvalue)
-      {
-        eigen_val (0, 0) = min_covar_eigvalue;
+    const VoxelGridCovariance<PointT> &grid = *grids[cell_refs[r].second.first];
+    int src = cell_refs[r].second.second;
 
-        if (eigen_val (1, 1) < min_covar_eigvalue)
-        {
-          eigen_val (1, 1) = min_covar_eigvalue;
-        }
+    cell_keys_[cell] = cell_refs[r].first;
+    cell_nr_points_[cell] = grid.cell_nr_points_[src];
+    cell_means_[cell] = grid.cell_means_[src];
+    cell_covs_[cell] = grid.cell_covs_[src];
+    cell_icovs_[cell] = grid.cell_icovs_[src];
 
-        leaf.cov_ = leaf.evecs_ * eigen_val * leaf.evecs_.inverse ();
-      }
-      leaf.evals_ = eigen_val.diagonal ();
+    if (save_leaf_layout_)
+      leaf_layout_[cell_keys_[cell]] = cell;
 
-      leaf.icov_ = leaf.cov_.inverse ();
-      if (leaf.icov_.maxCoeff () == std::numeric_limits<float>::infinity ( )
-          || leaf.icov_.minCoeff () == -std::numeric_limits<float>::infinity ( ) )
-      {
-        leaf.nr_points = -1;
-      }
+    cell++;
+  }
 
-    }
+  // Output centroids in cell order, so that kdtree indices are cell indices
+  output.points.resize (nr_cells);
+  for (int c = 0; c < nr_cells; ++c)
+  {
+    output.points[c].x = static_cast<float> (cell_means_[c] (0));
+    output.points[c].y = static_cast<float> (cell_means_[c] (1));
+    output.points[c].z = static_cast<float> (cell_means_[c] (2));
   }
 
   output.width = static_cast<uint32_t> (output.points.size ());
+
+  // Hash of cells for direct neighbor search
+  if (searchable_)
+    buildCellHash ();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> void
+pcl::VoxelGridCovariance<PointT>::buildCellHash ()
+{
+  size_t nr_cells = cell_keys_.size ();
+
+  // Keep the load factor at or below 0.5 so that probe sequences stay short
+  size_t table_size = 16;
+  while (table_size < 2 * nr_cells)
+    table_size <<= 1;
+
+  cell_hash_keys_.assign (table_size, -1);
+  cell_hash_cells_.assign (table_size, -1);
+  cell_hash_mask_ = table_size - 1;
+
+  for (size_t c = 0; c < nr_cells; ++c)
+  {
+    int idx = cell_keys_[c];
+    size_t slot = (static_cast<uint32_t> (idx) * 2654435761u) & cell_hash_mask_;
+    while (cell_hash_keys_[slot] != -1)
+      slot = (slot + 1) & cell_hash_mask_;
+
+    cell_hash_keys_[slot] = idx;
+    cell_hash_cells_[slot] = static_cast<int> (c);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointT> int
+pcl::VoxelGridCovariance<PointT>::directSearch (const PointT &point, int num_neighbors, std::vector<int> &k_cells)
+{
+  k_cells.clear ();
+
+  // Check if the hash has been built
+  if (!searchable_)
+  {
+    PCL_WARN ("%s: Not Searchable", this->getClassName ().c_str ());
+    return 0;
+  }
+
+  // Displacements of the voxel containing the point, its 6 face neighbors and the remaining 20 neighbors
+  static const int displacements[27][3] = {
+    { 0, 0, 0},
+    {-1, 0, 0}, { 1, 0, 0}, { 0,-1, 0}, { 0, 1, 0}, { 0, 0,-1}, { 0, 0, 1},
+    {-1,-1, 0}, {-1, 1, 0}, { 1,-1, 0}, { 1, 1, 0},
+    {-1, 0,-1}, {-1, 0, 1}, { 1, 0,-1}, { 1, 0, 1},
+    { 0,-1,-1}, { 0,-1, 1}, { 0, 1,-1}, { 0, 1, 1},
+    {-1,-1,-1}, {-1,-1, 1}, {-1, 1,-1}, {-1, 1, 1},
+    { 1,-1,-1}, { 1,-1, 1}, { 1, 1,-1}, { 1, 1, 1}
+  };
+
+  if (num_neighbors > 27)
+    num_neighbors = 27;
+
+  int ijk0 = static_cast<int> (floor (point.x * inverse_leaf_size_[0]) - static_cast<float> (min_b_[0]));
+  int ijk1 = static_cast<int> (floor (point.y * inverse_leaf_size_[1]) - static_cast<float> (min_b_[1]));
+  int ijk2 = static_cast<int> (floor (point.z * inverse_leaf_size_[2]) - static_cast<float> (min_b_[2]));
+
+  k_cells.reserve (num_neighbors);
+  for (int ni = 0; ni < num_neighbors; ni++)
+  {
+    int i = ijk0 + displacements[ni][0];
+    int j = ijk1 + displacements[ni][1];
+    int k = ijk2 + displacements[ni][2];
+
+    // Indices outside of the grid would alias other voxels
+    if (i < 0 || j < 0 || k < 0 || i >= div_b_[0] || j >= div_b_[1] || k >= div_b_[2])
+      continue;
+
+    int cell = findCellDirect (i * divb_mul_[0] + j * divb_mul_[1] + k * divb_mul_[2]);
+    if (cell >= 0)
+      k_cells.push_back (cell);
+  }
+
+  return (static_cast<int> (k_cells.size ()));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointT> int
-pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& reference_point, std::vector<LeafConstPtr> &neighbors)
+pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& reference_point, std::vector<int> &neighbors)
 {
   neighbors.clear ();
 
@@ -393,12 +557,9 @@ pcl::VoxelGridCovariance<PointT>::getNeighborhoodAtPoint (const PointT& referenc
     // Checking if the specified cell is in the grid
     if ((diff2min <= displacement.array ()).all () && (diff2max >= displacement.array ()).all ())
     {
-      typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (((ijk + displacement - min_b_).dot (divb_mul_)));
-      if (leaf_iter != leaves_.end () && leaf_iter->second.nr_points >= min_points_per_voxel_)
-      {
-        LeafConstPtr leaf = &(leaf_iter->second);
-        neighbors.push_back (leaf);
-      }
+      int cell = getCell ((ijk + displacement - min_b_).dot (divb_mul_));
+      if (cell >= 0)
+        neighbors.push_back (cell);
     }
   }
 
@@ -423,23 +584,18 @@ pcl::VoxelGridCovariance<PointT>::getDisplayCloud (pcl::PointCloud<PointXYZ>& ce
   Eigen::Vector3d dist_point;
 
   // Generate points for each occupied voxel with sufficient points.
-  for (typename std::map<size_t, Leaf>::iterator it = leaves_.begin (); it != leaves_.end (); ++it)
+  for (size_t c = 0; c < cell_keys_.size (); ++c)
   {
-    Leaf& leaf = it->second;
+    cell_mean = cell_means_[c];
+    llt_of_cov.compute (cell_covs_[c]);
+    cholesky_decomp = llt_of_cov.matrixL ();
 
-    if (leaf.nr_points >= min_points_per_voxel_)
+    // Random points generated by sampling the normal distribution given by voxel mean and covariance matrix
+    for (int i = 0; i < pnt_per_cell; i++)
     {
-      cell_mean = leaf.mean_;
-      llt_of_cov.compute (leaf.cov_);
-      cholesky_decomp = llt_of_cov.matrixL ();
-
-      // Random points generated by sampling the normal distribution given by voxel mean and covariance matrix
-      for (int i = 0; i < pnt_per_cell; i++)
-      {
-        rand_point = Eigen::Vector3d (var_nor (), var_nor (), var_nor ());
-        dist_point = cell_mean + cholesky_decomp * rand_point;
-        cell_cloud.push_back (PointXYZ (static_cast<float> (dist_point (0)), static_cast<float> (dist_point (1)), static_cast<float> (dist_point (2))));
-      }
+      rand_point = Eigen::Vector3d (var_nor (), var_nor (), var_nor ());
+      dist_point = cell_mean + cholesky_decomp * rand_point;
+      cell_cloud.push_back (PointXYZ (static_cast<float> (dist_point (0)), static_cast<float> (dist_point (1)), static_cast<float> (dist_point (2))));
     }
   }
 }
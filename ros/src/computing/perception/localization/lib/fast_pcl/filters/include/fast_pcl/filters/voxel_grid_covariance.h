@@ -43,7 +43,8 @@
 #include "fast_pcl/filters/boost.h"
 #include "fast_pcl/filters/voxel_grid.h"
 
-#include <map>
+#include <algorithm>
+#include <vector>
 #include <pcl/point_types.h>
 #include <pcl/kdtree/kdtree_flann.h>
 
@@ -54,6 +55,9 @@ namespace pcl
     * <b>Magnusson, M. (2009). The Three-Dimensional Normal-Distributions Transform —
     * an Efﬁcient Representation for Registration, Surface Analysis, and Loop Detection.
     * PhD thesis, Orebro University. Orebro Studies in Technology 36</b>
+    * \note Cells are stored as a structure of arrays sorted by voxel index and addressed by cell index.
+    * Only voxels containing a sufficient number of points are kept, and only x, y and z of their centroids
+    * are written to the output cloud.
     * \author Brian Okorn (Space and Naval Warfare Systems Center Pacific)
     */
   template<typename PointT>
@@ -90,111 +94,11 @@ namespace pcl
       typedef boost::shared_ptr< VoxelGrid<PointT> > Ptr;
       typedef boost::shared_ptr< const VoxelGrid<PointT> > ConstPtr;
 
+      /** \brief Aligned array of 3D vectors, one element per cell. */
+      typedef std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > Vector3dArray;
 
-      /** \brief Simple structure to hold a centroid, covarince and the number of points in a leaf.
-        * Inverse covariance, eigen vectors and engen values are precomputed. */
-      struct Leaf
-      {
-        /** \brief Constructor.
-         * Sets \ref nr_points, \ref icov_, \ref mean_ and \ref evals_ to 0 and \ref cov_ and \ref evecs_ to the identity matrix
-         */
-        Leaf () :
-          nr_points (0),
-          mean_ (Eigen::Vector3d::Zero ()),
-          centroid (),
-          cov_ (Eigen::Matrix3d::Identity ()),
-          icov_ (Eigen::Matrix3d::Zero ()),
-          evecs_ (Eigen::Matrix3d::Identity ()),
-          evals_ (Eigen::Vector3d::Zero ())
-        {
-        }
-
-        /** \brief Get the voxel covariance.
-          * \return covariance matrix
-          */
-        Eigen::Matrix3d
-        getCov () const
-        {
-          return (cov_);
-        }
-
-        /** \brief Get the inverse of the voxel covariance.
-          * \return inverse covariance matrix
-          */
-        Eigen::Matrix3d
-        getInverseCov () const
-        {
-          return (icov_);
-        }
-
-        /** \brief Get the voxel centroid.
-          * \return centroid
-          */
-        Eigen::Vector3d
-        getMean () const
-        {
-          return (mean_);
-        }
-
-        /** \brief Get the eigen vectors of the voxel covariance.
-          * \note Order corresponds with \ref getEvals
-          * \return matrix whose columns contain eigen vectors
-          */
-        Eigen::Matrix3d
-        getEvecs () const
-        {
-          return (evecs_);
-        }
-
-        /** \brief Get the eigen values of the voxel covariance.
-          * \note Order corresponds with \ref getEvecs
-          * \return vector of eigen values
-          */
-        Eigen::Vector3d
-        getEvals () const
-        {
-          return (evals_);
-        }
-
-        /** \brief Get the number of points contained by this voxel.
-          * \return number of points
-          */
-        int
-        getPointCount () const
-        {
-          return (nr_points);
-        }
-
-        /** \brief Number of points contained by voxel */
-        int nr_points;
-
-        /** \brief 3D voxel centroid */
-        Eigen::Vector3d mean_;
-
-        /** \brief Nd voxel centroid
-         * \note Differs from \ref mean_ when color data is used
-         */
-        Eigen::VectorXf centroid;
-
-        /** \brief Voxel covariance matrix */
-        Eigen::Matrix3d cov_;
-
-        /** \brief Inverse of voxel covariance matrix */
-        Eigen::Matrix3d icov_;
-
-        /** \brief Eigen vectors of voxel covariance matrix */
-        Eigen::Matrix3d evecs_;
-
-        /** \brief Eigen values of voxel covariance matrix */
-        Eigen::Vector3d evals_;
-
-      };
-
-      /** \brief Pointer to VoxelGridCovariance leaf structure */
-      typedef Leaf* LeafPtr;
-
-      /** \brief Const pointer to VoxelGridCovariance leaf structure */
-      typedef const Leaf* LeafConstPtr;
+      /** \brief Aligned array of 3x3 matrices, one element per cell. */
+      typedef std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > Matrix3dArray;
 
     public:
 
@@ -205,10 +109,16 @@ namespace pcl
         searchable_ (true),
         min_points_per_voxel_ (6),
         min_covar_eigvalue_mult_ (0.01),
-        leaves_ (),
+        cell_keys_ (),
+        cell_nr_points_ (),
+        cell_means_ (),
+        cell_covs_ (),
+        cell_icovs_ (),
         voxel_centroids_ (),
-        voxel_centroids_leaf_indices_ (),
-        kdtree_ ()
+        kdtree_ (),
+        cell_hash_keys_ (),
+        cell_hash_cells_ (),
+        cell_hash_mask_ (0)
       {
         downsample_all_data_ = false;
         save_leaf_layout_ = false;
@@ -298,29 +208,111 @@ namespace pcl
         }
       }
 
-      /** \brief Get the voxel containing point p.
-       * \param[in] index the index of the leaf structure node
-       * \return const pointer to leaf structure
+      /** \brief Initializes voxel structure from the cells of other grids, without revisiting their points.
+       * \note All grids must use the leaf size of this grid. Cells are copied as they are, so a voxel split
+       * between grids is not recombined; when several grids contain the same voxel, the first grid wins.
+       * A merge that yields no cells leaves the grid unsearchable.
+       * \param[in] grids the grids to merge
+       * \param[in] searchable flag if voxel structure is searchable, if true then kdtree is built
        */
-      inline LeafConstPtr
-      getLeaf (int index)
+      inline void
+      merge (const std::vector<const VoxelGridCovariance<PointT>*> &grids, bool searchable = false)
       {
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (index);
-        if (leaf_iter != leaves_.end ())
+        searchable_ = searchable;
+        voxel_centroids_ = PointCloudPtr (new PointCloud);
+        applyMerge (grids, *voxel_centroids_);
+
+        if (searchable_ && voxel_centroids_->size() > 0)
         {
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
+          // Initiates kdtree of the centroids of voxels containing a sufficient number of points
+          kdtree_.setInputCloud (voxel_centroids_);
         }
         else
-          return NULL;
+        {
+          // An empty window would leave the kdtree indexing the cells of a previous merge
+          searchable_ = false;
+        }
+      }
+
+      /** \brief Get the number of cells containing a sufficient number of points.
+       * \return number of cells
+       */
+      inline int
+      getCellCount () const
+      {
+        return (static_cast<int> (cell_keys_.size ()));
       }
 
-      /** \brief Get the voxel containing point p.
-       * \param[in] p the point to get the leaf structure at
-       * \return const pointer to leaf structure
+      /** \brief Get the voxel index of a cell.
+       * \param[in] cell cell index in [0, \ref getCellCount)
+       * \return voxel index computed from \ref min_b_ and \ref divb_mul_
        */
-      inline LeafConstPtr
-      getLeaf (PointT &p)
+      inline int
+      getCellKey (int cell) const
+      {
+        return (cell_keys_[cell]);
+      }
+
+      /** \brief Get the number of points contained by a cell.
+       * \param[in] cell cell index in [0, \ref getCellCount)
+       * \return number of points
+       */
+      inline int
+      getCellPointCount (int cell) const
+      {
+        return (cell_nr_points_[cell]);
+      }
+
+      /** \brief Get the centroid of a cell.
+       * \param[in] cell cell index in [0, \ref getCellCount)
+       * \return centroid
+       */
+      inline const Eigen::Vector3d&
+      getCellMean (int cell) const
+      {
+        return (cell_means_[cell]);
+      }
+
+      /** \brief Get the covariance of a cell.
+       * \param[in] cell cell index in [0, \ref getCellCount)
+       * \return covariance matrix
+       */
+      inline const Eigen::Matrix3d&
+      getCellCov (int cell) const
+      {
+        return (cell_covs_[cell]);
+      }
+
+      /** \brief Get the inverse of the covariance of a cell.
+       * \param[in] cell cell index in [0, \ref getCellCount)
+       * \return inverse covariance matrix
+       */
+      inline const Eigen::Matrix3d&
+      getCellInverseCov (int cell) const
+      {
+        return (cell_icovs_[cell]);
+      }
+
+      /** \brief Get the cell with the given voxel index.
+       * \param[in] index the voxel index computed from \ref min_b_ and \ref divb_mul_
+       * \return cell index, -1 if the voxel does not contain a sufficient number of points
+       */
+      inline int
+      getCell (int index)
+      {
+        std::vector<int>::const_iterator it = std::lower_bound (cell_keys_.begin (), cell_keys_.end (), index);
+        if (it != cell_keys_.end () && *it == index)
+          return (static_cast<int> (it - cell_keys_.begin ()));
+        else
+          return (-1);
+      }
+
+      /** \brief Get the cell containing point p.
+       * \param[in] p the point to get the cell at
+       * \return cell index, -1 if the voxel does not contain a sufficient number of points
+       */
+      inline int
+      getCell (const PointT &p)
       {
         // Generate index associated with p
         int ijk0 = static_cast<int> (floor (p.x * inverse_leaf_size_[0]) - min_b_[0]);
@@ -328,26 +320,15 @@ namespace pcl
         int ijk2 = static_cast<int> (floor (p.z * inverse_leaf_size_[2]) - min_b_[2]);
 
         // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
-        else
-          return NULL;
+        return (getCell (ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2]));
       }
 
-      /** \brief Get the voxel containing point p.
-       * \param[in] p the point to get the leaf structure at
-       * \return const pointer to leaf structure
+      /** \brief Get the cell containing point p.
+       * \param[in] p the point to get the cell at
+       * \return cell index, -1 if the voxel does not contain a sufficient number of points
        */
-      inline LeafConstPtr
-      getLeaf (Eigen::Vector3f &p)
+      inline int
+      getCell (const Eigen::Vector3f &p)
       {
         // Generate index associated with p
         int ijk0 = static_cast<int> (floor (p[0] * inverse_leaf_size_[0]) - min_b_[0]);
@@ -355,38 +336,17 @@ namespace pcl
         int ijk2 = static_cast<int> (floor (p[2] * inverse_leaf_size_[2]) - min_b_[2]);
 
         // Compute the centroid leaf index
-        int idx = ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2];
-
-        // Find leaf associated with index
-        typename std::map<size_t, Leaf>::iterator leaf_iter = leaves_.find (idx);
-        if (leaf_iter != leaves_.end ())
-        {
-          // If such a leaf exists return the pointer to the leaf structure
-          LeafConstPtr ret (&(leaf_iter->second));
-          return ret;
-        }
-        else
-          return NULL;
-
+        return (getCell (ijk0 * divb_mul_[0] + ijk1 * divb_mul_[1] + ijk2 * divb_mul_[2]));
       }
 
-      /** \brief Get the voxels surrounding point p, not including the voxel contating point p.
+      /** \brief Get the cells surrounding point p, not including the voxel contating point p.
        * \note Only voxels containing a sufficient number of points are used (slower than radius search in practice).
        * \param[in] reference_point the point to get the leaf structure at
-       * \param[out] neighbors
+       * \param[out] neighbors cell indices of the neighbors
        * \return number of neighbors found
        */
       int
-      getNeighborhoodAtPoint (const PointT& reference_point, std::vector<LeafConstPtr> &neighbors);
-
-      /** \brief Get the leaf structure map
-       * \return a map contataining all leaves
-       */
-      inline const std::map<size_t, Leaf>&
-      getLeaves ()
-      {
-        return leaves_;
-      }
+      getNeighborhoodAtPoint (const PointT& reference_point, std::vector<int> &neighbors);
 
       /** \brief Get a pointcloud containing the voxel centroids
        * \note Only voxels containing a sufficient number of points are used.
@@ -409,15 +369,15 @@ namespace pcl
        * \note Only voxels containing a sufficient number of points are used.
        * \param[in] point the given query point
        * \param[in] k the number of neighbors to search for
-       * \param[out] k_leaves the resultant leaves of the neighboring points
+       * \param[out] k_cells the resultant cell indices of the neighboring points
        * \param[out] k_sqr_distances the resultant squared distances to the neighboring points
        * \return number of neighbors found
        */
       int
       nearestKSearch (const PointT &point, int k,
-                      std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances)
+                      std::vector<int> &k_cells, std::vector<float> &k_sqr_distances)
       {
-        k_leaves.clear ();
+        k_cells.clear ();
 
         // Check if kdtree has been built
         if (!searchable_)
@@ -426,17 +386,8 @@ namespace pcl
           return 0;
         }
 
-        // Find k-nearest neighbors in the occupied voxel centroid cloud
-        std::vector<int> k_indices;
-        k = kdtree_.nearestKSearch (point, k, k_indices, k_sqr_distances);
-
-        // Find leaves corresponding to neighbors
-        k_leaves.reserve (k);
-        for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
-        {
-          k_leaves.push_back (&leaves_[voxel_centroids_leaf_indices_[*iter]]);
-        }
-        return k;
+        // Centroid cloud points are stored in cell order, so kdtree indices are cell indices
+        return (kdtree_.nearestKSearch (point, k, k_cells, k_sqr_distances));
       }
 
       /** \brief Search for the k-nearest occupied voxels for the given query point.
@@ -444,17 +395,17 @@ namespace pcl
        * \param[in] cloud the given query point
        * \param[in] index the index
        * \param[in] k the number of neighbors to search for
-       * \param[out] k_leaves the resultant leaves of the neighboring points
+       * \param[out] k_cells the resultant cell indices of the neighboring points
        * \param[out] k_sqr_distances the resultant squared distances to the neighboring points
        * \return number of neighbors found
        */
       inline int
       nearestKSearch (const PointCloud &cloud, int index, int k,
-                      std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances)
+                      std::vector<int> &k_cells, std::vector<float> &k_sqr_distances)
       {
         if (index >= static_cast<int> (cloud.points.size ()) || index < 0)
           return (0);
-        return (nearestKSearch (cloud.points[index], k, k_leaves, k_sqr_distances));
+        return (nearestKSearch (cloud.points[index], k, k_cells, k_sqr_distances));
       }
 
 
@@ -462,16 +413,16 @@ namespace pcl
        * \note Only voxels containing a sufficient number of points are used.
        * \param[in] point the given query point
        * \param[in] radius the radius of the sphere bounding all of p_q's neighbors
-       * \param[out] k_leaves the resultant leaves of the neighboring points
+       * \param[out] k_cells the resultant cell indices of the neighboring points
        * \param[out] k_sqr_distances the resultant squared distances to the neighboring points
        * \param[in] max_nn
        * \return number of neighbors found
        */
       int
-      radiusSearch (const PointT &point, double radius, std::vector<LeafConstPtr> &k_leaves,
+      radiusSearch (const PointT &point, double radius, std::vector<int> &k_cells,
                     std::vector<float> &k_sqr_distances, unsigned int max_nn = 0)
       {
-        k_leaves.clear ();
+        k_cells.clear ();
 
         // Check if kdtree has been built
         if (!searchable_)
@@ -480,17 +431,8 @@ namespace pcl
           return 0;
         }
 
-        // Find neighbors within radius in the occupied voxel centroid cloud
-        std::vector<int> k_indices;
-        int k = kdtree_.radiusSearch (point, radius, k_indices, k_sqr_distances, max_nn);
-
-        // Find leaves corresponding to neighbors
-        k_leaves.reserve (k);
-        for (std::vector<int>::iterator iter = k_indices.begin (); iter != k_indices.end (); iter++)
-        {
-          k_leaves.push_back (&leaves_[voxel_centroids_leaf_indices_[*iter]]);
-        }
-        return k;
+        // Centroid cloud points are stored in cell order, so kdtree indices are cell indices
+        return (kdtree_.radiusSearch (point, radius, k_cells, k_sqr_distances, max_nn));
       }
 
       /** \brief Search for all the nearest occupied voxels of the query point in a given radius.
@@ -498,21 +440,32 @@ namespace pcl
        * \param[in] cloud the given query point
        * \param[in] index a valid index in cloud representing a valid (i.e., finite) query point
        * \param[in] radius the radius of the sphere bounding all of p_q's neighbors
-       * \param[out] k_leaves the resultant leaves of the neighboring points
+       * \param[out] k_cells the resultant cell indices of the neighboring points
        * \param[out] k_sqr_distances the resultant squared distances to the neighboring points
        * \param[in] max_nn
        * \return number of neighbors found
        */
       inline int
       radiusSearch (const PointCloud &cloud, int index, double radius,
-                    std::vector<LeafConstPtr> &k_leaves, std::vector<float> &k_sqr_distances,
+                    std::vector<int> &k_cells, std::vector<float> &k_sqr_distances,
                     unsigned int max_nn = 0)
       {
         if (index >= static_cast<int> (cloud.points.size ()) || index < 0)
           return (0);
-        return (radiusSearch (cloud.points[index], radius, k_leaves, k_sqr_distances, max_nn));
+        return (radiusSearch (cloud.points[index], radius, k_cells, k_sqr_distances, max_nn));
       }
 
+      /** \brief Search for the occupied voxels around the query point by direct voxel index lookup.
+       * \note Only voxels containing a sufficient number of points are used.
+       * Each lookup is O(1) through an open-addressing hash keyed by voxel index, so no kdtree is involved.
+       * \param[in] point the given query point
+       * \param[in] num_neighbors 1 (voxel containing point), 7 (plus face neighbors) or 27 (full 3x3x3 block)
+       * \param[out] k_cells the resultant cell indices, voxel containing point first
+       * \return number of neighbors found
+       */
+      int
+      directSearch (const PointT &point, int num_neighbors, std::vector<int> &k_cells);
+
     protected:
 
       /** \brief Filter cloud and initializes voxel structure.
@@ -520,6 +473,36 @@ namespace pcl
        */
       void applyFilter (PointCloud &output);
 
+      /** \brief Initializes voxel structure from the cells of other grids.
+        * \param[in] grids the grids to merge
+        * \param[out] output cloud containing centroids of the merged cells
+        */
+      void applyMerge (const std::vector<const VoxelGridCovariance<PointT>*> &grids, PointCloud &output);
+
+      /** \brief Build \ref cell_hash_keys_ and \ref cell_hash_cells_ from \ref cell_keys_. */
+      void buildCellHash ();
+
+      /** \brief Find the cell with the given voxel index in the direct search hash table.
+       * \param[in] idx voxel index computed from \ref min_b_ and \ref divb_mul_
+       * \return cell index, -1 if the voxel is empty or has too few points
+       */
+      inline int
+      findCellDirect (int idx) const
+      {
+        if (cell_hash_keys_.empty ())
+          return (-1);
+
+        // Linear probing, the table is kept at most half full so the loop always reaches an empty slot
+        size_t slot = (static_cast<uint32_t> (idx) * 2654435761u) & cell_hash_mask_;
+        while (cell_hash_keys_[slot] != -1)
+        {
+          if (cell_hash_keys_[slot] == idx)
+            return (cell_hash_cells_[slot]);
+          slot = (slot + 1) & cell_hash_mask_;
+        }
+        return (-1);
+      }
+
       /** \brief Flag to determine if voxel structure is searchable. */
       bool searchable_;
 
@@ -529,17 +512,38 @@ namespace pcl
       /** \brief Minimum allowable ratio between eigenvalues to prevent singular covariance matrices. */
       double min_covar_eigvalue_mult_;
 
-      /** \brief Voxel structure containing all leaf nodes (includes voxels with less than a sufficient number of points). */
-      std::map<size_t, Leaf> leaves_;
+      /** \brief Voxel index of each cell, sorted in ascending order (only voxels with a sufficient number of points and a valid covariance). */
+      std::vector<int> cell_keys_;
 
-      /** \brief Point cloud containing centroids of voxels containing atleast minimum number of points. */
-      PointCloudPtr voxel_centroids_;
+      /** \brief Number of points contained by each cell. */
+      std::vector<int> cell_nr_points_;
+
+      /** \brief Centroid of each cell. */
+      Vector3dArray cell_means_;
+
+      /** \brief Covariance matrix of each cell. */
+      Matrix3dArray cell_covs_;
 
-      /** \brief Indices of leaf structurs associated with each point in \ref voxel_centroids_ (used for searching). */
-      std::vector<int> voxel_centroids_leaf_indices_;
+      /** \brief Inverse covariance matrix of each cell. */
+      Matrix3dArray cell_icovs_;
+
+      /** \brief Point cloud containing centroids of voxels containing atleast minimum number of points, in cell order. */
+      PointCloudPtr voxel_centroids_;
 
       /** \brief KdTree generated using \ref voxel_centroids_ (used for searching). */
       KdTreeFLANN<PointT> kdtree_;
+
+      /** \brief Voxel indices of the open-addressing hash used by \ref directSearch (-1 marks an empty slot). */
+      std::vector<int> cell_hash_keys_;
+
+      /** \brief Cell index associated with each slot of \ref cell_hash_keys_. */
+      std::vector<int> cell_hash_cells_;
+
+      /** \brief Size of \ref cell_hash_keys_ minus one (the size is a power of two). */
+      size_t cell_hash_mask_;
+
+    public:
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
 }
 
@@ -43,19 +43,34 @@
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget>
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributionsTransform ()
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributionsTransform (unsigned int nr_threads)
   : target_cells_ ()
+  , target_tiles_ ()
+  , coarse_cells_ ()
+  , active_cells_ (&target_cells_)
+  , active_resolution_ (1.0f)
   , resolution_ (1.0f)
+  , resolution_levels_ (1)
+  , search_method_ (KDTREE)
+  , use_batched_derivatives_ (false)
+  , threads_ (nr_threads)
   , step_size_ (0.1)
   , outlier_ratio_ (0.55)
   , gauss_d1_ ()
   , gauss_d2_ ()
   , trans_probability_ ()
+  , level_guess_probability_ ()
+  , level_step_converged_ (false)
   , j_ang_a_ (), j_ang_b_ (), j_ang_c_ (), j_ang_d_ (), j_ang_e_ (), j_ang_f_ (), j_ang_g_ (), j_ang_h_ ()
   , h_ang_a2_ (), h_ang_a3_ (), h_ang_b2_ (), h_ang_b3_ (), h_ang_c2_ (), h_ang_c3_ (), h_ang_d1_ (), h_ang_d2_ ()
   , h_ang_d3_ (), h_ang_e1_ (), h_ang_e2_ (), h_ang_e3_ (), h_ang_f1_ (), h_ang_f2_ (), h_ang_f3_ ()
   , point_gradient_ ()
   , point_hessian_ ()
+  , thread_score_ ()
+  , thread_score_gradient_ ()
+  , thread_hessian_ ()
+  , thread_point_gradient_ ()
+  , thread_point_hessian_ ()
 {
   reg_name_ = "NormalDistributionsTransform";
 
@@ -74,115 +89,102 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::NormalDistributions
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> void
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::addTargetTile (int64_t id, const PointCloudTargetConstPtr &cloud)
 {
-  nr_iterations_ = 0;
-  converged_ = false;
-
-  double gauss_c1, gauss_c2, gauss_d3;
-
-  // Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
-  gauss_c1 = 10 * (1 - outlier_ratio_);
-  gauss_c2 = outlier_ratio_ / pow (resolution_, 3);
-  gauss_d3 = -log (gauss_c2);
-  gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
-  gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
-
-  if (guess != Eigen::Matrix4f::Identity ())
+  std::vector<TargetTileGridPtr> &grids = target_tiles_[id];
+  grids.resize (resolution_levels_);
+  for (int level = 0; level < resolution_levels_; ++level)
   {
-    // Initialise final transformation to the guessed one
-    final_transformation_ = guess;
-    // Apply guessed transformation prior to search for neighbours
-    transformPointCloud (output, output, guess);
+    float level_resolution = getLevelResolution (level);
+    grids[level].reset (new TargetGrid);
+    grids[level]->setLeafSize (level_resolution, level_resolution, level_resolution);
+    grids[level]->setInputCloud (cloud);
+    // Tiles are only searched through the merged grids, no kdtree or hash is needed
+    grids[level]->filter (false);
   }
+}
 
-  // Initialize Point Gradient and Hessian
-  point_gradient_.setZero ();
-  point_gradient_.block<3, 3>(0, 0).setIdentity ();
-  point_hessian_.setZero ();
-
-  Eigen::Transform<float, 3, Eigen::Affine, Eigen::ColMajor> eig_transformation;
-  eig_transformation.matrix () = final_transformation_;
-
-  // Convert initial guess matrix to 6 element transformation vector
-  Eigen::Matrix<double, 6, 1> p, delta_p, score_gradient;
-  Eigen::Vector3f init_translation = eig_transformation.translation ();
-  Eigen::Vector3f init_rotation = eig_transformation.rotation ().eulerAngles (0, 1, 2);
-  p << init_translation (0), init_translation (1), init_translation (2),
-  init_rotation (0), init_rotation (1), init_rotation (2);
-
-  Eigen::Matrix<double, 6, 6> hessian;
-
-  double score = 0;
-  double delta_p_norm;
-
-  // Calculate derivates of initial transform vector, subsequent derivative calculations are done in the step length determination.
-  score = computeDerivatives (score_gradient, hessian, output, p);
-
-  while (!converged_)
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateTargetTiles ()
+{
+  coarse_cells_.resize (resolution_levels_ - 1);
+  for (int level = 0; level < resolution_levels_; ++level)
   {
-    // Store previous transformation
-    previous_transformation_ = transformation_;
-
-    // Solve for decent direction using newton method, line 23 in Algorithm 2 [Magnusson 2009]
-    Eigen::JacobiSVD<Eigen::Matrix<double, 6, 6> > sv (hessian, Eigen::ComputeFullU | Eigen::ComputeFullV);
-    // Negative for maximization as opposed to minimization
-    delta_p = sv.solve (-score_gradient);
-
-    //Calculate step length with guarnteed sufficient decrease [More, Thuente 1994]
-    delta_p_norm = delta_p.norm ();
-
-    if (delta_p_norm == 0 || delta_p_norm != delta_p_norm)
-    {
-      trans_probability_ = score / static_cast<double> (input_->points.size ());
-      converged_ = delta_p_norm == delta_p_norm;
-      return;
-    }
-
-    delta_p.normalize ();
-    delta_p_norm = computeStepLengthMT (p, delta_p, delta_p_norm, step_size_, transformation_epsilon_ / 2, score, score_gradient, hessian, output);
-    delta_p *= delta_p_norm;
-
-
-    transformation_ = (Eigen::Translation<float, 3> (static_cast<float> (delta_p (0)), static_cast<float> (delta_p (1)), static_cast<float> (delta_p (2))) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (3)), Eigen::Vector3f::UnitX ()) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (4)), Eigen::Vector3f::UnitY ()) *
-                       Eigen::AngleAxis<float> (static_cast<float> (delta_p (5)), Eigen::Vector3f::UnitZ ())).matrix ();
-
+    std::vector<const TargetGrid*> grids;
+    grids.reserve (target_tiles_.size ());
+    for (typename std::map<int64_t, std::vector<TargetTileGridPtr> >::const_iterator it = target_tiles_.begin (); it != target_tiles_.end (); ++it)
+      grids.push_back (it->second[level].get ());
+
+    float level_resolution = getLevelResolution (level);
+    if (level > 0 && !coarse_cells_[level - 1])
+      coarse_cells_[level - 1].reset (new TargetGrid);
+    TargetGrid &cells = level == 0 ? target_cells_ : *coarse_cells_[level - 1];
+    cells.setLeafSize (level_resolution, level_resolution, level_resolution);
+    cells.merge (grids, true);
+  }
 
-    p = p + delta_p;
+  // An empty window has no target, align then fails instead of matching against the previous window
+  if (target_cells_.getCellCount () == 0)
+  {
+    target_.reset ();
+    return;
+  }
 
-    // Update Visualizer (untested)
-    if (update_visualizer_ != 0)
-      update_visualizer_ (output, std::vector<int>(), *target_, std::vector<int>() );
+  // The map points of the tiles are the target, so the fitness score measures the same as with setInputTarget
+  PointCloudTargetPtr points (new PointCloudTarget);
+  for (typename std::map<int64_t, std::vector<TargetTileGridPtr> >::const_iterator it = target_tiles_.begin (); it != target_tiles_.end (); ++it)
+    *points += *it->second[0]->getInputCloud ();
+  Registration<PointSource, PointTarget>::setInputTarget (points);
+}
 
-    if (nr_iterations_ > max_iterations_ ||
-        (nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_)))
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::init ()
+{
+  if (!target_tiles_.empty ())
+  {
+    // Revoxelize every tile with the new resolution
+    for (typename std::map<int64_t, std::vector<TargetTileGridPtr> >::iterator it = target_tiles_.begin (); it != target_tiles_.end (); ++it)
     {
-      converged_ = true;
+      PointCloudTargetConstPtr cloud = it->second[0]->getInputCloud ();
+      addTargetTile (it->first, cloud);
     }
+    updateTargetTiles ();
+    return;
+  }
 
-    nr_iterations_++;
+  target_cells_.setLeafSize (resolution_, resolution_, resolution_);
+  target_cells_.setInputCloud ( target_ );
+  // Initiate voxel structure.
+  target_cells_.filter (true);
 
+  // Coarse levels are voxelized from the same points
+  coarse_cells_.resize (resolution_levels_ - 1);
+  for (int level = 1; level < resolution_levels_; ++level)
+  {
+    float level_resolution = getLevelResolution (level);
+    coarse_cells_[level - 1].reset (new TargetGrid);
+    coarse_cells_[level - 1]->setLeafSize (level_resolution, level_resolution, level_resolution);
+    coarse_cells_[level - 1]->setInputCloud (target_);
+    coarse_cells_[level - 1]->filter (true);
   }
-
-  // Store transformation probability.  The realtive differences within each scan registration are accurate
-  // but the normalization constants need to be modified for it to be globally accurate
-  trans_probability_ = score / static_cast<double> (input_->points.size ());
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> void
-pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeLevelTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess,
+                                                                                         bool use_omp)
 {
   nr_iterations_ = 0;
   converged_ = false;
+  level_step_converged_ = false;
 
   double gauss_c1, gauss_c2, gauss_d3;
 
   // Initializes the guassian fitting parameters (eq. 6.8) [Magnusson 2009]
   gauss_c1 = 10 * (1 - outlier_ratio_);
-  gauss_c2 = outlier_ratio_ / pow (resolution_, 3);
+  gauss_c2 = outlier_ratio_ / pow (active_resolution_, 3);
   gauss_d3 = -log (gauss_c2);
   gauss_d1_ = -log ( gauss_c1 + gauss_c2 ) - gauss_d3;
   gauss_d2_ = -2 * log ((-log ( gauss_c1 * exp ( -0.5 ) + gauss_c2 ) - gauss_d3) / gauss_d1_);
@@ -216,7 +218,11 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransfor
   double delta_p_norm;
 
   // Calculate derivates of initial transform vector, subsequent derivative calculations are done in the step length determination.
-  score = omp_computeDerivatives (score_gradient, hessian, output, p);
+  if (use_omp)
+    score = omp_computeDerivatives (score_gradient, hessian, output, p);
+  else
+    score = computeDerivatives (score_gradient, hessian, output, p);
+  level_guess_probability_ = score / static_cast<double> (input_->points.size ());
 
   while (!converged_)
   {
@@ -234,7 +240,7 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransfor
     if (delta_p_norm == 0 || delta_p_norm != delta_p_norm)
     {
       trans_probability_ = score / static_cast<double> (input_->points.size ());
-      converged_ = delta_p_norm == delta_p_norm;
+      converged_ = level_step_converged_ = delta_p_norm == delta_p_norm;
       return;
     }
 
@@ -255,8 +261,11 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransfor
     if (update_visualizer_ != 0)
       update_visualizer_ (output, std::vector<int>(), *target_, std::vector<int>() );
 
-    if (nr_iterations_ > max_iterations_ ||
-        (nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_)))
+    if (nr_iterations_ && (std::fabs (delta_p_norm) < transformation_epsilon_))
+    {
+      converged_ = level_step_converged_ = true;
+    }
+    else if (nr_iterations_ > max_iterations_)
     {
       converged_ = true;
     }
@@ -270,6 +279,57 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransfor
   trans_probability_ = score / static_cast<double> (input_->points.size ());
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> Eigen::Matrix4f
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::alignCoarseLevels (const PointCloudSource &output, const Eigen::Matrix4f &guess,
+                                                                                bool use_omp, int &nr_iterations)
+{
+  Eigen::Matrix4f level_guess = guess;
+  nr_iterations = 0;
+
+  // Coarsest level first, each level starts from the transform found by the previous one
+  for (int level = static_cast<int> (coarse_cells_.size ()); level > 0; --level)
+  {
+    if (coarse_cells_[level - 1]->getCellCount () == 0)
+      continue;
+
+    PointCloudSource level_output (output);
+    setActiveLevel (level);
+    final_transformation_ = transformation_ = previous_transformation_ = Eigen::Matrix4f::Identity ();
+    computeLevelTransformation (level_output, level_guess, use_omp);
+
+    nr_iterations += nr_iterations_;
+    // A coarse level cut by the iteration limit or ending on a worse score than its guess would only mislead the
+    // finer ones
+    if (level_step_converged_ && trans_probability_ >= level_guess_probability_)
+      level_guess = final_transformation_;
+  }
+
+  setActiveLevel (0);
+  final_transformation_ = transformation_ = previous_transformation_ = Eigen::Matrix4f::Identity ();
+  return (level_guess);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+{
+  int coarse_iterations;
+  Eigen::Matrix4f fine_guess = alignCoarseLevels (output, guess, false, coarse_iterations);
+  computeLevelTransformation (output, fine_guess, false);
+  nr_iterations_ += coarse_iterations;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess)
+{
+  int coarse_iterations;
+  Eigen::Matrix4f fine_guess = alignCoarseLevels (output, guess, true, coarse_iterations);
+  computeLevelTransformation (output, fine_guess, true);
+  nr_iterations_ += coarse_iterations;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> double
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
@@ -278,12 +338,15 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
                                                                                  Eigen::Matrix<double, 6, 1> &p,
                                                                                  bool compute_hessian)
 {
+  if (use_batched_derivatives_)
+    return (batch_computeDerivatives (score_gradient, hessian, trans_cloud, p, compute_hessian));
+
   // Original Point and Transformed Point
   PointSource x_pt, x_trans_pt;
   // Original Point and Transformed Point (for math)
   Eigen::Vector3d x, x_trans;
   // Occupied Voxel
-  TargetGridLeafConstPtr cell;
+  int cell;
   // Inverse Covariance of Occupied Voxel
   Eigen::Matrix3d c_inv;
 
@@ -299,12 +362,12 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
   {
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-    std::vector<TargetGridLeafConstPtr> neighborhood;
+    // Find nieghbors (Radius search by default, direct voxel lookup when selected by search_method_)
+    std::vector<int> neighborhood;
     std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    searchNeighborhood (x_trans_pt, neighborhood, distances);
 
-    for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+    for (std::vector<int>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
       cell = *neighborhood_it;
       x_pt = input_->points[idx];
@@ -313,9 +376,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeDerivatives
       x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z);
 
       // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
-      x_trans -= cell->getMean ();
+      x_trans -= active_cells_->getCellMean (cell);
       // Uses precomputed covariance for speed.
-      c_inv = cell->getInverseCov ();
+      c_inv = active_cells_->getCellInverseCov (cell);
 
       // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
       computePointDerivatives (x);
@@ -336,14 +399,8 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeDerivati
                                                                                  Eigen::Matrix<double, 6, 1> &p,
                                                                                  bool compute_hessian)
 {
-  // Original Point and Transformed Point
-  PointSource x_pt, x_trans_pt;
-  // Original Point and Transformed Point (for math)
-  Eigen::Vector3d x, x_trans;
-  // Occupied Voxel
-  TargetGridLeafConstPtr cell;
-  // Inverse Covariance of Occupied Voxel
-  Eigen::Matrix3d c_inv;
+  if (use_batched_derivatives_)
+    return (batch_computeDerivatives (score_gradient, hessian, trans_cloud, p, compute_hessian));
 
   score_gradient.setZero ();
   hessian.setZero ();
@@ -353,103 +410,150 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::omp_computeDerivati
   computeAngleDerivatives (p);
 
 #ifdef _OPENMP
-  int num_threads = omp_get_max_threads() * 2;
-  Eigen::Matrix<double, 6, 1> score_gradient_i[num_threads];
-  Eigen::Matrix<double, 6, 6> hessian_i[num_threads];
-  for (int i = 0; i < num_threads; ++i) {
-      score_gradient_i[i].setZero ();
-      hessian_i[i].setZero ();
-  }
-
-  omp_set_nested(1);
-  omp_set_dynamic(1);
-#pragma omp parallel for num_threads(num_threads) reduction(+:score) private(x_pt, x_trans_pt, x, x_trans, cell, c_inv)
+  int num_threads = threads_ > 0 ? static_cast<int> (threads_) : omp_get_max_threads ();
+#else
+  int num_threads = 1;
 #endif
 
-  // Update gradient and hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
-  for (size_t idx = 0; idx < input_->points.size (); idx++)
+  // Per thread accumulators, only reallocated when the thread count changes.
+  // Point derivatives start from the initialized point_gradient_/point_hessian_ (constant identity block).
+  thread_score_.resize (num_threads);
+  thread_score_gradient_.resize (num_threads);
+  thread_hessian_.resize (num_threads);
+  thread_point_gradient_.resize (num_threads);
+  thread_point_hessian_.resize (num_threads);
+  for (int i = 0; i < num_threads; ++i)
   {
-    x_trans_pt = trans_cloud.points[idx];
+    thread_score_[i] = 0;
+    thread_score_gradient_[i].setZero ();
+    thread_hessian_[i].setZero ();
+    thread_point_gradient_[i] = point_gradient_;
+    thread_point_hessian_[i] = point_hessian_;
+  }
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-    std::vector<TargetGridLeafConstPtr> neighborhood;
+  int nr_points = static_cast<int> (input_->points.size ());
+
+  // One fixed size team, each thread takes one contiguous chunk of points (static schedule)
+#if defined(_OPENMP) && _OPENMP >= 201307
+#pragma omp parallel num_threads(num_threads) proc_bind(close)
+#elif defined(_OPENMP)
+#pragma omp parallel num_threads(num_threads)
+#endif
+  {
+#ifdef _OPENMP
+    int tid = omp_get_thread_num ();
+#else
+    int tid = 0;
+#endif
+    Eigen::Matrix<double, 3, 6> &point_gradient = thread_point_gradient_[tid];
+    Eigen::Matrix<double, 18, 6> &point_hessian = thread_point_hessian_[tid];
+
+    // Accumulate on the stack and publish once, avoiding false sharing between neighboring thread slots
+    Eigen::Matrix<double, 6, 1> local_gradient = Eigen::Matrix<double, 6, 1>::Zero ();
+    Eigen::Matrix<double, 6, 6> local_hessian = Eigen::Matrix<double, 6, 6>::Zero ();
+    double local_score = 0;
+
+    // Original Point and Transformed Point (for math)
+    Eigen::Vector3d x, x_trans;
+    // Inverse Covariance of Occupied Voxel
+    Eigen::Matrix3d c_inv;
+    std::vector<int> neighborhood;
     std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
 
-    for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+    // Update gradient and hessian for each point, line 17 in Algorithm 2 [Magnusson 2009]
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int idx = 0; idx < nr_points; idx++)
     {
-      cell = *neighborhood_it;
-      x_pt = input_->points[idx];
-      x = Eigen::Vector3d (x_pt.x, x_pt.y, x_pt.z);
+      const PointSource &x_trans_pt = trans_cloud.points[idx];
 
-      x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z);
+      // Find nieghbors (Radius search by default, direct voxel lookup when selected by search_method_)
+      searchNeighborhood (x_trans_pt, neighborhood, distances);
 
-      // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
-      x_trans -= cell->getMean ();
-      // Uses precomputed covariance for speed.
-      c_inv = cell->getInverseCov ();
+      const PointSource &x_pt = input_->points[idx];
+      x = Eigen::Vector3d (x_pt.x, x_pt.y, x_pt.z);
 
-      // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
-      computePointDerivatives (x);
-      // Update score, gradient and hessian, lines 19-21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
-      //score += updateDerivatives (score_gradient, hessian, x_trans, c_inv, compute_hessian);
+      for (std::vector<int>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
       {
-          Eigen::Vector3d cov_dxd_pi;
-          // e^(-d_2/2 * (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)) Equation 6.9 [Magnusson 2009]
-          double e_x_cov_x = exp (-gauss_d2_ * x_trans.dot (c_inv * x_trans) / 2);
-          // Calculate probability of transtormed points existance, Equation 6.9 [Magnusson 2009]
-          double score_inc = -gauss_d1_ * e_x_cov_x;
+        int cell = *neighborhood_it;
+
+        // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
+        x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z) - active_cells_->getCellMean (cell);
+        // Uses precomputed covariance for speed.
+        c_inv = active_cells_->getCellInverseCov (cell);
+
+        // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
+        computePointDerivatives (x, point_gradient, point_hessian, compute_hessian);
+        // Update score, gradient and hessian, lines 19-21 in Algorithm 2, according to Equations 6.10, 6.12 and 6.13, respectively [Magnusson 2009]
+        local_score += updateDerivatives (local_gradient, local_hessian, x_trans, c_inv, point_gradient, point_hessian, compute_hessian);
+      }
+    }
+
+    thread_score_[tid] = local_score;
+    thread_score_gradient_[tid] = local_gradient;
+    thread_hessian_[tid] = local_hessian;
+  }
 
-          e_x_cov_x = gauss_d2_ * e_x_cov_x;
+  // Reduce in thread order so that results do not depend on thread timing
+  for (int i = 0; i < num_threads; ++i)
+  {
+    score += thread_score_[i];
+    score_gradient += thread_score_gradient_[i];
+    hessian += thread_hessian_[i];
+  }
 
-          // Error checking for invalid values.
-          if (e_x_cov_x > 1 || e_x_cov_x < 0 || e_x_cov_x != e_x_cov_x) {
-              score_inc = 0;
-          } else {
-              // Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
-              e_x_cov_x *= gauss_d1_;
+  return (score);
+}
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::batch_computeDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                                                                                       Eigen::Matrix<double, 6, 6> &hessian,
+                                                                                       PointCloudSource &trans_cloud,
+                                                                                       Eigen::Matrix<double, 6, 1> &p,
+                                                                                       bool compute_hessian)
+{
+  score_gradient.setZero ();
+  hessian.setZero ();
+  double score = 0;
 
-              for (int i = 0; i < 6; i++)
-              {
-                  // Sigma_k^-1 d(T(x,p))/dpi, Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009o
-                  cov_dxd_pi = c_inv * point_gradient_.col (i);
+  // Precompute Angular Derivatives (eq. 6.19 and 6.21)[Magnusson 2009]
+  computeAngleDerivatives (p);
 
-                  // Update gradient, Equation 6.12 [Magnusson 2009]
-#ifdef _OPENMP
-                  score_gradient_i[omp_get_thread_num()] (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
-#else
-                  score_gradient (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
-#endif
-                  if (compute_hessian)
-                  {
-                      for (int j = 0; j < hessian.cols (); j++)
-                      {
-                          // Update hessian, Equation 6.13 [Magnusson 2009]
-#ifdef _OPENMP
-                          hessian_i[omp_get_thread_num()] (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                                         x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                                         point_gradient_.col (j).dot (cov_dxd_pi) );
-#else
-                          hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                                         x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                                         point_gradient_.col (j).dot (cov_dxd_pi) );
-#endif
-                      }
-                  }
-              }
-          }
-          score += score_inc;
-      }
+  const Eigen::Vector3d j_ang[8] = { j_ang_a_, j_ang_b_, j_ang_c_, j_ang_d_, j_ang_e_, j_ang_f_, j_ang_g_, j_ang_h_ };
+  const Eigen::Vector3d h_ang[15] = { h_ang_a2_, h_ang_a3_, h_ang_b2_, h_ang_b3_, h_ang_c2_, h_ang_c3_,
+                                      h_ang_d1_, h_ang_d2_, h_ang_d3_, h_ang_e1_, h_ang_e2_, h_ang_e3_,
+                                      h_ang_f1_, h_ang_f2_, h_ang_f3_ };
+
+  // Kept on the stack so that the vector lanes are suitably aligned
+  ndt::DerivativeBatch batch;
+  batch.reset (gauss_d1_, gauss_d2_, j_ang, h_ang, compute_hessian);
+
+  std::vector<int> neighborhood;
+  std::vector<float> distances;
+
+  // Queue each point and occupied voxel pair, line 17 in Algorithm 2 [Magnusson 2009]
+  for (size_t idx = 0; idx < input_->points.size (); idx++)
+  {
+    const PointSource &x_trans_pt = trans_cloud.points[idx];
+    searchNeighborhood (x_trans_pt, neighborhood, distances);
+
+    const PointSource &x_pt = input_->points[idx];
+    Eigen::Vector3d x (x_pt.x, x_pt.y, x_pt.z);
+
+    for (std::vector<int>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+    {
+      int cell = *neighborhood_it;
+
+      // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
+      Eigen::Vector3d x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z) - active_cells_->getCellMean (cell);
+
+      batch.push (x, x_trans, active_cells_->getCellInverseCov (cell));
     }
   }
-#ifdef _OPENMP
-  for (int i = 0; i < num_threads; ++i) {
-    score_gradient += score_gradient_i[i];
-    hessian += hessian_i[i];
-  }
-#endif
 
+  batch.finish (score, score_gradient, hessian);
   return (score);
 }
 
@@ -533,17 +637,27 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeAngleDerivat
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> void
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computePointDerivatives (Eigen::Vector3d &x, bool compute_hessian)
+{
+  computePointDerivatives (x, point_gradient_, point_hessian_, compute_hessian);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> void
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::computePointDerivatives (Eigen::Vector3d &x,
+                                                                                      Eigen::Matrix<double, 3, 6> &point_gradient,
+                                                                                      Eigen::Matrix<double, 18, 6> &point_hessian,
+                                                                                      bool compute_hessian)
 {
   // Calculate first derivative of Transformation Equation 6.17 w.r.t. transform vector p.
   // Derivative w.r.t. ith element of transform vector corresponds to column i, Equation 6.18 and 6.19 [Magnusson 2009]
-  point_gradient_ (1, 3) = x.dot (j_ang_a_);
-  point_gradient_ (2, 3) = x.dot (j_ang_b_);
-  point_gradient_ (0, 4) = x.dot (j_ang_c_);
-  point_gradient_ (1, 4) = x.dot (j_ang_d_);
-  point_gradient_ (2, 4) = x.dot (j_ang_e_);
-  point_gradient_ (0, 5) = x.dot (j_ang_f_);
-  point_gradient_ (1, 5) = x.dot (j_ang_g_);
-  point_gradient_ (2, 5) = x.dot (j_ang_h_);
+  point_gradient (1, 3) = x.dot (j_ang_a_);
+  point_gradient (2, 3) = x.dot (j_ang_b_);
+  point_gradient (0, 4) = x.dot (j_ang_c_);
+  point_gradient (1, 4) = x.dot (j_ang_d_);
+  point_gradient (2, 4) = x.dot (j_ang_e_);
+  point_gradient (0, 5) = x.dot (j_ang_f_);
+  point_gradient (1, 5) = x.dot (j_ang_g_);
+  point_gradient (2, 5) = x.dot (j_ang_h_);
 
   if (compute_hessian)
   {
@@ -559,15 +673,15 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computePointDerivat
 
     // Calculate second derivative of Transformation Equation 6.17 w.r.t. transform vector p.
     // Derivative w.r.t. ith and jth elements of transform vector corresponds to the 3x1 block matrix starting at (3i,j), Equation 6.20 and 6.21 [Magnusson 2009]
-    point_hessian_.block<3, 1>(9, 3) = a;
-    point_hessian_.block<3, 1>(12, 3) = b;
-    point_hessian_.block<3, 1>(15, 3) = c;
-    point_hessian_.block<3, 1>(9, 4) = b;
-    point_hessian_.block<3, 1>(12, 4) = d;
-    point_hessian_.block<3, 1>(15, 4) = e;
-    point_hessian_.block<3, 1>(9, 5) = c;
-    point_hessian_.block<3, 1>(12, 5) = e;
-    point_hessian_.block<3, 1>(15, 5) = f;
+    point_hessian.block<3, 1>(9, 3) = a;
+    point_hessian.block<3, 1>(12, 3) = b;
+    point_hessian.block<3, 1>(15, 3) = c;
+    point_hessian.block<3, 1>(9, 4) = b;
+    point_hessian.block<3, 1>(12, 4) = d;
+    point_hessian.block<3, 1>(15, 4) = e;
+    point_hessian.block<3, 1>(9, 5) = c;
+    point_hessian.block<3, 1>(12, 5) = e;
+    point_hessian.block<3, 1>(15, 5) = f;
   }
 }
 
@@ -577,6 +691,18 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (
                                                                                 Eigen::Matrix<double, 6, 6> &hessian,
                                                                                 Eigen::Vector3d &x_trans, Eigen::Matrix3d &c_inv,
                                                                                 bool compute_hessian)
+{
+  return (updateDerivatives (score_gradient, hessian, x_trans, c_inv, point_gradient_, point_hessian_, compute_hessian));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename PointSource, typename PointTarget> double
+pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                                                                                Eigen::Matrix<double, 6, 6> &hessian,
+                                                                                Eigen::Vector3d &x_trans, Eigen::Matrix3d &c_inv,
+                                                                                const Eigen::Matrix<double, 3, 6> &point_gradient,
+                                                                                const Eigen::Matrix<double, 18, 6> &point_hessian,
+                                                                                bool compute_hessian)
 {
   Eigen::Vector3d cov_dxd_pi;
   // e^(-d_2/2 * (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)) Equation 6.9 [Magnusson 2009]
@@ -597,7 +723,7 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (
   for (int i = 0; i < 6; i++)
   {
     // Sigma_k^-1 d(T(x,p))/dpi, Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
-    cov_dxd_pi = c_inv * point_gradient_.col (i);
+    cov_dxd_pi = c_inv * point_gradient.col (i);
 
     // Update gradient, Equation 6.12 [Magnusson 2009]
     score_gradient (i) += x_trans.dot (cov_dxd_pi) * e_x_cov_x;
@@ -607,9 +733,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (
       for (int j = 0; j < hessian.cols (); j++)
       {
         // Update hessian, Equation 6.13 [Magnusson 2009]
-        hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient_.col (j)) +
-                                    x_trans.dot (c_inv * point_hessian_.block<3, 1>(3 * i, j)) +
-                                    point_gradient_.col (j).dot (cov_dxd_pi) );
+        hessian (i, j) += e_x_cov_x * (-gauss_d2_ * x_trans.dot (cov_dxd_pi) * x_trans.dot (c_inv * point_gradient.col (j)) +
+                                    x_trans.dot (c_inv * point_hessian.block<3, 1>(3 * i, j)) +
+                                    point_gradient.col (j).dot (cov_dxd_pi) );
       }
     }
   }
@@ -620,14 +746,22 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::updateDerivatives (
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename PointSource, typename PointTarget> void
 pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (Eigen::Matrix<double, 6, 6> &hessian,
-                                                                             PointCloudSource &trans_cloud, Eigen::Matrix<double, 6, 1> &)
+                                                                             PointCloudSource &trans_cloud, Eigen::Matrix<double, 6, 1> &p)
 {
+  if (use_batched_derivatives_)
+  {
+    // The batched kernel computes gradient and hessian together, the gradient is discarded
+    Eigen::Matrix<double, 6, 1> score_gradient;
+    batch_computeDerivatives (score_gradient, hessian, trans_cloud, p, true);
+    return;
+  }
+
   // Original Point and Transformed Point
   PointSource x_pt, x_trans_pt;
   // Original Point and Transformed Point (for math)
   Eigen::Vector3d x, x_trans;
   // Occupied Voxel
-  TargetGridLeafConstPtr cell;
+  int cell;
   // Inverse Covariance of Occupied Voxel
   Eigen::Matrix3d c_inv;
 
@@ -640,12 +774,12 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (Eig
   {
     x_trans_pt = trans_cloud.points[idx];
 
-    // Find nieghbors (Radius search has been experimentally faster than direct neighbor checking.
-    std::vector<TargetGridLeafConstPtr> neighborhood;
+    // Find nieghbors (Radius search by default, direct voxel lookup when selected by search_method_)
+    std::vector<int> neighborhood;
     std::vector<float> distances;
-    target_cells_.radiusSearch (x_trans_pt, resolution_, neighborhood, distances);
+    searchNeighborhood (x_trans_pt, neighborhood, distances);
 
-    for (typename std::vector<TargetGridLeafConstPtr>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
+    for (std::vector<int>::iterator neighborhood_it = neighborhood.begin (); neighborhood_it != neighborhood.end (); neighborhood_it++)
     {
       cell = *neighborhood_it;
 
@@ -656,9 +790,9 @@ pcl::NormalDistributionsTransform<PointSource, PointTarget>::computeHessian (Eig
         x_trans = Eigen::Vector3d (x_trans_pt.x, x_trans_pt.y, x_trans_pt.z);
 
         // Denorm point, x_k' in Equations 6.12 and 6.13 [Magnusson 2009]
-        x_trans -= cell->getMean ();
+        x_trans -= active_cells_->getCellMean (cell);
         // Uses precomputed covariance for speed.
-        c_inv = cell->getInverseCov ();
+        c_inv = active_cells_->getCellInverseCov (cell);
 
         // Compute derivative of transform function w.r.t. transform vector, J_E and H_E in Equations 6.18 and 6.20 [Magnusson 2009]
         computePointDerivatives (x);
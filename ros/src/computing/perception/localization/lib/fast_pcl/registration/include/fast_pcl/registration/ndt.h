@@ -45,9 +45,16 @@
 #include "fast_pcl/registration/registration.h"
 //#include <pcl/filters/voxel_grid_covariance.h>
 #include "fast_pcl/filters/voxel_grid_covariance.h"
+#include "fast_pcl/registration/ndt_batch.h"
 
 #include <unsupported/Eigen/NonLinearOptimization>
 
+#include <map>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace pcl
 {
   /** \brief A 3D Normal Distribution Transform registration implementation for point cloud data.
@@ -83,8 +90,8 @@ namespace pcl
       typedef TargetGrid* TargetGridPtr;
       /** \brief Typename of const pointer to searchable voxel grid. */
       typedef const TargetGrid* TargetGridConstPtr;
-      /** \brief Typename of const pointer to searchable voxel grid leaf. */
-      typedef typename TargetGrid::LeafConstPtr TargetGridLeafConstPtr;
+      /** \brief Typename of shared pointer to the voxel grid of a target tile. */
+      typedef boost::shared_ptr<TargetGrid> TargetTileGridPtr;
 
 
     public:
@@ -92,11 +99,23 @@ namespace pcl
       typedef boost::shared_ptr< NormalDistributionsTransform<PointSource, PointTarget> > Ptr;
       typedef boost::shared_ptr< const NormalDistributionsTransform<PointSource, PointTarget> > ConstPtr;
 
+      /** \brief Method used to find the covariance voxels neighboring each transformed source point.
+        * KDTREE uses a radius search over the voxel centroids, DIRECT27, DIRECT7 and DIRECT1 look up the
+        * 3x3x3 block, the face neighbors or only the voxel containing the point by voxel index.
+        */
+      enum NeighborSearchMethod
+      {
+        KDTREE,
+        DIRECT27,
+        DIRECT7,
+        DIRECT1
+      };
 
       /** \brief Constructor.
         * Sets \ref outlier_ratio_ to 0.35, \ref step_size_ to 0.05 and \ref resolution_ to 1.0
+        * \param[in] nr_threads the number of threads used by omp_align (0: automatic)
         */
-      NormalDistributionsTransform ();
+      NormalDistributionsTransform (unsigned int nr_threads = 0);
       
       /** \brief Empty destructor */
       virtual ~NormalDistributionsTransform () {}
@@ -107,10 +126,54 @@ namespace pcl
       inline void
       setInputTarget (const PointCloudTargetConstPtr &cloud)
       {
+        target_tiles_.clear ();
         Registration<PointSource, PointTarget>::setInputTarget (cloud);
         init ();
       }
 
+      /** \brief Add a tile of the target map, voxelized on its own with the current resolution.
+        * \note Tiles are an alternative to \ref setInputTarget for large maps: the target is rebuilt from the voxels
+        * of the current tiles by \ref updateTargetTiles, so moving the window only voxelizes the tiles that enter it.
+        * Tile borders should lie on the voxel borders of every level (tile size a multiple of the coarsest resolution).
+        * The fitness score kdtree is rebuilt from the map points of the tiles by every \ref updateTargetTiles.
+        * \param[in] id caller defined tile identifier, an existing tile with the same id is replaced
+        * \param[in] cloud the points of the tile
+        */
+      void
+      addTargetTile (int64_t id, const PointCloudTargetConstPtr &cloud);
+
+      /** \brief Remove a tile of the target map, the target is updated by the next \ref updateTargetTiles.
+        * \param[in] id tile identifier
+        */
+      inline void
+      removeTargetTile (int64_t id)
+      {
+        target_tiles_.erase (id);
+      }
+
+      /** \brief Check whether a tile is part of the target map.
+        * \param[in] id tile identifier
+        * \return true if the tile was added and not removed
+        */
+      inline bool
+      hasTargetTile (int64_t id) const
+      {
+        return (target_tiles_.find (id) != target_tiles_.end ());
+      }
+
+      /** \brief Get the number of tiles of the target map. */
+      inline int
+      getTargetTileCount () const
+      {
+        return (static_cast<int> (target_tiles_.size ()));
+      }
+
+      /** \brief Rebuild the covariance voxel structure from the voxels of the current tiles.
+        * \note When the tiles hold no voxel the input target is cleared, check \ref getInputTarget before aligning.
+        */
+      void
+      updateTargetTiles ();
+
       /** \brief Set/change the voxel grid resolution.
         * \param[in] resolution side length of voxels
         */
@@ -135,6 +198,89 @@ namespace pcl
         return (resolution_);
       }
 
+      /** \brief Set the number of resolution levels used for coarse-to-fine alignment.
+        * \note Level k uses voxels of \ref resolution_ * 2^k. Alignment runs from the coarsest level to the finest,
+        * each level starting from the transform found by the previous one. The coarse grids are built together with
+        * the target grid.
+        * \param[in] levels number of levels, 1 disables coarse-to-fine alignment
+        */
+      inline void
+      setNumResolutionLevels (int levels)
+      {
+        levels = std::max (1, levels);
+        if (resolution_levels_ != levels)
+        {
+          resolution_levels_ = levels;
+          if (target_)
+            init ();
+        }
+      }
+
+      /** \brief Get the number of resolution levels used for coarse-to-fine alignment.
+        * \return number of levels
+        */
+      inline int
+      getNumResolutionLevels () const
+      {
+        return (resolution_levels_);
+      }
+
+      /** \brief Set the method used to find neighboring covariance voxels.
+        * \param[in] method neighbor search method
+        */
+      inline void
+      setNeighborSearchMethod (NeighborSearchMethod method)
+      {
+        search_method_ = method;
+      }
+
+      /** \brief Get the method used to find neighboring covariance voxels.
+        * \return neighbor search method
+        */
+      inline NeighborSearchMethod
+      getNeighborSearchMethod () const
+      {
+        return (search_method_);
+      }
+
+      /** \brief Set the number of threads used by omp_align.
+        * \note The same fixed size team is used for every derivative evaluation of an alignment, and points are
+        * split into equal contiguous chunks, one per thread. The OpenMP runtime keeps the team alive between calls.
+        * \param[in] nr_threads the number of threads to use (0: automatic, omp_get_max_threads ())
+        */
+      inline void
+      setNumberOfThreads (unsigned int nr_threads = 0)
+      {
+        threads_ = nr_threads;
+      }
+
+      /** \brief Get the number of threads used by omp_align, as set by the user (0: automatic). */
+      inline unsigned int
+      getNumberOfThreads () const
+      {
+        return (threads_);
+      }
+
+      /** \brief Enable/disable the batched float derivative kernel.
+        * \note When enabled, score, gradient and hessian are computed eight point/cell pairs at a time in float
+        * on the calling thread (also by omp_align). The double precision scalar path is used otherwise.
+        * \param[in] use_batched_derivatives true to use the batched kernel
+        */
+      inline void
+      setUseBatchedDerivatives (bool use_batched_derivatives)
+      {
+        use_batched_derivatives_ = use_batched_derivatives;
+      }
+
+      /** \brief Get whether the batched float derivative kernel is used.
+        * \return true if the batched kernel is used
+        */
+      inline bool
+      getUseBatchedDerivatives () const
+      {
+        return (use_batched_derivatives_);
+      }
+
       /** \brief Get the newton line search maximum step length.
         * \return maximum step length
         */
@@ -252,14 +398,71 @@ namespace pcl
       virtual void
       omp_computeTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess);
 
-      /** \brief Initiate covariance voxel structure. */
-      void inline
-      init ()
+      /** \brief Initiate covariance voxel structure, and the coarse levels if any. */
+      void
+      init ();
+
+      /** \brief Get the voxel side length of a resolution level.
+        * \param[in] level resolution level, 0 is the finest
+        * \return side length of voxels
+        */
+      inline float
+      getLevelResolution (int level) const
+      {
+        return (resolution_ * static_cast<float> (1 << level));
+      }
+
+      /** \brief Select the voxel grid used by the neighbor search and the derivative computations.
+        * \param[in] level resolution level, 0 is the finest
+        */
+      inline void
+      setActiveLevel (int level)
       {
-        target_cells_.setLeafSize (resolution_, resolution_, resolution_);
-        target_cells_.setInputCloud ( target_ );
-        // Initiate voxel structure.
-        target_cells_.filter (true);
+        active_cells_ = level == 0 ? &target_cells_ : coarse_cells_[level - 1].get ();
+        active_resolution_ = getLevelResolution (level);
+      }
+
+      /** \brief Estimate the transformation at the resolution selected by \ref setActiveLevel.
+        * \param[out] output the transformed input point cloud dataset using the rigid transformation found
+        * \param[in] guess the initial gross estimation of the transformation
+        * \param[in] use_omp flag to compute the derivatives with \ref omp_computeDerivatives
+        */
+      void
+      computeLevelTransformation (PointCloudSource &output, const Eigen::Matrix4f &guess, bool use_omp);
+
+      /** \brief Align the input through the coarse levels and return the transformation found.
+        * \param[in] output the input point cloud dataset, transformed only in copies
+        * \param[in] guess the initial gross estimation of the transformation
+        * \param[in] use_omp flag to compute the derivatives with \ref omp_computeDerivatives
+        * \param[out] nr_iterations the number of iterations spent on the coarse levels
+        * \note A level is only passed on when it converged before the iteration limit to a better score than its guess.
+        * \return the transformation found by the finest accepted coarse level, guess if none is accepted
+        */
+      Eigen::Matrix4f
+      alignCoarseLevels (const PointCloudSource &output, const Eigen::Matrix4f &guess, bool use_omp, int &nr_iterations);
+
+      /** \brief Find the covariance voxels neighboring a transformed point using \ref search_method_.
+        * \param[in] x_trans_pt transformed point
+        * \param[out] neighborhood the resultant cell indices
+        * \param[out] distances squared distances to the leaf centroids (only filled by KDTREE)
+        * \return number of neighbors found
+        */
+      inline int
+      searchNeighborhood (const PointSource &x_trans_pt,
+                          std::vector<int> &neighborhood,
+                          std::vector<float> &distances)
+      {
+        switch (search_method_)
+        {
+          case DIRECT27:
+            return (active_cells_->directSearch (x_trans_pt, 27, neighborhood));
+          case DIRECT7:
+            return (active_cells_->directSearch (x_trans_pt, 7, neighborhood));
+          case DIRECT1:
+            return (active_cells_->directSearch (x_trans_pt, 1, neighborhood));
+          default:
+            return (active_cells_->radiusSearch (x_trans_pt, active_resolution_, neighborhood, distances));
+        }
       }
 
       /** \brief Compute derivatives of probability function w.r.t. the transformation vector.
@@ -284,6 +487,21 @@ namespace pcl
                           Eigen::Matrix<double, 6, 1> &p,
                           bool compute_hessian = true);
 
+      /** \brief Compute derivatives of probability function w.r.t. the transformation vector using \ref ndt::DerivativeBatch.
+        * \note Equation 6.10, 6.12 and 6.13 [Magnusson 2009].
+        * \param[out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
+        * \param[out] hessian the hessian matrix of the probability function w.r.t. the transformation vector
+        * \param[in] trans_cloud transformed point cloud
+        * \param[in] p the current transform vector
+        * \param[in] compute_hessian flag to calculate hessian, unnessissary for step calculation.
+        */
+      double
+      batch_computeDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                                Eigen::Matrix<double, 6, 6> &hessian,
+                                PointCloudSource &trans_cloud,
+                                Eigen::Matrix<double, 6, 1> &p,
+                                bool compute_hessian = true);
+
       /** \brief Compute individual point contirbutions to derivatives of probability function w.r.t. the transformation vector.
         * \note Equation 6.10, 6.12 and 6.13 [Magnusson 2009].
         * \param[in,out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
@@ -298,6 +516,25 @@ namespace pcl
                          Eigen::Vector3d &x_trans, Eigen::Matrix3d &c_inv,
                          bool compute_hessian = true);
 
+      /** \brief Compute individual point contirbutions to derivatives of probability function w.r.t. the transformation vector,
+        * using the given point derivatives instead of \ref point_gradient_ and \ref point_hessian_.
+        * \note Equation 6.10, 6.12 and 6.13 [Magnusson 2009].
+        * \param[in,out] score_gradient the gradient vector of the probability function w.r.t. the transformation vector
+        * \param[in,out] hessian the hessian matrix of the probability function w.r.t. the transformation vector
+        * \param[in] x_trans transformed point minus mean of occupied covariance voxel
+        * \param[in] c_inv covariance of occupied covariance voxel
+        * \param[in] point_gradient the first order point derivative, \f$ J_E \f$
+        * \param[in] point_hessian the second order point derivative, \f$ H_E \f$
+        * \param[in] compute_hessian flag to calculate hessian, unnessissary for step calculation.
+        */
+      double
+      updateDerivatives (Eigen::Matrix<double, 6, 1> &score_gradient,
+                         Eigen::Matrix<double, 6, 6> &hessian,
+                         Eigen::Vector3d &x_trans, Eigen::Matrix3d &c_inv,
+                         const Eigen::Matrix<double, 3, 6> &point_gradient,
+                         const Eigen::Matrix<double, 18, 6> &point_hessian,
+                         bool compute_hessian = true);
+
       /** \brief Precompute anglular components of derivatives.
         * \note Equation 6.19 and 6.21 [Magnusson 2009].
         * \param[in] p the current transform vector
@@ -314,6 +551,19 @@ namespace pcl
       void
       computePointDerivatives (Eigen::Vector3d &x, bool compute_hessian = true);
 
+      /** \brief Compute point derivatives into the given matrices instead of \ref point_gradient_ and \ref point_hessian_.
+        * \note Equation 6.18-21 [Magnusson 2009].
+        * \param[in] x point from the input cloud
+        * \param[in,out] point_gradient the first order point derivative, \f$ J_E \f$
+        * \param[in,out] point_hessian the second order point derivative, \f$ H_E \f$
+        * \param[in] compute_hessian flag to calculate hessian, unnessissary for step calculation.
+        */
+      void
+      computePointDerivatives (Eigen::Vector3d &x,
+                               Eigen::Matrix<double, 3, 6> &point_gradient,
+                               Eigen::Matrix<double, 18, 6> &point_hessian,
+                               bool compute_hessian = true);
+
       /** \brief Compute hessian of probability function w.r.t. the transformation vector.
         * \note Equation 6.13 [Magnusson 2009].
         * \param[out] hessian the hessian matrix of the probability function w.r.t. the transformation vector
@@ -429,11 +679,36 @@ namespace pcl
       /** \brief The voxel grid generated from target cloud containing point means and covariances. */
       TargetGrid target_cells_;
 
+      /** \brief Voxel grids of the target tiles, one per resolution level, merged into \ref target_cells_ and
+        * \ref coarse_cells_ by \ref updateTargetTiles. */
+      std::map<int64_t, std::vector<TargetTileGridPtr> > target_tiles_;
+
+      /** \brief Voxel grids of the coarse resolution levels, element k - 1 holds level k. */
+      std::vector<TargetTileGridPtr> coarse_cells_;
+
+      /** \brief The voxel grid searched by the current alignment level. */
+      TargetGrid *active_cells_;
+
+      /** \brief The side length of voxels of the current alignment level. */
+      float active_resolution_;
+
       //double fitness_epsilon_;
 
       /** \brief The side length of voxels. */
       float resolution_;
 
+      /** \brief The number of resolution levels used for coarse-to-fine alignment. */
+      int resolution_levels_;
+
+      /** \brief The method used to find neighboring covariance voxels. */
+      NeighborSearchMethod search_method_;
+
+      /** \brief Flag to compute derivatives with the batched float kernel. */
+      bool use_batched_derivatives_;
+
+      /** \brief The number of threads used by omp_align (0: automatic). */
+      unsigned int threads_;
+
       /** \brief The maximum step length. */
       double step_size_;
 
@@ -446,6 +721,13 @@ namespace pcl
       /** \brief The probability score of the transform applied to the input cloud, Equation 6.9 and 6.10 [Magnusson 2009]. */
       double trans_probability_;
 
+      /** \brief The probability score of the guess of the last \ref computeLevelTransformation. */
+      double level_guess_probability_;
+
+      /** \brief Flag set when the last \ref computeLevelTransformation stopped on \ref transformation_epsilon_ or a
+        * zero step, not on \ref max_iterations_. */
+      bool level_step_converged_;
+
       /** \brief Precomputed Angular Gradient
         *
         * The precomputed angular derivatives for the jacobian of a transformation vector, Equation 6.19 [Magnusson 2009]. 
@@ -469,6 +751,15 @@ namespace pcl
       /** \brief The second order derivative of the transformation of a point w.r.t. the transform vector, \f$ H_E \f$ in Equation 6.20 [Magnusson 2009]. */
       Eigen::Matrix<double, 18, 6> point_hessian_;
 
+      /** \brief Per thread score, gradient, hessian and point derivatives used by omp_computeDerivatives.
+        * Kept across calls so that no allocation happens inside the Newton iterations.
+        */
+      std::vector<double> thread_score_;
+      std::vector<Eigen::Matrix<double, 6, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 6, 1> > > thread_score_gradient_;
+      std::vector<Eigen::Matrix<double, 6, 6>, Eigen::aligned_allocator<Eigen::Matrix<double, 6, 6> > > thread_hessian_;
+      std::vector<Eigen::Matrix<double, 3, 6>, Eigen::aligned_allocator<Eigen::Matrix<double, 3, 6> > > thread_point_gradient_;
+      std::vector<Eigen::Matrix<double, 18, 6>, Eigen::aligned_allocator<Eigen::Matrix<double, 18, 6> > > thread_point_hessian_;
+
     public:
       EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
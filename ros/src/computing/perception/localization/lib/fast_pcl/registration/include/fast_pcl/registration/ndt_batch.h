@@ -0,0 +1,492 @@
+/*
+ * Software License Agreement (BSD License)
+ *
+ *  Point Cloud Library (PCL) - www.pointclouds.org
+ *  Copyright (c) 2010-2011, Willow Garage, Inc.
+ *  Copyright (c) 2012-, Open Perception, Inc.
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of the copyright holder(s) nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef FAST_PCL_REGISTRATION_NDT_BATCH_H_
+#define FAST_PCL_REGISTRATION_NDT_BATCH_H_
+
+#include <cmath>
+#include <Eigen/Core>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace pcl
+{
+  namespace ndt
+  {
+#ifdef __AVX2__
+    /** \brief Eight float lanes held in one AVX register. */
+    struct BatchFloat
+    {
+      BatchFloat () {}
+      BatchFloat (__m256 x) : v (x) {}
+      explicit BatchFloat (float x) : v (_mm256_set1_ps (x)) {}
+
+      static inline BatchFloat
+      load (const float *p)
+      {
+        return (BatchFloat (_mm256_loadu_ps (p)));
+      }
+
+      __m256 v;
+    };
+
+    inline BatchFloat operator+ (const BatchFloat &a, const BatchFloat &b) { return (_mm256_add_ps (a.v, b.v)); }
+    inline BatchFloat operator- (const BatchFloat &a, const BatchFloat &b) { return (_mm256_sub_ps (a.v, b.v)); }
+    inline BatchFloat operator* (const BatchFloat &a, const BatchFloat &b) { return (_mm256_mul_ps (a.v, b.v)); }
+
+    /** \brief Compute a * b + c, fused when FMA is available. */
+    inline BatchFloat
+    fmadd (const BatchFloat &a, const BatchFloat &b, const BatchFloat &c)
+    {
+#ifdef __FMA__
+      return (_mm256_fmadd_ps (a.v, b.v, c.v));
+#else
+      return (_mm256_add_ps (_mm256_mul_ps (a.v, b.v), c.v));
+#endif
+    }
+
+    /** \brief Lane-wise exponential (Cephes polynomial, relative error about 1e-7 over the float range). */
+    inline BatchFloat
+    exp (const BatchFloat &in)
+    {
+      __m256 x = _mm256_min_ps (in.v, _mm256_set1_ps (88.3762626647949f));
+      x = _mm256_max_ps (x, _mm256_set1_ps (-88.3762626647949f));
+
+      // Express exp(x) as exp(g + n * log(2))
+      __m256 fx = _mm256_floor_ps (_mm256_add_ps (_mm256_mul_ps (x, _mm256_set1_ps (1.44269504088896341f)), _mm256_set1_ps (0.5f)));
+      x = _mm256_sub_ps (x, _mm256_mul_ps (fx, _mm256_set1_ps (0.693359375f)));
+      x = _mm256_sub_ps (x, _mm256_mul_ps (fx, _mm256_set1_ps (-2.12194440e-4f)));
+
+      BatchFloat g (x);
+      BatchFloat z = g * g;
+      BatchFloat y (1.9875691500E-4f);
+      y = fmadd (y, g, BatchFloat (1.3981999507E-3f));
+      y = fmadd (y, g, BatchFloat (8.3334519073E-3f));
+      y = fmadd (y, g, BatchFloat (4.1665795894E-2f));
+      y = fmadd (y, g, BatchFloat (1.6666665459E-1f));
+      y = fmadd (y, g, BatchFloat (5.0000001201E-1f));
+      y = fmadd (y, z, g + BatchFloat (1.0f));
+
+      // Build 2^n
+      __m256i n = _mm256_add_epi32 (_mm256_cvttps_epi32 (fx), _mm256_set1_epi32 (0x7f));
+      n = _mm256_slli_epi32 (n, 23);
+      return (_mm256_mul_ps (y.v, _mm256_castsi256_ps (n)));
+    }
+
+    /** \brief 1.0 in lanes where 0 <= x <= 1, 0.0 otherwise (including NaN). */
+    inline BatchFloat
+    unitIntervalMask (const BatchFloat &x)
+    {
+      __m256 in_range = _mm256_and_ps (_mm256_cmp_ps (x.v, _mm256_set1_ps (1.0f), _CMP_LE_OQ),
+                                       _mm256_cmp_ps (x.v, _mm256_setzero_ps (), _CMP_GE_OQ));
+      return (_mm256_and_ps (in_range, _mm256_set1_ps (1.0f)));
+    }
+
+    /** \brief Sum of all lanes. */
+    inline double
+    horizontalSum (const BatchFloat &a)
+    {
+      __m128 s = _mm_add_ps (_mm256_castps256_ps128 (a.v), _mm256_extractf128_ps (a.v, 1));
+      s = _mm_hadd_ps (s, s);
+      s = _mm_hadd_ps (s, s);
+      return (static_cast<double> (_mm_cvtss_f32 (s)));
+    }
+#else
+    /** \brief Eight float lanes, plain array fallback when AVX2 is not enabled at build time. */
+    struct BatchFloat
+    {
+      BatchFloat () {}
+      explicit BatchFloat (float x)
+      {
+        for (int l = 0; l < 8; ++l)
+          v[l] = x;
+      }
+
+      static inline BatchFloat
+      load (const float *p)
+      {
+        BatchFloat r;
+        for (int l = 0; l < 8; ++l)
+          r.v[l] = p[l];
+        return (r);
+      }
+
+      float v[8];
+    };
+
+    inline BatchFloat
+    operator+ (const BatchFloat &a, const BatchFloat &b)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = a.v[l] + b.v[l];
+      return (r);
+    }
+
+    inline BatchFloat
+    operator- (const BatchFloat &a, const BatchFloat &b)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = a.v[l] - b.v[l];
+      return (r);
+    }
+
+    inline BatchFloat
+    operator* (const BatchFloat &a, const BatchFloat &b)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = a.v[l] * b.v[l];
+      return (r);
+    }
+
+    /** \brief Compute a * b + c. */
+    inline BatchFloat
+    fmadd (const BatchFloat &a, const BatchFloat &b, const BatchFloat &c)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = a.v[l] * b.v[l] + c.v[l];
+      return (r);
+    }
+
+    /** \brief Lane-wise exponential. */
+    inline BatchFloat
+    exp (const BatchFloat &x)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = std::exp (x.v[l]);
+      return (r);
+    }
+
+    /** \brief 1.0 in lanes where 0 <= x <= 1, 0.0 otherwise (including NaN). */
+    inline BatchFloat
+    unitIntervalMask (const BatchFloat &x)
+    {
+      BatchFloat r;
+      for (int l = 0; l < 8; ++l)
+        r.v[l] = (x.v[l] >= 0.0f && x.v[l] <= 1.0f) ? 1.0f : 0.0f;
+      return (r);
+    }
+
+    /** \brief Sum of all lanes. */
+    inline double
+    horizontalSum (const BatchFloat &a)
+    {
+      double s = 0;
+      for (int l = 0; l < 8; ++l)
+        s += a.v[l];
+      return (s);
+    }
+#endif
+
+    /** \brief Accumulates NDT score, gradient and hessian contributions of point/cell pairs eight at a time in float.
+      * \note Equation 6.9, 6.12 and 6.13 [Magnusson 2009]. Results match NormalDistributionsTransform::updateDerivatives
+      * to float precision; the double precision scalar path is kept in NormalDistributionsTransform for validation.
+      * Lane sums are flushed into double accumulators every \ref FLUSH_INTERVAL batches to bound rounding error.
+      */
+    class DerivativeBatch
+    {
+      public:
+
+        enum { WIDTH = 8, FLUSH_INTERVAL = 32 };
+
+        DerivativeBatch () :
+          size_ (0),
+          nr_batches_ (0),
+          compute_hessian_ (true),
+          gauss_d1_ (0),
+          gauss_d2_ (0),
+          score_ (0),
+          gradient_ (Eigen::Matrix<double, 6, 1>::Zero ()),
+          hessian_ (Eigen::Matrix<double, 6, 6>::Zero ())
+        {
+        }
+
+        /** \brief Clear accumulated values and set the constants used for the next set of pairs.
+          * \param[in] gauss_d1 gaussian fitting parameter d1, Equation 6.8 [Magnusson 2009]
+          * \param[in] gauss_d2 gaussian fitting parameter d2, Equation 6.8 [Magnusson 2009]
+          * \param[in] j_ang precomputed angular gradient vectors a to h, Equation 6.19 [Magnusson 2009]
+          * \param[in] h_ang precomputed angular hessian vectors a2, a3, b2, b3, c2, c3, d1-3, e1-3, f1-3, Equation 6.21 [Magnusson 2009]
+          * \param[in] compute_hessian flag to calculate hessian
+          */
+        void
+        reset (double gauss_d1, double gauss_d2, const Eigen::Vector3d j_ang[8], const Eigen::Vector3d h_ang[15], bool compute_hessian)
+        {
+          size_ = 0;
+          nr_batches_ = 0;
+          compute_hessian_ = compute_hessian;
+          gauss_d1_ = static_cast<float> (gauss_d1);
+          gauss_d2_ = static_cast<float> (gauss_d2);
+          for (int i = 0; i < 8; ++i)
+            for (int k = 0; k < 3; ++k)
+              j_ang_[i][k] = static_cast<float> (j_ang[i] (k));
+          for (int i = 0; i < 15; ++i)
+            for (int k = 0; k < 3; ++k)
+              h_ang_[i][k] = static_cast<float> (h_ang[i] (k));
+
+          score_ = 0;
+          gradient_.setZero ();
+          hessian_.setZero ();
+          clearLaneSums ();
+        }
+
+        /** \brief Add a point/cell pair.
+          * \param[in] x point from the input cloud
+          * \param[in] x_trans transformed point minus mean of occupied covariance voxel
+          * \param[in] c_inv inverse covariance of occupied covariance voxel
+          */
+        inline void
+        push (const Eigen::Vector3d &x, const Eigen::Vector3d &x_trans, const Eigen::Matrix3d &c_inv)
+        {
+          for (int k = 0; k < 3; ++k)
+          {
+            x_[k][size_] = static_cast<float> (x (k));
+            t_[k][size_] = static_cast<float> (x_trans (k));
+          }
+          c_[0][size_] = static_cast<float> (c_inv (0, 0));
+          c_[1][size_] = static_cast<float> (c_inv (0, 1));
+          c_[2][size_] = static_cast<float> (c_inv (0, 2));
+          c_[3][size_] = static_cast<float> (c_inv (1, 1));
+          c_[4][size_] = static_cast<float> (c_inv (1, 2));
+          c_[5][size_] = static_cast<float> (c_inv (2, 2));
+          used_[size_] = 1.0f;
+
+          if (++size_ == WIDTH)
+            process ();
+        }
+
+        /** \brief Process the remaining pairs and return the accumulated values.
+          * \param[out] score sum of the score contributions
+          * \param[out] gradient gradient of the score w.r.t. the transformation vector
+          * \param[out] hessian hessian of the score w.r.t. the transformation vector (left untouched unless computed)
+          */
+        void
+        finish (double &score, Eigen::Matrix<double, 6, 1> &gradient, Eigen::Matrix<double, 6, 6> &hessian)
+        {
+          if (size_ > 0)
+          {
+            // Padding lanes are zero weighted
+            for (int l = size_; l < WIDTH; ++l)
+            {
+              for (int k = 0; k < 3; ++k)
+                x_[k][l] = t_[k][l] = 0;
+              for (int k = 0; k < 6; ++k)
+                c_[k][l] = 0;
+              used_[l] = 0;
+            }
+            process ();
+          }
+          flush ();
+
+          score = score_;
+          gradient = gradient_;
+          if (compute_hessian_)
+          {
+            for (int i = 0; i < 6; ++i)
+              for (int j = i; j < 6; ++j)
+                hessian (i, j) = hessian (j, i) = hessian_ (i, j);
+          }
+        }
+
+      private:
+
+        void
+        clearLaneSums ()
+        {
+          score_sum_ = BatchFloat (0.0f);
+          for (int i = 0; i < 6; ++i)
+            gradient_sum_[i] = BatchFloat (0.0f);
+          for (int k = 0; k < 21; ++k)
+            hessian_sum_[k] = BatchFloat (0.0f);
+        }
+
+        void
+        flush ()
+        {
+          score_ += horizontalSum (score_sum_);
+          for (int i = 0; i < 6; ++i)
+            gradient_ (i) += horizontalSum (gradient_sum_[i]);
+          if (compute_hessian_)
+          {
+            for (int i = 0, k = 0; i < 6; ++i)
+              for (int j = i; j < 6; ++j, ++k)
+                hessian_ (i, j) += horizontalSum (hessian_sum_[k]);
+          }
+          clearLaneSums ();
+          nr_batches_ = 0;
+        }
+
+        /** \brief Dot product of the source points with a precomputed angular vector. */
+        inline BatchFloat
+        dotX (const BatchFloat x[3], const float v[3]) const
+        {
+          return (fmadd (x[2], BatchFloat (v[2]), fmadd (x[1], BatchFloat (v[1]), x[0] * BatchFloat (v[0]))));
+        }
+
+        void
+        process ()
+        {
+          BatchFloat x[3], t[3];
+          for (int k = 0; k < 3; ++k)
+          {
+            x[k] = BatchFloat::load (x_[k]);
+            t[k] = BatchFloat::load (t_[k]);
+          }
+          BatchFloat c00 = BatchFloat::load (c_[0]), c01 = BatchFloat::load (c_[1]), c02 = BatchFloat::load (c_[2]);
+          BatchFloat c11 = BatchFloat::load (c_[3]), c12 = BatchFloat::load (c_[4]), c22 = BatchFloat::load (c_[5]);
+
+          // Sigma_k^-1 (x_k - mu_k)
+          BatchFloat u[3];
+          u[0] = fmadd (c02, t[2], fmadd (c01, t[1], c00 * t[0]));
+          u[1] = fmadd (c12, t[2], fmadd (c11, t[1], c01 * t[0]));
+          u[2] = fmadd (c22, t[2], fmadd (c12, t[1], c02 * t[0]));
+
+          // e^(-d_2/2 * (x_k - mu_k)^T Sigma_k^-1 (x_k - mu_k)) Equation 6.9 [Magnusson 2009]
+          BatchFloat q = fmadd (t[2], u[2], fmadd (t[1], u[1], t[0] * u[0]));
+          BatchFloat e_x_cov_x = exp (BatchFloat (-gauss_d2_ * 0.5f) * q);
+          BatchFloat d2_e_x_cov_x = BatchFloat (gauss_d2_) * e_x_cov_x;
+
+          // Invalid values and padding lanes contribute nothing, as in updateDerivatives
+          BatchFloat weight = unitIntervalMask (d2_e_x_cov_x) * BatchFloat::load (used_);
+          score_sum_ = fmadd (BatchFloat (-gauss_d1_) * e_x_cov_x, weight, score_sum_);
+
+          // Reusable portion of Equation 6.12 and 6.13 [Magnusson 2009]
+          BatchFloat f = BatchFloat (gauss_d1_) * d2_e_x_cov_x * weight;
+
+          // Point gradient columns 3 to 5, Equation 6.18 and 6.19 [Magnusson 2009]
+          BatchFloat ja = dotX (x, j_ang_[0]), jb = dotX (x, j_ang_[1]), jc = dotX (x, j_ang_[2]), jd = dotX (x, j_ang_[3]);
+          BatchFloat je = dotX (x, j_ang_[4]), jf = dotX (x, j_ang_[5]), jg = dotX (x, j_ang_[6]), jh = dotX (x, j_ang_[7]);
+
+          // (x_k - mu_k)^T Sigma_k^-1 d(T(x,p))/dpi
+          BatchFloat g[6];
+          g[0] = u[0];
+          g[1] = u[1];
+          g[2] = u[2];
+          g[3] = fmadd (u[2], jb, u[1] * ja);
+          g[4] = fmadd (u[2], je, fmadd (u[1], jd, u[0] * jc));
+          g[5] = fmadd (u[2], jh, fmadd (u[1], jg, u[0] * jf));
+
+          // Update gradient, Equation 6.12 [Magnusson 2009]
+          for (int i = 0; i < 6; ++i)
+            gradient_sum_[i] = fmadd (f, g[i], gradient_sum_[i]);
+
+          if (compute_hessian_)
+          {
+            BatchFloat zero (0.0f);
+            BatchFloat jcol[3][3] = { { zero, ja, jb }, { jc, jd, je }, { jf, jg, jh } };
+
+            // Sigma_k^-1 d(T(x,p))/dpi for the angular columns
+            BatchFloat cj[3][3];
+            for (int a = 0; a < 3; ++a)
+            {
+              cj[a][0] = fmadd (c02, jcol[a][2], fmadd (c01, jcol[a][1], c00 * jcol[a][0]));
+              cj[a][1] = fmadd (c12, jcol[a][2], fmadd (c11, jcol[a][1], c01 * jcol[a][0]));
+              cj[a][2] = fmadd (c22, jcol[a][2], fmadd (c12, jcol[a][1], c02 * jcol[a][0]));
+            }
+
+            // (x_k - mu_k)^T Sigma_k^-1 d2(T(x,p))/dpidpj, Equation 6.20 and 6.21 [Magnusson 2009]
+            BatchFloat uh[3][3];
+            uh[0][0] = fmadd (u[2], dotX (x, h_ang_[1]), u[1] * dotX (x, h_ang_[0]));
+            uh[0][1] = fmadd (u[2], dotX (x, h_ang_[3]), u[1] * dotX (x, h_ang_[2]));
+            uh[0][2] = fmadd (u[2], dotX (x, h_ang_[5]), u[1] * dotX (x, h_ang_[4]));
+            uh[1][1] = fmadd (u[2], dotX (x, h_ang_[8]), fmadd (u[1], dotX (x, h_ang_[7]), u[0] * dotX (x, h_ang_[6])));
+            uh[1][2] = fmadd (u[2], dotX (x, h_ang_[11]), fmadd (u[1], dotX (x, h_ang_[10]), u[0] * dotX (x, h_ang_[9])));
+            uh[2][2] = fmadd (u[2], dotX (x, h_ang_[14]), fmadd (u[1], dotX (x, h_ang_[13]), u[0] * dotX (x, h_ang_[12])));
+
+            BatchFloat c[3][3] = { { c00, c01, c02 }, { c01, c11, c12 }, { c02, c12, c22 } };
+            BatchFloat minus_d2 (-gauss_d2_);
+
+            // Update hessian, Equation 6.13 [Magnusson 2009]
+            for (int i = 0, k = 0; i < 6; ++i)
+            {
+              for (int j = i; j < 6; ++j, ++k)
+              {
+                // d(T(x,p))/dpi^T Sigma_k^-1 d(T(x,p))/dpj
+                BatchFloat jcj;
+                if (j < 3)
+                  jcj = c[i][j];
+                else if (i < 3)
+                  jcj = cj[j - 3][i];
+                else
+                  jcj = fmadd (jcol[i - 3][2], cj[j - 3][2], fmadd (jcol[i - 3][1], cj[j - 3][1], jcol[i - 3][0] * cj[j - 3][0]));
+
+                BatchFloat term = fmadd (minus_d2 * g[i], g[j], jcj);
+                if (i >= 3)
+                  term = term + uh[i - 3][j - 3];
+
+                hessian_sum_[k] = fmadd (f, term, hessian_sum_[k]);
+              }
+            }
+          }
+
+          size_ = 0;
+          if (++nr_batches_ == FLUSH_INTERVAL)
+            flush ();
+        }
+
+        /** \brief Source points, transformed points minus cell means and upper triangles of inverse covariances, one lane per pair. */
+        float x_[3][WIDTH], t_[3][WIDTH], c_[6][WIDTH], used_[WIDTH];
+
+        int size_;
+        int nr_batches_;
+        bool compute_hessian_;
+
+        float gauss_d1_, gauss_d2_;
+        float j_ang_[8][3];
+        float h_ang_[15][3];
+
+        BatchFloat score_sum_;
+        BatchFloat gradient_sum_[6];
+        BatchFloat hessian_sum_[21];
+
+        double score_;
+        Eigen::Matrix<double, 6, 1> gradient_;
+        Eigen::Matrix<double, 6, 6> hessian_;
+
+      public:
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+  }
+}
+
+#endif // FAST_PCL_REGISTRATION_NDT_BATCH_H_
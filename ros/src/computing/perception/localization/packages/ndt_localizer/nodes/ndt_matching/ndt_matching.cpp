@@ -34,11 +34,16 @@
  Yuki KITSUKAWA
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <chrono>
+#include <map>
+#include <set>
+#include <vector>
+#include <cmath>
 
 #include <ros/ros.h>
 #include <std_msgs/Float32.h>
@@ -70,11 +75,22 @@
 #include <pcl_ros/transforms.h>
 
 #include <runtime_manager/ConfigNdt.h>
+#include <map_file/PointsMapDelta.h>
 
 #include <ndt_localizer/ndt_stat.h>
 
+#ifdef NDT_MATCHING_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
 #define PREDICT_POSE_THRESHOLD 0.5
 
+// Tiles voxelized per scan when the local map moves, the first local map is built at once
+#define LOCAL_MAP_TILES_PER_SCAN 2
+// Part id of the points_map cloud in the square tiles, points_map and points_map_delta are never mixed
+#define WHOLE_MAP_DELTA_ID (-1)
+
 #define Wa 0.4
 #define Wb 0.3
 #define Wc 0.3
@@ -181,6 +197,12 @@ static ros::Publisher ndt_reliability_pub;
 static std_msgs::Float32 ndt_reliability;
 
 static bool _use_openmp = false;
+static std::string _search_method = "kdtree";  // kdtree, direct27, direct7, direct1
+static bool _use_batched_derivatives = false;
+static int _num_threads = 0;  // 0: omp_get_max_threads()
+static double _local_map_radius = 0.0;     // [m], 0: the whole map is the NDT target
+static double _local_map_tile_size = 50.0;  // [m]
+static int _resolution_levels = 1;          // 1: single resolution, n: coarse-to-fine over ndt_res * 2^(n-1) .. ndt_res
 static bool _get_height = false;
 static bool _use_local_transform = false;
 
@@ -190,6 +212,178 @@ static std::string filename;
 // static tf::TransformListener local_transform_listener;
 static tf::StampedTransform local_transform;
 
+// When _local_map_radius > 0, the points_map_delta tiles (or the whole points_map) are split into square tiles of
+// _local_map_tile_size. Each square tile keeps its points per points_map_loader tile id, so that a removed tile can be
+// taken out.
+typedef std::map<int64_t, pcl::PointCloud<pcl::PointXYZ>::Ptr> map_tile_parts;
+static std::map<int64_t, map_tile_parts> map_tiles;
+static std::map<int64_t, std::vector<int64_t> > map_delta_parts;  // points_map_loader tile id -> square tiles
+static std::set<int64_t> local_map_tiles;                          // square tiles in the NDT target
+static std::set<int64_t> local_map_changed;                        // tiles of local_map_tiles to be voxelized again
+
+// Tiles received on points_map_delta, keyed by the points_map_loader tile id, when _local_map_radius is 0
+static std::map<int64_t, pcl::PointCloud<pcl::PointXYZ>::Ptr> map_delta_tiles;
+static bool map_delta_loaded = false;
+
+static int64_t map_tile_id(int tile_x, int tile_y)
+{
+  return (static_cast<int64_t>(tile_x) << 32) | static_cast<uint32_t>(tile_y);
+}
+
+static void map_tile_index(double x, double y, int& tile_x, int& tile_y)
+{
+  tile_x = static_cast<int>(floor(x / _local_map_tile_size));
+  tile_y = static_cast<int>(floor(y / _local_map_tile_size));
+}
+
+#ifdef USE_FAST_PCL
+// Take the points of a points_map_delta tile out of the square tiles
+static void remove_map_delta_part(int64_t delta_id)
+{
+  std::map<int64_t, std::vector<int64_t> >::iterator delta = map_delta_parts.find(delta_id);
+  if (delta == map_delta_parts.end())
+  {
+    return;
+  }
+
+  for (std::size_t i = 0; i < delta->second.size(); i++)
+  {
+    int64_t id = delta->second[i];
+    map_tile_parts& parts = map_tiles[id];
+    parts.erase(delta_id);
+    if (parts.empty())
+    {
+      map_tiles.erase(id);
+    }
+    if (local_map_tiles.count(id) != 0)
+    {
+      local_map_changed.insert(id);
+    }
+  }
+  map_delta_parts.erase(delta);
+}
+
+// Tile borders must lie on the voxel borders of every resolution level, coarse voxels would otherwise be split
+// between tiles and only the part in the first tile kept by the merge
+static void round_local_map_tile_size()
+{
+  double coarse_res = ndt_res * static_cast<double>(1 << (std::max(_resolution_levels, 1) - 1));
+  _local_map_tile_size = std::max(1.0, std::round(_local_map_tile_size / coarse_res)) * coarse_res;
+}
+
+// Split the points of a points_map_delta tile into the square tiles
+static void add_map_delta_part(int64_t delta_id, const pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  remove_map_delta_part(delta_id);
+
+  std::vector<int64_t>& ids = map_delta_parts[delta_id];
+  for (const auto& p : cloud)
+  {
+    int tile_x, tile_y;
+    map_tile_index(p.x, p.y, tile_x, tile_y);
+    int64_t id = map_tile_id(tile_x, tile_y);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& part = map_tiles[id][delta_id];
+    if (!part)
+    {
+      part.reset(new pcl::PointCloud<pcl::PointXYZ>);
+      ids.push_back(id);
+      if (local_map_tiles.count(id) != 0)
+      {
+        local_map_changed.insert(id);
+      }
+    }
+    part->push_back(p);
+  }
+}
+
+// Make the tiles within _local_map_radius of (x, y) the NDT target. Only tiles entering the window or whose points
+// changed are voxelized, at most LOCAL_MAP_TILES_PER_SCAN of them per call once the first local map is built.
+static void update_local_map(double x, double y)
+{
+  int center_x, center_y;
+  map_tile_index(x, y, center_x, center_y);
+
+  int range = static_cast<int>(ceil(_local_map_radius / _local_map_tile_size));
+  std::set<int64_t> tiles;
+  std::vector<std::pair<int, int64_t> > pending;  // (distance in tiles, id), nearest first
+  for (int tile_x = center_x - range; tile_x <= center_x + range; tile_x++)
+  {
+    for (int tile_y = center_y - range; tile_y <= center_y + range; tile_y++)
+    {
+      int64_t id = map_tile_id(tile_x, tile_y);
+      if (map_tiles.count(id) == 0)
+      {
+        continue;
+      }
+      tiles.insert(id);
+      if (local_map_tiles.count(id) == 0 || local_map_changed.count(id) != 0)
+      {
+        pending.push_back(std::make_pair(std::max(abs(tile_x - center_x), abs(tile_y - center_y)), id));
+      }
+    }
+  }
+
+  bool changed = false;
+  for (std::set<int64_t>::iterator id = local_map_tiles.begin(); id != local_map_tiles.end();)
+  {
+    if (tiles.count(*id) == 0)
+    {
+      ndt.removeTargetTile(*id);
+      local_map_changed.erase(*id);
+      local_map_tiles.erase(id++);
+      changed = true;
+    }
+    else
+    {
+      ++id;
+    }
+  }
+
+  std::sort(pending.begin(), pending.end());
+  std::size_t count = pending.size();
+  if (local_map_tiles.empty() == false)
+  {
+    count = std::min<std::size_t>(count, LOCAL_MAP_TILES_PER_SCAN);
+  }
+  for (std::size_t i = 0; i < count; i++)
+  {
+    int64_t id = pending[i].second;
+    const map_tile_parts& parts = map_tiles[id];
+    pcl::PointCloud<pcl::PointXYZ>::Ptr tile(new pcl::PointCloud<pcl::PointXYZ>);
+    for (map_tile_parts::const_iterator part = parts.begin(); part != parts.end(); ++part)
+    {
+      *tile += *part->second;
+    }
+    ndt.addTargetTile(id, tile);
+    local_map_tiles.insert(id);
+    local_map_changed.erase(id);
+    changed = true;
+  }
+
+  if (changed == false)
+  {
+    return;
+  }
+  ndt.updateTargetTiles();
+  std::cout << "Local map: " << local_map_tiles.size() << " tiles around (" << center_x << ", " << center_y << "), "
+            << pending.size() - count << " pending" << std::endl;
+}
+#endif
+
+static void nearest_map_height(const pcl::PointCloud<pcl::PointXYZ>& cloud, double x, double y, double& min_distance,
+                               double& nearest_z)
+{
+  for (const auto& p : cloud)
+  {
+    double distance = hypot(x - p.x, y - p.y);
+    if (distance < min_distance)
+    {
+      min_distance = distance;
+      nearest_z = p.z;
+    }
+  }
+}
+
 static void param_callback(const runtime_manager::ConfigNdt::ConstPtr& input)
 {
   if (_use_gnss != input->init_pos_gnss)
@@ -283,44 +477,152 @@ static void param_callback(const runtime_manager::ConfigNdt::ConstPtr& input)
   }
 }
 
+// Called before the first map is given to NDT
+static void prepare_map_target()
+{
+  if (_use_local_transform == true)
+  {
+    tf::TransformListener local_transform_listener;
+    try
+    {
+      ros::Time now = ros::Time(0);
+      local_transform_listener.waitForTransform("/map", "/world", now, ros::Duration(10.0));
+      local_transform_listener.lookupTransform("/map", "world", now, local_transform);
+    }
+    catch (tf::TransformException& ex)
+    {
+      ROS_ERROR("%s", ex.what());
+    }
+  }
+
+  // Setting NDT parameters to default values
+  ndt.setMaximumIterations(max_iter);
+  ndt.setResolution(ndt_res);
+  ndt.setStepSize(step_size);
+  ndt.setTransformationEpsilon(trans_eps);
+}
+
 static void map_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 {
   if (map_loaded == 0)
   {
+    prepare_map_target();
+
     // Convert the data type(from sensor_msgs to pcl).
     pcl::fromROSMsg(*input, map);
 
     if (_use_local_transform == true)
     {
-      tf::TransformListener local_transform_listener;
-      try
-      {
-        ros::Time now = ros::Time(0);
-        local_transform_listener.waitForTransform("/map", "/world", now, ros::Duration(10.0));
-        local_transform_listener.lookupTransform("/map", "world", now, local_transform);
-      }
-      catch (tf::TransformException& ex)
-      {
-        ROS_ERROR("%s", ex.what());
-      }
-
       pcl_ros::transformPointCloud(map, map, local_transform.inverse());
     }
 
+#ifdef USE_FAST_PCL
+    // Without points_map_delta the whole map is split into the square tiles as a single part, the window is then
+    // built by update_local_map as with the loader tiles
+    if (_local_map_radius > 0.0)
+    {
+      round_local_map_tile_size();
+      add_map_delta_part(WHOLE_MAP_DELTA_ID, map);
+      map.clear();
+      map_loaded = 1;
+      std::cout << "Map: " << map_tiles.size() << " square tiles" << std::endl;
+      return;
+    }
+#endif
+
     pcl::PointCloud<pcl::PointXYZ>::Ptr map_ptr(new pcl::PointCloud<pcl::PointXYZ>(map));
     // Setting point cloud to be aligned to.
     ndt.setInputTarget(map_ptr);
 
-    // Setting NDT parameters to default values
-    ndt.setMaximumIterations(max_iter);
-    ndt.setResolution(ndt_res);
-    ndt.setStepSize(step_size);
-    ndt.setTransformationEpsilon(trans_eps);
-
     map_loaded = 1;
   }
 }
 
+#ifdef USE_FAST_PCL
+// Apply a tile delta from points_map_loader. With _local_map_radius > 0 the tiles are only split here and
+// voxelized by update_local_map, otherwise the added tiles are voxelized and the whole tile set is the target.
+static void map_delta_callback(const map_file::PointsMapDelta::ConstPtr& input)
+{
+  // The whole map has already been received on points_map
+  if (map_loaded == 1 && map_delta_loaded == false)
+  {
+    return;
+  }
+  if (map_loaded == 0)
+  {
+    prepare_map_target();
+  }
+
+  if (input->reset == true)
+  {
+    for (std::map<int64_t, pcl::PointCloud<pcl::PointXYZ>::Ptr>::const_iterator tile = map_delta_tiles.begin();
+         tile != map_delta_tiles.end(); ++tile)
+    {
+      ndt.removeTargetTile(tile->first);
+    }
+    map_delta_tiles.clear();
+
+    for (std::set<int64_t>::const_iterator id = local_map_tiles.begin(); id != local_map_tiles.end(); ++id)
+    {
+      ndt.removeTargetTile(*id);
+    }
+    local_map_tiles.clear();
+    local_map_changed.clear();
+    map_tiles.clear();
+    map_delta_parts.clear();
+  }
+
+  if (_local_map_radius > 0.0 && map_delta_parts.empty())
+  {
+    round_local_map_tile_size();
+  }
+
+  for (std::size_t i = 0; i < input->removed_ids.size(); i++)
+  {
+    if (_local_map_radius > 0.0)
+    {
+      remove_map_delta_part(input->removed_ids[i]);
+    }
+    else
+    {
+      ndt.removeTargetTile(input->removed_ids[i]);
+      map_delta_tiles.erase(input->removed_ids[i]);
+    }
+  }
+
+  for (std::size_t i = 0; i < input->added_ids.size() && i < input->added_tiles.size(); i++)
+  {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr tile(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::fromROSMsg(input->added_tiles[i], *tile);
+    if (_use_local_transform == true)
+    {
+      pcl_ros::transformPointCloud(*tile, *tile, local_transform.inverse());
+    }
+    if (_local_map_radius > 0.0)
+    {
+      add_map_delta_part(input->added_ids[i], *tile);
+    }
+    else
+    {
+      ndt.addTargetTile(input->added_ids[i], tile);
+      map_delta_tiles[input->added_ids[i]] = tile;
+    }
+  }
+
+  // The local map is rebuilt by update_local_map, only a reset has to be applied here
+  if (_local_map_radius <= 0.0 || input->reset == true)
+  {
+    ndt.updateTargetTiles();
+  }
+
+  map_loaded = 1;
+  map_delta_loaded = true;
+  std::cout << "Map delta: +" << input->added_ids.size() << " -" << input->removed_ids.size() << " tiles, "
+            << (_local_map_radius > 0.0 ? map_delta_parts.size() : map_delta_tiles.size()) << " tiles loaded"
+            << std::endl;
+}
+#endif
+
 static void gnss_callback(const geometry_msgs::PoseStamped::ConstPtr& input)
 {
   tf::Quaternion gnss_q(input->pose.orientation.x, input->pose.orientation.y, input->pose.orientation.z,
@@ -400,15 +702,39 @@ static void initialpose_callback(const geometry_msgs::PoseWithCovarianceStamped:
   {
     double min_distance = DBL_MAX;
     double nearest_z = current_pose.z;
-    for (const auto& p : map)
+    if (_local_map_radius > 0.0)
     {
-      double distance = hypot(current_pose.x - p.x, current_pose.y - p.y);
-      if (distance < min_distance)
+      // Only the tiles around the pose are searched
+      int center_x, center_y;
+      map_tile_index(current_pose.x, current_pose.y, center_x, center_y);
+      for (int tile_x = center_x - 1; tile_x <= center_x + 1; tile_x++)
       {
-        min_distance = distance;
-        nearest_z = p.z;
+        for (int tile_y = center_y - 1; tile_y <= center_y + 1; tile_y++)
+        {
+          std::map<int64_t, map_tile_parts>::const_iterator tile = map_tiles.find(map_tile_id(tile_x, tile_y));
+          if (tile == map_tiles.end())
+          {
+            continue;
+          }
+          for (map_tile_parts::const_iterator part = tile->second.begin(); part != tile->second.end(); ++part)
+          {
+            nearest_map_height(*part->second, current_pose.x, current_pose.y, min_distance, nearest_z);
+          }
+        }
       }
     }
+    else if (map_delta_loaded == true)
+    {
+      for (std::map<int64_t, pcl::PointCloud<pcl::PointXYZ>::Ptr>::const_iterator tile = map_delta_tiles.begin();
+           tile != map_delta_tiles.end(); ++tile)
+      {
+        nearest_map_height(*tile->second, current_pose.x, current_pose.y, min_distance, nearest_z);
+      }
+    }
+    else
+    {
+      nearest_map_height(map, current_pose.x, current_pose.y, min_distance, nearest_z);
+    }
     current_pose.z = nearest_z;
   }
 
@@ -425,7 +751,9 @@ static void initialpose_callback(const geometry_msgs::PoseWithCovarianceStamped:
   offset_yaw = 0.0;
 }
 
-static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
+// Scans arrive as pcl clouds so that, when loaded as a nodelet next to the
+// points_downsampler nodelets, they are shared by pointer instead of serialized.
+static void points_callback(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& input)
 {
   if (map_loaded == 1 && init_pos_set == 1)
   {
@@ -436,12 +764,12 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     tf::Quaternion predict_q, ndt_q, current_q, localizer_q;
 
     pcl::PointXYZ p;
-    pcl::PointCloud<pcl::PointXYZ> filtered_scan;
+    const std_msgs::Header header = pcl_conversions::fromPCL(input->header);
 
-    current_scan_time = input->header.stamp;
+    current_scan_time = header.stamp;
 
-    pcl::fromROSMsg(*input, filtered_scan);
-    pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZ>(filtered_scan));
+    pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZ>());
+    pcl::copyPointCloud(*input, *filtered_scan_ptr);
     int scan_points_num = filtered_scan_ptr->size();
 
     Eigen::Matrix4f t(Eigen::Matrix4f::Identity());   // base_link
@@ -468,6 +796,20 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     Eigen::AngleAxisf init_rotation_z(predict_pose.yaw, Eigen::Vector3f::UnitZ());
     Eigen::Matrix4f init_guess = (init_translation * init_rotation_z * init_rotation_y * init_rotation_x) * tf_btol;
 
+#ifdef USE_FAST_PCL
+    if (_local_map_radius > 0.0)
+    {
+      update_local_map(predict_pose.x, predict_pose.y);
+    }
+#endif
+
+    // No map tile around the pose yet
+    if (!ndt.getInputTarget() || ndt.getInputTarget()->empty())
+    {
+      std::cout << "NDT target is empty, skipping the scan." << std::endl;
+      return;
+    }
+
     pcl::PointCloud<pcl::PointXYZ>::Ptr output_cloud(new pcl::PointCloud<pcl::PointXYZ>);
 #ifdef USE_FAST_PCL
     if (_use_openmp == true)
@@ -763,7 +1105,7 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
       std::cerr << "Could not open " << filename << "." << std::endl;
       exit(1);
     }
-    ofs << input->header.seq << "," << scan_points_num << "," << step_size << "," << trans_eps << "," << std::fixed
+    ofs << header.seq << "," << scan_points_num << "," << step_size << "," << trans_eps << "," << std::fixed
         << std::setprecision(5) << current_pose.x << "," << std::fixed << std::setprecision(5) << current_pose.y << ","
         << std::fixed << std::setprecision(5) << current_pose.z << "," << current_pose.roll << "," << current_pose.pitch
         << "," << current_pose.yaw << "," << predict_pose.x << "," << predict_pose.y << "," << predict_pose.z << ","
@@ -777,9 +1119,9 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
         << std::endl;
 
     std::cout << "-----------------------------------------------------------------" << std::endl;
-    std::cout << "Sequence: " << input->header.seq << std::endl;
-    std::cout << "Timestamp: " << input->header.stamp << std::endl;
-    std::cout << "Frame ID: " << input->header.frame_id << std::endl;
+    std::cout << "Sequence: " << header.seq << std::endl;
+    std::cout << "Timestamp: " << header.stamp << std::endl;
+    std::cout << "Frame ID: " << header.frame_id << std::endl;
     //		std::cout << "Number of Scan Points: " << scan_ptr->size() << " points." << std::endl;
     std::cout << "Number of Filtered Scan Points: " << scan_points_num << " points." << std::endl;
     std::cout << "NDT has converged: " << ndt.hasConverged() << std::endl;
@@ -840,13 +1182,17 @@ static void points_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
   }
 }
 
-int main(int argc, char** argv)
-{
-  ros::init(argc, argv, "ndt_matching");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
+static ros::Subscriber param_sub;
+static ros::Subscriber gnss_sub;
+static ros::Subscriber map_sub;
+#ifdef USE_FAST_PCL
+static ros::Subscriber map_delta_sub;
+#endif
+static ros::Subscriber initialpose_sub;
+static ros::Subscriber points_sub;
 
+static bool setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
+{
   // Set log file name.
   char buffer[80];
   std::time_t now = std::time(NULL);
@@ -860,44 +1206,63 @@ int main(int argc, char** argv)
   private_nh.getParam("queue_size", _queue_size);
   private_nh.getParam("offset", _offset);
   private_nh.getParam("use_openmp", _use_openmp);
+  private_nh.getParam("search_method", _search_method);
+  private_nh.getParam("use_batched_derivatives", _use_batched_derivatives);
+  private_nh.getParam("num_threads", _num_threads);
+  private_nh.getParam("local_map_radius", _local_map_radius);
+  private_nh.getParam("local_map_tile_size", _local_map_tile_size);
+  private_nh.getParam("resolution_levels", _resolution_levels);
+
+  if (_local_map_tile_size <= 0.0)
+  {
+    std::cout << "local_map_tile_size must be positive, using 50 m." << std::endl;
+    _local_map_tile_size = 50.0;
+  }
+#ifndef USE_FAST_PCL
+  if (_local_map_radius > 0.0)
+  {
+    std::cout << "local_map_radius requires fast_pcl, using the whole map." << std::endl;
+    _local_map_radius = 0.0;
+  }
+#endif
   private_nh.getParam("get_height", _get_height);
   private_nh.getParam("use_local_transform", _use_local_transform);
 
   if (nh.getParam("localizer", _localizer) == false)
   {
     std::cout << "localizer is not set." << std::endl;
-    return 1;
+    return false;
   }
 
   if (nh.getParam("tf_x", _tf_x) == false)
   {
     std::cout << "tf_x is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_y", _tf_y) == false)
   {
     std::cout << "tf_y is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_z", _tf_z) == false)
   {
     std::cout << "tf_z is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_roll", _tf_roll) == false)
   {
     std::cout << "tf_roll is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_pitch", _tf_pitch) == false)
   {
     std::cout << "tf_pitch is not set." << std::endl;
-    return 1;
+    return false;
   }
   if (nh.getParam("tf_yaw", _tf_yaw) == false)
   {
     std::cout << "tf_yaw is not set." << std::endl;
-    return 1;
+    return false;
   }
 
   std::cout << "-----------------------------------------------------------------" << std::endl;
@@ -906,6 +1271,12 @@ int main(int argc, char** argv)
   std::cout << "queue_size: " << _queue_size << std::endl;
   std::cout << "offset: " << _offset << std::endl;
   std::cout << "use_openmp: " << _use_openmp << std::endl;
+  std::cout << "search_method: " << _search_method << std::endl;
+  std::cout << "use_batched_derivatives: " << _use_batched_derivatives << std::endl;
+  std::cout << "num_threads: " << _num_threads << std::endl;
+  std::cout << "local_map_radius: " << _local_map_radius << std::endl;
+  std::cout << "local_map_tile_size: " << _local_map_tile_size << std::endl;
+  std::cout << "resolution_levels: " << _resolution_levels << std::endl;
   std::cout << "get_height: " << _get_height << std::endl;
   std::cout << "use_local_transform: " << _use_local_transform << std::endl;
   std::cout << "localizer: " << _localizer << std::endl;
@@ -925,6 +1296,28 @@ int main(int argc, char** argv)
   Eigen::AngleAxisf rot_z_ltob((-1.0) * _tf_yaw, Eigen::Vector3f::UnitZ());
   tf_ltob = (tl_ltob * rot_z_ltob * rot_y_ltob * rot_x_ltob).matrix();
 
+#ifdef USE_FAST_PCL
+  if (_search_method == "direct27")
+  {
+    ndt.setNeighborSearchMethod(pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ>::DIRECT27);
+  }
+  else if (_search_method == "direct7")
+  {
+    ndt.setNeighborSearchMethod(pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ>::DIRECT7);
+  }
+  else if (_search_method == "direct1")
+  {
+    ndt.setNeighborSearchMethod(pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ>::DIRECT1);
+  }
+  else
+  {
+    ndt.setNeighborSearchMethod(pcl::NormalDistributionsTransform<pcl::PointXYZ, pcl::PointXYZ>::KDTREE);
+  }
+  ndt.setUseBatchedDerivatives(_use_batched_derivatives);
+  ndt.setNumberOfThreads(_num_threads > 0 ? _num_threads : 0);
+  ndt.setNumResolutionLevels(_resolution_levels);
+#endif
+
   // Updated in initialpose_callback or gnss_callback
   initial_pose.x = 0.0;
   initial_pose.y = 0.0;
@@ -947,13 +1340,52 @@ int main(int argc, char** argv)
   ndt_reliability_pub = nh.advertise<std_msgs::Float32>("/ndt_reliability", 1000);
 
   // Subscribers
-  ros::Subscriber param_sub = nh.subscribe("config/ndt", 10, param_callback);
-  ros::Subscriber gnss_sub = nh.subscribe("gnss_pose", 10, gnss_callback);
-  ros::Subscriber map_sub = nh.subscribe("points_map", 10, map_callback);
-  ros::Subscriber initialpose_sub = nh.subscribe("initialpose", 1000, initialpose_callback);
-  ros::Subscriber points_sub = nh.subscribe("filtered_points", _queue_size, points_callback);
+  param_sub = nh.subscribe("config/ndt", 10, param_callback);
+  gnss_sub = nh.subscribe("gnss_pose", 10, gnss_callback);
+  // The first of points_map and points_map_delta to arrive is used, the other one is ignored
+  map_sub = nh.subscribe("points_map", 10, map_callback);
+#ifdef USE_FAST_PCL
+  map_delta_sub = nh.subscribe("points_map_delta", 10, map_delta_callback);
+#endif
+  initialpose_sub = nh.subscribe("initialpose", 1000, initialpose_callback);
+  points_sub = nh.subscribe("filtered_points", _queue_size, points_callback);
+
+  return true;
+}
+
+#ifdef NDT_MATCHING_NODELET
+namespace ndt_localizer
+{
+// The matcher state is file-static, so load at most one instance per manager.
+class NdtMatchingNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    if (!setup(getNodeHandle(), getPrivateNodeHandle()))
+    {
+      NODELET_ERROR("ndt_matching is not configured, not subscribing to filtered_points.");
+    }
+  }
+};
+}  // namespace ndt_localizer
+
+PLUGINLIB_EXPORT_CLASS(ndt_localizer::NdtMatchingNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "ndt_matching");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  if (!setup(nh, private_nh))
+  {
+    return 1;
+  }
 
   ros::spin();
 
   return 0;
 }
+#endif
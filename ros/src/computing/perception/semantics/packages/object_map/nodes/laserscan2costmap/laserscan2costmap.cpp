@@ -32,6 +32,7 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cmath>
 
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
@@ -63,7 +64,7 @@ struct Grid
 
   void calcCoordinate();
   void calcRange();
-  int calcGlobalIndex(const tf::StampedTransform& transform) const;
+  int calcRingIndex(int ring_x, int ring_y) const;
 };
 
 struct Cost
@@ -122,39 +123,31 @@ void Grid::calcRange()
   range = sqrt(distance_x * distance_x + distance_y * distance_y);
 }
 
-// Change local index into global index
-int Grid::calcGlobalIndex(const tf::StampedTransform& transform) const
+// Position of a global grid index in the ring buffer
+int wrapIndex(int index, int size)
 {
-  // Calculate index in global frame
-  int ix = (x + transform.getOrigin().x()) / g_resolution;
-  int iy = (y + transform.getOrigin().y()) / g_resolution;
-
-  // Make indexes positive value
-  int global_grid_x = (ix + 100000 * g_scan_size_x) % g_scan_size_x;
-  int global_grid_y = (iy + 100000 * g_scan_size_y) % g_scan_size_y;
-
-  int global_index = global_grid_x + global_grid_y * g_scan_size_x;
-
-  return global_index;
+  index %= size;
+  return index < 0 ? index + size : index;
 }
 
-int calcGlobalIndex(int grid_x, int grid_y, const tf::StampedTransform& transform)
+// Change local index into ring buffer index.
+// ring_x and ring_y are the ring buffer position of the sensor's grid
+int Grid::calcRingIndex(int ring_x, int ring_y) const
 {
-  // Point coordinate in velodyne(local) frame
-  double local_x = (grid_x - g_scan_size_x / 2.0) * g_resolution;
-  double local_y = (grid_y - g_scan_size_y / 2.0) * g_resolution;
-
-  // Calculate index in global coordinate
-  int ix = (local_x + transform.getOrigin().x()) / g_resolution;
-  int iy = (local_y + transform.getOrigin().y()) / g_resolution;
-
-  // Make indexes positive value
-  int global_grid_x = (ix + 100000 * g_scan_size_x) % g_scan_size_x;
-  int global_grid_y = (iy + 100000 * g_scan_size_y) % g_scan_size_y;
-
-  int global_index = global_grid_x + global_grid_y * g_scan_size_x;
-
-  return global_index;
+  int x = ring_x + index_x - g_scan_size_x / 2;
+  int y = ring_y + index_y - g_scan_size_y / 2;
+
+  // Offsets are within half a map, so one wrap is enough
+  if (x < 0)
+    x += g_scan_size_x;
+  else if (x >= g_scan_size_x)
+    x -= g_scan_size_x;
+  if (y < 0)
+    y += g_scan_size_y;
+  else if (y >= g_scan_size_y)
+    y -= g_scan_size_y;
+
+  return x + y * g_scan_size_x;
 }
 
 void preCasting(const sensor_msgs::LaserScan& scan, std::vector<std::vector<Grid>>* precasted_grids)
@@ -214,48 +207,41 @@ void preCasting(const sensor_msgs::LaserScan& scan, std::vector<std::vector<Grid
 
 
 // Delete old cost values
-void deleteOldData(std::vector<Cost>* cost_map, double current_x, double current_y, double prev_x, double prev_y)
+// The cost map is a ring buffer over the global grid, so only the rows and
+// columns which newly enter the scanning area have to be cleared
+void deleteOldData(std::vector<Cost>* cost_map, int cell_x, int cell_y, int prev_cell_x, int prev_cell_y)
 {
-  double begin_x = current_x;
-  double begin_y = current_y;
-  double end_x = prev_x;
-  double end_y = prev_y;
-
-  if (begin_x > end_x)
-    std::swap(begin_x, end_x);
-  if (begin_y > end_y)
-    std::swap(begin_y, end_y);
-
-  int ibegin_x = begin_x / g_resolution + g_scan_size_x / 2;
-  int ibegin_y = begin_y / g_resolution + g_scan_size_y / 2;
-  int iend_x = end_x / g_resolution + g_scan_size_x / 2;
-  int iend_y = end_y / g_resolution + g_scan_size_y / 2;
-
-  for (int i = ibegin_x; i < iend_x; i++)
+  int shift_x = cell_x - prev_cell_x;
+  if (shift_x != 0)
   {
-    for (int j = 0; j < g_scan_size_y; j++)
+    int count = std::min(std::abs(shift_x), g_scan_size_x);
+    int low = cell_x - g_scan_size_x / 2;
+    int first = shift_x > 0 ? low + g_scan_size_x - count : low;
+    for (int i = 0; i < count; i++)
     {
-      int global_grid_x = (i + 100000 * g_scan_size_x) % g_scan_size_x;
-      cost_map->at(global_grid_x + j * g_scan_size_x).occupied = 0;
-      cost_map->at(global_grid_x + j * g_scan_size_x).free     = 0;
-      cost_map->at(global_grid_x + j * g_scan_size_x).unknown  = true;
+      int ring_x = wrapIndex(first + i, g_scan_size_x);
+      for (int j = 0; j < g_scan_size_y; j++)
+        cost_map->at(ring_x + j * g_scan_size_x) = Cost();
     }
   }
 
-  for (int i = 0; i < g_scan_size_x; i++)
+  int shift_y = cell_y - prev_cell_y;
+  if (shift_y != 0)
   {
-    for (int j = ibegin_y; j < iend_y; j++)
+    int count = std::min(std::abs(shift_y), g_scan_size_y);
+    int low = cell_y - g_scan_size_y / 2;
+    int first = shift_y > 0 ? low + g_scan_size_y - count : low;
+    for (int j = 0; j < count; j++)
     {
-      int global_grid_y = (j + 100000 * g_scan_size_y) % g_scan_size_y;
-      cost_map->at(i + global_grid_y * g_scan_size_x).occupied = 0;
-      cost_map->at(i + global_grid_y * g_scan_size_x).free     = 0;
-      cost_map->at(i + global_grid_y * g_scan_size_x).unknown  = true;
+      int ring_y = wrapIndex(first + j, g_scan_size_y);
+      auto row = cost_map->begin() + ring_y * g_scan_size_x;
+      std::fill(row, row + g_scan_size_x, Cost());
     }
   }
 }
 
 void setOccupancyGridMap(nav_msgs::OccupancyGrid* map, const std_msgs::Header& header,
-                         const tf::StampedTransform& transform)
+                         const tf::StampedTransform& transform, int cell_x, int cell_y)
 {
   map->header.stamp = header.stamp;
   map->header.frame_id = OGM_FRAME;
@@ -263,8 +249,8 @@ void setOccupancyGridMap(nav_msgs::OccupancyGrid* map, const std_msgs::Header& h
   map->info.resolution = g_resolution;
   map->info.height = g_map_size_y;
   map->info.width = g_map_size_x;
-  map->info.origin.position.x = transform.getOrigin().x() - (g_map_size_x / 2) * g_resolution;
-  map->info.origin.position.y = transform.getOrigin().y() - (g_map_size_y / 2) * g_resolution;
+  map->info.origin.position.x = (cell_x - g_map_size_x / 2) * g_resolution;
+  map->info.origin.position.y = (cell_y - g_map_size_y / 2) * g_resolution;
   map->info.origin.position.z = transform.getOrigin().z() - 5;
   map->info.origin.orientation.x = 0;
   map->info.origin.orientation.y = 0;
@@ -290,11 +276,15 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
   // Save costs in this variable
   static std::vector<Cost> cost_map(g_scan_size_x * g_scan_size_y);
 
+  // Global grid index of the sensor
+  int cell_x = std::floor(transform.getOrigin().x() / g_resolution);
+  int cell_y = std::floor(transform.getOrigin().y() / g_resolution);
+
   static bool initialized_map = false;
-  static double prev_x = transform.getOrigin().x();
-  static double prev_y = transform.getOrigin().y();
+  static int prev_cell_x = cell_x;
+  static int prev_cell_y = cell_y;
   static nav_msgs::OccupancyGrid map;
-  setOccupancyGridMap(&map, scan.header, transform);
+  setOccupancyGridMap(&map, scan.header, transform, cell_x, cell_y);
   if (!initialized_map)
   {
     map.data.resize(g_map_size_x * g_map_size_y, -1);
@@ -302,9 +292,13 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
   }
 
   // Since we implement as ring buffer, we have to delete old data regularly
-  deleteOldData(&cost_map, transform.getOrigin().x(), transform.getOrigin().y(), prev_x, prev_y);
-  prev_x = transform.getOrigin().x();
-  prev_y = transform.getOrigin().y();
+  deleteOldData(&cost_map, cell_x, cell_y, prev_cell_x, prev_cell_y);
+  prev_cell_x = cell_x;
+  prev_cell_y = cell_y;
+
+  // Ring buffer position of the sensor's grid
+  int ring_x = wrapIndex(cell_x, g_scan_size_x);
+  int ring_y = wrapIndex(cell_y, g_scan_size_y);
 
   // Vehicle's orientation
   double yaw = calcYawFromQuaternion(transform.getRotation());
@@ -336,6 +330,9 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
       range = scan.range_max;
 
     int precasted_index = (i + index_offset) % iangle_size;
+    if (precasted_grids[precasted_index].empty())
+      continue;
+
     int obstacle_index = -1;
     for (const auto& g : precasted_grids[precasted_index])
     {
@@ -345,35 +342,33 @@ void createCostMap(const sensor_msgs::LaserScan& scan, const std::vector<std::ve
         break;
 
       // Free range
-      int global_index = g.calcGlobalIndex(transform);
-      cost_map[global_index].accumulateCost(0, FREE_INCREMENT);
+      int ring_index = g.calcRingIndex(ring_x, ring_y);
+      cost_map[ring_index].accumulateCost(0, FREE_INCREMENT);
     }
 
     // Obstacle
-    int global_index = precasted_grids[precasted_index][obstacle_index].calcGlobalIndex(transform);
-    cost_map[global_index].accumulateCost(OCCUPIED_INCREMENT, 0);
+    int ring_index = precasted_grids[precasted_index][obstacle_index].calcRingIndex(ring_x, ring_y);
+    cost_map[ring_index].accumulateCost(OCCUPIED_INCREMENT, 0);
 
   }
 
 
-  // Begining of grid index of publishing OGM
-  static int origin_index_x = (g_scan_size_x - g_map_size_x) / 2.0;
-  static int origin_index_y = (g_scan_size_y - g_map_size_y) / 2.0;
-  // static int origin_index = origin_index_x + origin_index_y * g_scan_size_x;
-
   // Set cost values for publishing OccuppancyGridMap
+  // Each row of the publishing area is at most two runs in the ring buffer
+  int begin_x = wrapIndex(cell_x - g_map_size_x / 2, g_scan_size_x);
   for (int i = 0; i < g_map_size_y; i++)
   {
+    int scanmap_y = wrapIndex(cell_y - g_map_size_y / 2 + i, g_scan_size_y);
+    const Cost* row = &cost_map[scanmap_y * g_scan_size_x];
+    int8_t* data = &map.data[i * g_map_size_x];
+
+    int scanmap_x = begin_x;
     for (int j = 0; j < g_map_size_x; j++)
     {
-      int scanmap_index_x = origin_index_x + j;
-      int scanmap_index_y = origin_index_y + i;
-
-      int global_index = calcGlobalIndex(scanmap_index_x, scanmap_index_y, transform);
-      if (cost_map[global_index].unknown)
-        map.data[j + i * g_map_size_x] = -1;
-      else
-        map.data[j + i * g_map_size_x] = (cost_map[global_index].occupied + 8) * 6;
+      const Cost& cost = row[scanmap_x];
+      data[j] = cost.unknown ? -1 : (cost.occupied + 8) * 6;
+      if (++scanmap_x == g_scan_size_x)
+        scanmap_x = 0;
     }
   }
 
@@ -419,6 +414,10 @@ int main(int argc, char** argv)
   private_nh.param<std::string>("scan_topic", g_scan_topic, "/scan");
   private_nh.param<std::string>("sensor_frame", g_sensor_frame, "/velodyne");
 
+  // The publishing area is cut out of the scanning area
+  g_map_size_x = std::min(g_map_size_x, g_scan_size_x);
+  g_map_size_y = std::min(g_map_size_y, g_scan_size_y);
+
   ros::Subscriber laserscan_sub = nh.subscribe(g_scan_topic, 1, laserScanCallback);
 
   g_map_pub = nh.advertise<nav_msgs::OccupancyGrid>("/ring_ogm", 1);
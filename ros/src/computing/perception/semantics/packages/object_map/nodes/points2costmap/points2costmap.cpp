@@ -31,48 +31,135 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <grid_map_ros/grid_map_ros.hpp>
+#include <grid_map_msgs/GridMap.h>
 #include <pcl_conversions/pcl_conversions.h>
 
+#include <limits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace
 {
 constexpr double HEIGHT_LIMIT = 0.1;  // from sensor
 constexpr double CAR_LENGTH = 4.5;
 constexpr double CAR_WIDTH = 1.75;
+constexpr int COST_INCREMENT = 15;
+constexpr int COST_MAX = 100;
 
 ros::Publisher g_costmap_pub;
+ros::Publisher g_layers_pub;
 double g_resolution;
 int g_cell_width;
 int g_cell_height;
 
-std::vector<int> createCostMap(const pcl::PointCloud<pcl::PointXYZ> &scan)
+// Points which fall into one grid
+struct Cell
+{
+  int count = 0;      // all points
+  int low_count = 0;  // points below HEIGHT_LIMIT, used for the cost
+  float min_z = std::numeric_limits<float>::infinity();
+  float max_z = -std::numeric_limits<float>::infinity();
+
+  void add(float z)
+  {
+    count++;
+    if (z <= HEIGHT_LIMIT)
+      low_count++;
+    if (z < min_z)
+      min_z = z;
+    if (z > max_z)
+      max_z = z;
+  }
+
+  void merge(const Cell &other)
+  {
+    count += other.count;
+    low_count += other.low_count;
+    if (other.min_z < min_z)
+      min_z = other.min_z;
+    if (other.max_z > max_z)
+      max_z = other.max_z;
+  }
+
+  int8_t cost() const
+  {
+    return std::min(COST_INCREMENT * low_count, COST_MAX);
+  }
+};
+
+int threadCount()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+int threadNumber()
+{
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Rasterize the points in chunks, each thread into its own grid, and
+// merge the grids cell by cell
+void createCostMap(const pcl::PointCloud<pcl::PointXYZ> &scan, std::vector<Cell> *cells)
 {
-  std::vector<int> cost_map(g_cell_width * g_cell_height, 0);
+  static std::vector<std::vector<Cell>> local_cells;
+  int cell_count = g_cell_width * g_cell_height;
+  int team_size = 1;
   double map_center_x = (g_cell_width / 2.0) * g_resolution;
   double map_center_y = (g_cell_height / 2.0) * g_resolution;
 
-  // scan points are in sensor frame
-  for (const auto &p : scan.points)
+  local_cells.resize(threadCount());
+  cells->resize(cell_count);
+
+#pragma omp parallel
   {
-    if (p.z > HEIGHT_LIMIT)
-      continue;
-    if (std::fabs(p.x) < CAR_LENGTH && std::fabs(p.y) < CAR_WIDTH)
-      continue;
-
-    // Calculate grid index
-    int grid_x = (p.x + map_center_x) / g_resolution;
-    int grid_y = (p.y + map_center_y) / g_resolution;
-    if (grid_x < 0 || grid_x >= g_cell_width || grid_y < 0 || grid_y >= g_cell_height)
-      continue;
-
-    int index = g_cell_width * grid_y + grid_x;
-    cost_map[index] += 15;
-
-    // Max cost value is 100
-    if (cost_map[index] > 100)
-      cost_map[index] = 100;
-  }
+    std::vector<Cell> &local = local_cells[threadNumber()];
+    local.assign(cell_count, Cell());
+
+#pragma omp single
+    {
+#ifdef _OPENMP
+      team_size = omp_get_num_threads();
+#endif
+    }
+
+    // scan points are in sensor frame
+#pragma omp for schedule(static)
+    for (size_t i = 0; i < scan.points.size(); i++)
+    {
+      const auto &p = scan.points[i];
+      if (std::fabs(p.x) < CAR_LENGTH && std::fabs(p.y) < CAR_WIDTH)
+        continue;
+
+      // Calculate grid index
+      int grid_x = (p.x + map_center_x) / g_resolution;
+      int grid_y = (p.y + map_center_y) / g_resolution;
+      if (grid_x < 0 || grid_x >= g_cell_width || grid_y < 0 || grid_y >= g_cell_height)
+        continue;
 
-  return cost_map;
+      local[g_cell_width * grid_y + grid_x].add(p.z);
+    }
+
+#pragma omp for schedule(static)
+    for (int index = 0; index < cell_count; index++)
+    {
+      Cell cell = local_cells[0][index];
+      for (int t = 1; t < team_size; t++)
+        cell.merge(local_cells[t][index]);
+      (*cells)[index] = cell;
+    }
+  }
 }
 
 void setOccupancyGrid(nav_msgs::OccupancyGrid *og)
@@ -88,6 +175,46 @@ void setOccupancyGrid(nav_msgs::OccupancyGrid *og)
   og->info.origin.orientation.w = 1.0;
 }
 
+// Publish cost, min_height, max_height and count layers.
+// grid_map indexes from the +x +y corner, so both axes are flipped
+void publishLayers(const std_msgs::Header &header, const std::vector<Cell> &cells)
+{
+  static grid_map::GridMap layers({ "cost", "min_height", "max_height", "count" });
+  static bool initialized = false;
+  if (!initialized)
+  {
+    layers.setGeometry(grid_map::Length(g_cell_width * g_resolution, g_cell_height * g_resolution), g_resolution);
+    initialized = true;
+  }
+  layers.setFrameId(header.frame_id);
+  layers.setTimestamp(header.stamp.toNSec());
+
+  grid_map::Matrix &cost = layers["cost"];
+  grid_map::Matrix &min_height = layers["min_height"];
+  grid_map::Matrix &max_height = layers["max_height"];
+  grid_map::Matrix &count = layers["count"];
+  float nan = std::numeric_limits<float>::quiet_NaN();
+
+#pragma omp parallel for schedule(static)
+  for (int grid_y = 0; grid_y < g_cell_height; grid_y++)
+  {
+    for (int grid_x = 0; grid_x < g_cell_width; grid_x++)
+    {
+      const Cell &cell = cells[g_cell_width * grid_y + grid_x];
+      int i = g_cell_width - 1 - grid_x;
+      int j = g_cell_height - 1 - grid_y;
+      cost(i, j) = cell.cost();
+      min_height(i, j) = cell.count ? cell.min_z : nan;
+      max_height(i, j) = cell.count ? cell.max_z : nan;
+      count(i, j) = cell.count;
+    }
+  }
+
+  grid_map_msgs::GridMap message;
+  grid_map::GridMapRosConverter::toMessage(layers, message);
+  g_layers_pub.publish(message);
+}
+
 void createOccupancyGrid(const sensor_msgs::PointCloud2::ConstPtr &input)
 {
   static int count = 0;
@@ -101,10 +228,16 @@ void createOccupancyGrid(const sensor_msgs::PointCloud2::ConstPtr &input)
   og.header = input->header;
 
   // create cost map with pointcloud
-  std::vector<int> cost_map = createCostMap(scan);
-  og.data.insert(og.data.end(), cost_map.begin(), cost_map.end());
+  static std::vector<Cell> cells;
+  createCostMap(scan, &cells);
+
+  og.data.resize(cells.size());
+  for (size_t i = 0; i < cells.size(); i++)
+    og.data[i] = cells[i].cost();
   g_costmap_pub.publish(og);
-  og.data.clear();
+
+  if (g_layers_pub.getNumSubscribers() > 0)
+    publishLayers(input->header, cells);
   count++;
 }
 
@@ -125,6 +258,7 @@ int main(int argc, char **argv)
   private_nh.param<std::string>("points_topic", points_topic, "points_lanes");
 
   g_costmap_pub = nh.advertise<nav_msgs::OccupancyGrid>("realtime_cost_map", 10);
+  g_layers_pub = nh.advertise<grid_map_msgs::GridMap>("realtime_cost_map_layers", 10);
   ros::Subscriber points_sub = nh.subscribe(points_topic, 10, createOccupancyGrid);
 
   ros::spin();
@@ -13,6 +13,7 @@
 #include <sensor_msgs/PointCloud2.h>
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <vector>
 
 using namespace grid_map;
 
@@ -31,7 +32,14 @@ private:
   double map_resolution_;
   double tf_x_;
   double tf_z_;
+  double obstacle_kernel_cutoff_;
+  double vscan_decay_;
   GridMap map_;
+  // cell center coordinates, x by row index and y by column index
+  std::vector<double> cell_x_;
+  std::vector<double> cell_y_;
+  // nonzero cells of vscan_points_field
+  std::vector<Index> vscan_cells_;
   class ObstacleFieldParameter {
   public:
     ObstacleFieldParameter() : ver_x_p(0.9), ver_y_p(0.9) {}
@@ -51,6 +59,13 @@ private:
     double around_y;
   };
 
+  static double obstacle_potential(double rotated_pos_x, double rotated_pos_y,
+                                   double pos_x, double pos_y, double len_x,
+                                   double len_y,
+                                   const ObstacleFieldParameter &param);
+  bool cell_range(const std::vector<double> &centers, double min, double max,
+                  int *begin, int *end) const;
+
   void obj_callback(lidar_tracker::DetectedObjectArray::ConstPtr obj_msg);
   void target_waypoint_callback(
       visualization_msgs::Marker::ConstPtr target_point_msgs);
@@ -92,6 +107,16 @@ PotentialField::PotentialField()
     map_y_size_ = 25.0;
     ROS_INFO("map y size %f", map_y_size_);
   }
+  // obstacle contributions below this value are not added, 0 = whole map
+  if (!private_nh.getParam("obstacle_kernel_cutoff", obstacle_kernel_cutoff_)) {
+    obstacle_kernel_cutoff_ = 1e-3;
+    ROS_INFO("obstacle kernel cutoff %f", obstacle_kernel_cutoff_);
+  }
+  // vscan_points_field is multiplied by this on every scan, 0 = clear
+  if (!private_nh.getParam("vscan_decay", vscan_decay_)) {
+    vscan_decay_ = 0.0;
+    ROS_INFO("vscan decay %f", vscan_decay_);
+  }
 
   publisher_ =
       nh_.advertise<grid_map_msgs::GridMap>("/potential_field", 1, true);
@@ -119,6 +144,19 @@ void PotentialField::init() {
     map_.at("target_waypoint_field", *it) = 0.0;
     map_.at("vscan_points_field", *it) = 0.0;
   }
+  cell_x_.resize(map_.getSize()(0));
+  for (int i = 0; i < (int)cell_x_.size(); ++i) {
+    Position position;
+    map_.getPosition(Index(i, 0), position);
+    cell_x_[i] = position.x();
+  }
+  cell_y_.resize(map_.getSize()(1));
+  for (int j = 0; j < (int)cell_y_.size(); ++j) {
+    Position position;
+    map_.getPosition(Index(0, j), position);
+    cell_y_[j] = position.y();
+  }
+  vscan_cells_.clear();
   ROS_INFO("Created map with size %f x %f m (%i x %i cells).",
            map_.getLength().x(), map_.getLength().y(), map_.getSize()(0),
            map_.getSize()(1));
@@ -136,95 +174,171 @@ void PotentialField::publish_potential_field() {
   ROS_INFO_THROTTLE(1.0, "Grid map (timestamp %f) published.",
                     message.info.header.stamp.toSec());
 }
+// Potential of one obstacle box at a position rotated into the box frame
+double PotentialField::obstacle_potential(double rotated_pos_x,
+                                          double rotated_pos_y, double pos_x,
+                                          double pos_y, double len_x,
+                                          double len_y,
+                                          const ObstacleFieldParameter &param) {
+  double ver_x_p(param.ver_x_p);
+  double ver_y_p(param.ver_y_p);
+
+  if (pos_x - len_x < rotated_pos_x && rotated_pos_x < pos_x + len_x) {
+    if (pos_y - len_y < rotated_pos_y && rotated_pos_y < pos_y + len_y) {
+      return std::exp(0.0);
+    } else if (rotated_pos_y < pos_y - len_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))));
+    } else if (pos_y + len_y < rotated_pos_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))));
+    }
+  } else if (rotated_pos_x < pos_x - len_x) {
+    if (rotated_pos_y < pos_y - len_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))) +
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    } else if (pos_y + len_y < rotated_pos_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))) +
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    } else if (pos_y - len_y < rotated_pos_y &&
+               rotated_pos_y < pos_y + len_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    }
+  } else if (pos_x + len_x < rotated_pos_x) {
+    if (rotated_pos_y < pos_y - len_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))) +
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    } else if (pos_y + len_y / 2.0 < rotated_pos_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
+                   std::pow(2.0 * ver_y_p, 2.0))) +
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    } else if (pos_y - len_y < rotated_pos_y &&
+               rotated_pos_y < pos_y + len_y) {
+      return std::exp(
+          (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
+                   std::pow(2.0 * ver_x_p, 2.0))));
+    }
+  }
+  return 0.0;
+}
+
+// Index range of the cells whose centers may lie in (min, max). grid_map
+// indices grow as the coordinate decreases.
+bool PotentialField::cell_range(const std::vector<double> &centers, double min,
+                                double max, int *begin, int *end) const {
+  if (!(min < max))
+    return false;
+  double resolution = map_.getResolution();
+  double last = centers.size() - 1;
+  double first_cell = std::max(0.0, std::floor((centers[0] - max) / resolution));
+  double last_cell = std::min(last, std::ceil((centers[0] - min) / resolution));
+  if (first_cell > last_cell)
+    return false;
+  *begin = (int)first_cell;
+  *end = (int)last_cell;
+  return true;
+}
+
 void PotentialField::obj_callback(
     lidar_tracker::DetectedObjectArray::ConstPtr
         obj_msg) { // Create grid map.
   static ObstacleFieldParameter param;
-  double ver_x_p(param.ver_x_p);
-  double ver_y_p(param.ver_y_p);
 
   // Add data to grid map.
   ros::Time time = ros::Time::now();
 
-  for (GridMapIterator it(map_); !it.isPastEnd(); ++it) {
+  // The potential falls off as exp(-d^2 / (2 ver_p)^2) outside the box, so
+  // each object only touches the cells within the cutoff radius.
+  bool bounded = obstacle_kernel_cutoff_ > 0.0 && obstacle_kernel_cutoff_ < 1.0;
+  double radius_x = 0.0;
+  double radius_y = 0.0;
+  if (bounded) {
+    radius_x = 2.0 * param.ver_x_p * std::sqrt(-std::log(obstacle_kernel_cutoff_));
+    radius_y = 2.0 * param.ver_y_p * std::sqrt(-std::log(obstacle_kernel_cutoff_));
+  }
 
-    Position position;
-    map_.getPosition(*it, position);
-    map_.at("obstacle_field", *it) = 0.0;
-    for (int i(0); i < (int)obj_msg->objects.size(); ++i) {
-      double pos_x = obj_msg->objects.at(i).pose.position.x + tf_x_;
-      double pos_y = obj_msg->objects.at(i).pose.position.y;
-      double len_x = obj_msg->objects.at(i).dimensions.x / 2.0;
-      double len_y = obj_msg->objects.at(i).dimensions.y / 2.0;
-
-      double r, p, y;
-      tf::Quaternion quat(obj_msg->objects.at(i).pose.orientation.x,
-                          obj_msg->objects.at(i).pose.orientation.y,
-                          obj_msg->objects.at(i).pose.orientation.z,
-                          obj_msg->objects.at(i).pose.orientation.w);
-      tf::Matrix3x3(quat).getRPY(r, p, y);
-
-      double rotated_pos_x = std::cos(-1.0 * y) * (position.x() - pos_x) -
-                             std::sin(-1.0 * y) * (position.y() - pos_y) +
-                             pos_x;
-      double rotated_pos_y = std::sin(-1.0 * y) * (position.x() - pos_x) +
-                             std::cos(-1.0 * y) * (position.y() - pos_y) +
-                             pos_y;
-
-      if (-0.5 < pos_x && pos_x < 4.0) {
-        if (-1.0 < pos_y && pos_y < 1.0)
-          continue;
-      }
-      if (pos_x - len_x < rotated_pos_x && rotated_pos_x < pos_x + len_x) {
-        if (pos_y - len_y < rotated_pos_y && rotated_pos_y < pos_y + len_y) {
-          map_.at("obstacle_field", *it) += std::exp(0.0);
-        } else if (rotated_pos_y < pos_y - len_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))));
-        } else if (pos_y + len_y < rotated_pos_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))));
-        }
-      } else if (rotated_pos_x < pos_x - len_x) {
-        if (rotated_pos_y < pos_y - len_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))) +
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        } else if (pos_y + len_y < rotated_pos_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))) +
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        } else if (pos_y - len_y < rotated_pos_y &&
-                   rotated_pos_y < pos_y + len_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x - len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        }
-      } else if (pos_x + len_x < rotated_pos_x) {
-        if (rotated_pos_y < pos_y - len_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y - len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))) +
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        } else if (pos_y + len_y / 2.0 < rotated_pos_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_y - (pos_y + len_y)), 2.0) /
-                       std::pow(2.0 * ver_y_p, 2.0))) +
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        } else if (pos_y - len_y < rotated_pos_y &&
-                   rotated_pos_y < pos_y + len_y) {
-          map_.at("obstacle_field", *it) += std::exp(
-              (-1.0 * (std::pow((rotated_pos_x - (pos_x + len_x)), 2.0) /
-                       std::pow(2.0 * ver_x_p, 2.0))));
-        }
+  struct Splat {
+    double pos_x, pos_y, len_x, len_y;
+    double cos_y, sin_y;
+    int row_begin, row_end, col_begin, col_end;
+  };
+  std::vector<Splat> splats;
+  for (int i(0); i < (int)obj_msg->objects.size(); ++i) {
+    Splat splat;
+    splat.pos_x = obj_msg->objects.at(i).pose.position.x + tf_x_;
+    splat.pos_y = obj_msg->objects.at(i).pose.position.y;
+    splat.len_x = obj_msg->objects.at(i).dimensions.x / 2.0;
+    splat.len_y = obj_msg->objects.at(i).dimensions.y / 2.0;
+
+    if (-0.5 < splat.pos_x && splat.pos_x < 4.0) {
+      if (-1.0 < splat.pos_y && splat.pos_y < 1.0)
+        continue;
+    }
+
+    double r, p, y;
+    tf::Quaternion quat(obj_msg->objects.at(i).pose.orientation.x,
+                        obj_msg->objects.at(i).pose.orientation.y,
+                        obj_msg->objects.at(i).pose.orientation.z,
+                        obj_msg->objects.at(i).pose.orientation.w);
+    tf::Matrix3x3(quat).getRPY(r, p, y);
+    splat.cos_y = std::cos(-1.0 * y);
+    splat.sin_y = std::sin(-1.0 * y);
+
+    if (!bounded) {
+      splat.row_begin = 0;
+      splat.row_end = (int)cell_x_.size() - 1;
+      splat.col_begin = 0;
+      splat.col_end = (int)cell_y_.size() - 1;
+      splats.push_back(splat);
+      continue;
+    }
+
+    // bounding box of the box grown by the radius, in the map frame
+    double extent_x = splat.len_x + radius_x;
+    double extent_y = splat.len_y + radius_y;
+    double half_x = std::fabs(splat.cos_y) * extent_x + std::fabs(splat.sin_y) * extent_y;
+    double half_y = std::fabs(splat.sin_y) * extent_x + std::fabs(splat.cos_y) * extent_y;
+    if (!cell_range(cell_x_, splat.pos_x - half_x, splat.pos_x + half_x,
+                    &splat.row_begin, &splat.row_end) ||
+        !cell_range(cell_y_, splat.pos_y - half_y, splat.pos_y + half_y,
+                    &splat.col_begin, &splat.col_end))
+      continue;
+    splats.push_back(splat);
+  }
+
+  grid_map::Matrix &field = map_["obstacle_field"];
+  field.setZero();
+
+  // rows are independent, objects are summed in message order per cell
+#pragma omp parallel for schedule(dynamic)
+  for (int row = 0; row < (int)cell_x_.size(); ++row) {
+    for (size_t k = 0; k < splats.size(); ++k) {
+      const Splat &splat = splats[k];
+      if (row < splat.row_begin || splat.row_end < row)
+        continue;
+      double dx = cell_x_[row] - splat.pos_x;
+      for (int col = splat.col_begin; col <= splat.col_end; ++col) {
+        double dy = cell_y_[col] - splat.pos_y;
+        double rotated_pos_x = splat.cos_y * dx - splat.sin_y * dy + splat.pos_x;
+        double rotated_pos_y = splat.sin_y * dx + splat.cos_y * dy + splat.pos_y;
+        field(row, col) += obstacle_potential(rotated_pos_x, rotated_pos_y,
+                                              splat.pos_x, splat.pos_y,
+                                              splat.len_x, splat.len_y, param);
       }
     }
   }
@@ -274,28 +388,44 @@ void PotentialField::vscan_points_callback(
   ros::Time time = ros::Time::now();
   pcl::PointCloud<pcl::PointXYZ> pcl_vscan;
   pcl::fromROSMsg(*vscan_msg, pcl_vscan);
-  pcl::PointCloud<pcl::PointXYZ>::Ptr pcl_vscan_ptr(
-      new pcl::PointCloud<pcl::PointXYZ>(pcl_vscan));
 
-  double length_x = map_.getLength().x() / 2.0;
-  double length_y = map_.getLength().y() / 2.0;
+  grid_map::Matrix &field = map_["vscan_points_field"];
 
-  for (GridMapIterator it(map_); !it.isPastEnd(); ++it) {
-    Position position;
-    map_.getPosition(*it, position);
-    map_.at("vscan_points_field", *it) = 0.0;
-    for (int i(0); i < (int)pcl_vscan.size(); ++i) {
-      if (3.0 < pcl_vscan.at(i).z + tf_z_ || pcl_vscan.at(i).z + tf_z_ < 0.3)
-        continue;
-      if (length_x < pcl_vscan.at(i).x && pcl_vscan.at(i).x < -1.0 * length_x)
-        continue;
-      if (length_y < pcl_vscan.at(i).y && pcl_vscan.at(i).y < -1.0 * length_y)
+  // decay the cells of the previous scans instead of clearing the layer
+  size_t kept = 0;
+  for (size_t k = 0; k < vscan_cells_.size(); ++k) {
+    float &value = field(vscan_cells_[k](0), vscan_cells_[k](1));
+    value *= vscan_decay_;
+    if (value < 1e-3)
+      value = 0.0;
+    else
+      vscan_cells_[kept++] = vscan_cells_[k];
+  }
+  vscan_cells_.resize(kept);
+
+  // mark the cells around each point
+  for (int i(0); i < (int)pcl_vscan.size(); ++i) {
+    const pcl::PointXYZ &point = pcl_vscan.at(i);
+    if (3.0 < point.z + tf_z_ || point.z + tf_z_ < 0.3)
+      continue;
+
+    int row_begin, row_end, col_begin, col_end;
+    if (!cell_range(cell_x_, point.x + tf_x_ - around_x,
+                    point.x + tf_x_ + around_x, &row_begin, &row_end) ||
+        !cell_range(cell_y_, point.y - around_y, point.y + around_y,
+                    &col_begin, &col_end))
+      continue;
+
+    for (int row = row_begin; row <= row_end; ++row) {
+      if (!(point.x + tf_x_ - around_x < cell_x_[row] &&
+            cell_x_[row] < point.x + tf_x_ + around_x))
         continue;
-      if (pcl_vscan.at(i).x + tf_x_ - around_x < position.x() &&
-          position.x() < pcl_vscan.at(i).x + tf_x_ + around_x) {
-        if (pcl_vscan.at(i).y - around_y < position.y() &&
-            position.y() < pcl_vscan.at(i).y + around_y) {
-          map_.at("vscan_points_field", *it) = 1.0; // std::exp(0.0) ;
+      for (int col = col_begin; col <= col_end; ++col) {
+        if (point.y - around_y < cell_y_[col] &&
+            cell_y_[col] < point.y + around_y) {
+          if (field(row, col) == 0.0)
+            vscan_cells_.push_back(Index(row, col));
+          field(row, col) = 1.0; // std::exp(0.0) ;
         }
       }
     }
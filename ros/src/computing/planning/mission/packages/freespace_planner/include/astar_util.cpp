@@ -23,3 +23,53 @@ SimpleNode::SimpleNode(int x, int y, int theta, double gc, double hc)
   , cost(gc + hc)
 {
 }
+
+OpenList::OpenList()
+  : bucket_width_(0.1)
+  , current_(0)
+  , size_(0)
+{
+}
+
+void OpenList::setBucketWidth(double width)
+{
+  bucket_width_ = std::max(width, 1e-3);
+}
+
+void OpenList::push(const SimpleNode &sn)
+{
+  // Costs too large for the bucket range share the last bucket
+  static const size_t max_bucket = 1 << 22;
+  size_t bucket = sn.cost > 0 ? std::min(static_cast<size_t>(sn.cost / bucket_width_), max_bucket) : 0;
+
+  // An inconsistent heuristic can give a cost below the current bucket
+  if (bucket < current_)
+    bucket = current_;
+
+  if (bucket >= buckets_.size())
+    buckets_.resize(bucket + 1);
+
+  buckets_[bucket].push_back(sn);
+  size_++;
+}
+
+SimpleNode OpenList::pop()
+{
+  while (buckets_[current_].empty())
+    current_++;
+
+  SimpleNode sn = buckets_[current_].back();
+  buckets_[current_].pop_back();
+  size_--;
+
+  return sn;
+}
+
+void OpenList::clear()
+{
+  for (size_t i = current_; i < buckets_.size(); i++)
+    buckets_[i].clear();
+
+  current_ = 0;
+  size_ = 0;
+}
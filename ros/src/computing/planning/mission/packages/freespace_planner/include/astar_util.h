@@ -2,6 +2,8 @@
 #define ASTAR_UTIL_H
 
 #include <tf/transform_listener.h>
+#include <vector>
+#include <algorithm>
 
 enum class STATUS : uint8_t
 {
@@ -19,6 +21,7 @@ struct AstarNode
   double hc         = 0;             // heuristic cost
   bool back;                         // true if the current direction of the vehicle is back
   uint8_t steering;                  // steering action of this node
+  uint32_t generation = 0;           // search in which this node was last touched
   AstarNode *parent = NULL;          // parent node
 };
 
@@ -59,6 +62,32 @@ struct SimpleNode
   SimpleNode(int x, int y, int theta, double gc, double hc);
 };
 
+// Bucket (Dial) queue for the open list
+// Nodes are binned by cost into buckets of a fixed width and popped from the
+// lowest non-empty bucket, so push and pop take constant time. Nodes in the
+// same bucket come out in LIFO order, which keeps the path cost within one
+// bucket width of the optimum.
+class OpenList
+{
+ public:
+  OpenList();
+
+  void setBucketWidth(double width);
+  bool empty() const
+  {
+    return size_ == 0;
+  }
+  void push(const SimpleNode &sn);
+  SimpleNode pop();
+  void clear();  // keeps the bucket storage for the next search
+
+ private:
+  double bucket_width_;
+  size_t current_;  // no node is stored below this bucket
+  size_t size_;
+  std::vector<std::vector<SimpleNode>> buckets_;
+};
+
 
 namespace astar
 {
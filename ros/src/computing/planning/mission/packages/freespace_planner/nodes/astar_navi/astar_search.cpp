@@ -2,6 +2,10 @@
 
 AstarSearch::AstarSearch()
   : node_initialized_(false)
+  , generation_(0)
+  , wavefront_valid_(false)
+  , wavefront_goal_x_(-1)
+  , wavefront_goal_y_(-1)
 {
   ros::NodeHandle private_nh_("~");
   private_nh_.param<bool>("use_2dnav_goal", use_2dnav_goal_, true);
@@ -19,7 +23,10 @@ AstarSearch::AstarSearch()
   private_nh_.param<double>("reverse_weight", reverse_weight_, 2.00);
   private_nh_.param<bool>("use_wavefront_heuristic", use_wavefront_heuristic_, true);
   private_nh_.param<double>("reverse_weight", reverse_weight_, 2.00);
+  private_nh_.param<double>("bucket_width", bucket_width_, 0.1);
+  private_nh_.param<bool>("reuse_wavefront", reuse_wavefront_, false);
 
+  openlist_.setBucketWidth(bucket_width_);
   createStateUpdateTable(angle_size_);
 }
 
@@ -29,14 +36,27 @@ AstarSearch::~AstarSearch()
 
 void AstarSearch::resizeNode(int width, int height, int angle_size)
 {
-  nodes_.resize(height);
+  nodes_.assign(static_cast<size_t>(width) * height * angle_size, AstarNode());
+  obstacles_.assign(width * height, 0);
+  wavefront_hc_.assign(width * height, 0);
+  generation_ = 0;
+  wavefront_valid_ = false;
+}
 
-  for (int i = 0; i < height; i++)
-    nodes_[i].resize(width);
+AstarNode *AstarSearch::getNode(int index_x, int index_y, int index_theta)
+{
+  AstarNode *node = &nodes_[static_cast<size_t>(getCellIndex(index_x, index_y)) * angle_size_ + index_theta];
+
+  // First access in this search
+  if (node->generation != generation_) {
+    node->generation = generation_;
+    node->status     = STATUS::NONE;
+    node->gc         = 0;
+    node->hc         = 0;
+    node->parent     = NULL;
+  }
 
-  for (int i = 0; i < height; i++)
-    for (int j = 0; j < width; j++)
-      nodes_[i][j].resize(angle_size);
+  return node;
 }
 
 void AstarSearch::poseToIndex(const geometry_msgs::Pose &pose, int *index_x, int *index_y, int *index_theta)
@@ -172,7 +192,7 @@ void AstarSearch::setPath(const SimpleNode &goal)
   path_.header = header;
 
   // From the goal node to the start node
-  AstarNode *node = &nodes_[goal.index_y][goal.index_x][goal.index_theta];
+  AstarNode *node = getNode(goal.index_x, goal.index_y, goal.index_theta);
 
   while (node != NULL) {
     // Set tf pose
@@ -257,7 +277,7 @@ bool AstarSearch::detectCollision(const SimpleNode &sn)
 
       if (isOutOfRange(index_x, index_y))
         return true;
-      if (nodes_[index_y][index_x][0].status == STATUS::OBS)
+      if (obstacles_[getCellIndex(index_x, index_y)])
         return true;
     }
   }
@@ -269,7 +289,7 @@ bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
 {
   // Set start point for wavefront search
   // This is goal for Astar search
-  nodes_[sn.index_y][sn.index_x][0].hc = 0;
+  std::fill(wavefront_hc_.begin(), wavefront_hc_.end(), 0);
   WaveFrontNode wf_node(sn.index_x, sn.index_y, 1e-10);
   std::queue<WaveFrontNode> qu;
   qu.push(wf_node);
@@ -309,8 +329,8 @@ bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
 
       // out of range OR already visited OR obstacle node
       if (isOutOfRange(next.index_x, next.index_y) ||
-          nodes_[next.index_y][next.index_x][0].hc > 0 ||
-          nodes_[next.index_y][next.index_x][0].status == STATUS::OBS)
+          wavefront_hc_[getCellIndex(next.index_x, next.index_y)] > 0 ||
+          obstacles_[getCellIndex(next.index_x, next.index_y)])
         continue;
 
       // Take the size of robot into account
@@ -323,7 +343,7 @@ bool AstarSearch::calcWaveFrontHeuristic(const SimpleNode &sn)
 
       // Set wavefront heuristic cost
       next.hc = ref.hc + u.hc;
-      nodes_[next.index_y][next.index_x][0].hc = next.hc;
+      wavefront_hc_[getCellIndex(next.index_x, next.index_y)] = next.hc;
 
       qu.push(next);
     }
@@ -349,7 +369,7 @@ bool AstarSearch::detectCollisionWaveFront(const WaveFrontNode &ref)
       if (isOutOfRange(index_x, index_y))
         return true;
 
-      if (nodes_[index_y][index_x][0].status == STATUS::OBS)
+      if (obstacles_[getCellIndex(index_x, index_y)])
         return true;
     }
   }
@@ -363,8 +383,7 @@ void AstarSearch::reset()
   path_.poses.clear();
 
   // Clear queue
-  std::priority_queue<SimpleNode, std::vector<SimpleNode>, std::greater<SimpleNode>> empty;
-  std::swap(openlist_, empty);
+  openlist_.clear();
 }
 
 void AstarSearch::setMap(const nav_msgs::OccupancyGrid &map)
@@ -391,32 +410,25 @@ void AstarSearch::setMap(const nav_msgs::OccupancyGrid &map)
   tf::poseMsgToTF(ogm_in_map, map2ogm_);
 
   // Initialize node according to map size
-  if (!node_initialized_) {
+  size_t map_size = static_cast<size_t>(map.info.width) * map.info.height;
+  if (!node_initialized_ || obstacles_.size() != map_size) {
     resizeNode(map.info.width, map.info.height, angle_size_);
     node_initialized_ = true;
   }
 
-  for (size_t i = 0; i < map.info.height; i++) {
-    for (size_t j = 0; j < map.info.width; j++) {
-      // Index of subscribing OccupancyGrid message
-      size_t og_index = i * map.info.width + j;
-      int cost = map.data[og_index];
+  // Start a new search, the nodes of the previous one are reset on first access
+  generation_++;
 
-      // more than threshold or unknown area
-      if (cost > obstacle_threshold_/* || cost < 0 */) {
-        nodes_[i][j][0].status = STATUS::OBS;
-      }
-      else
-      {
-        for (int k = 0; k < angle_size_; k++) {
-          //nodes_[i][j][k].gc     = 0;
-          nodes_[i][j][k].hc     = 0;
-          nodes_[i][j][k].status = STATUS::NONE;
-          nodes_[i][j][k].parent = NULL;
-        }
-      }
+  for (size_t i = 0; i < map_size; i++) {
+    // more than threshold or unknown area
+    obstacles_[i] = map.data[i] > obstacle_threshold_/* || cost < 0 */;
+  }
 
-    }
+  // The wavefront heuristic only depends on the map and the goal
+  if (!reuse_wavefront_ || map.data != wavefront_map_) {
+    wavefront_valid_ = false;
+    if (reuse_wavefront_)
+      wavefront_map_ = map.data;
   }
 
 }
@@ -435,18 +447,18 @@ bool AstarSearch::setStartNode()
     return false;
 
   // Set start node
-  AstarNode &start_node = nodes_[index_y][index_x][index_theta];
-  start_node.x      = start_pose_local_.pose.position.x;
-  start_node.y      = start_pose_local_.pose.position.y;
-  start_node.theta  = 2.0 * M_PI / angle_size_ * index_theta;
-  start_node.gc     = 0;
-  start_node.back   = false;
-  start_node.status = STATUS::OPEN;
+  AstarNode *start_node = getNode(index_x, index_y, index_theta);
+  start_node->x      = start_pose_local_.pose.position.x;
+  start_node->y      = start_pose_local_.pose.position.y;
+  start_node->theta  = 2.0 * M_PI / angle_size_ * index_theta;
+  start_node->gc     = 0;
+  start_node->back   = false;
+  start_node->status = STATUS::OPEN;
   if (!use_wavefront_heuristic_)
-    start_node.hc = astar::calcDistance(start_pose_local_.pose.position.x, start_pose_local_.pose.position.y, goal_pose_local_.pose.position.x, goal_pose_local_.pose.position.y);
+    start_node->hc = astar::calcDistance(start_pose_local_.pose.position.x, start_pose_local_.pose.position.y, goal_pose_local_.pose.position.x, goal_pose_local_.pose.position.y);
 
   // Push start node to openlist
-  start_sn.cost = start_node.gc + start_node.hc;
+  start_sn.cost = start_node->gc + start_node->hc;
   openlist_.push(start_sn);
   return true;
 }
@@ -467,7 +479,21 @@ bool AstarSearch::setGoalNode()
 
   // Calculate wavefront heuristic cost
   if (use_wavefront_heuristic_) {
-    bool wavefront_result = calcWaveFrontHeuristic(goal_sn);
+    bool wavefront_result;
+    if (wavefront_valid_ && index_x == wavefront_goal_x_ && index_y == wavefront_goal_y_) {
+      // Only the start moved, the start is reachable if the wavefront got there
+      int start_index_x;
+      int start_index_y;
+      int start_index_theta;
+      poseToIndex(start_pose_local_.pose, &start_index_x, &start_index_y, &start_index_theta);
+      wavefront_result = wavefront_hc_[getCellIndex(start_index_x, start_index_y)] > 0;
+    } else {
+      wavefront_result  = calcWaveFrontHeuristic(goal_sn);
+      wavefront_valid_  = reuse_wavefront_;
+      wavefront_goal_x_ = index_x;
+      wavefront_goal_y_ = index_y;
+    }
+
     if (!wavefront_result) {
       ROS_WARN("Goal is not reachable...");
       return false;
@@ -493,13 +519,11 @@ bool AstarSearch::search()
     }
 
     // Pop minimum cost node from openlist
-    SimpleNode sn;
-    sn = openlist_.top();
-    openlist_.pop();
-    nodes_[sn.index_y][sn.index_x][sn.index_theta].status = STATUS::CLOSED;
+    SimpleNode sn = openlist_.pop();
 
     // Expand nodes from this node
-    AstarNode *current_node = &nodes_[sn.index_y][sn.index_x][sn.index_theta];
+    AstarNode *current_node = getNode(sn.index_x, sn.index_y, sn.index_theta);
+    current_node->status = STATUS::CLOSED;
 
     // for each update
     for (const auto &state : state_update_table_[sn.index_theta]) {
@@ -539,8 +563,8 @@ bool AstarSearch::search()
       if (isOutOfRange(next.index_x, next.index_y) || detectCollision(next))
         continue;
 
-      AstarNode *next_node = &nodes_[next.index_y][next.index_x][next.index_theta];
-      double next_hc       =  nodes_[next.index_y][next.index_x][0].hc;
+      AstarNode *next_node = getNode(next.index_x, next.index_y, next.index_theta);
+      double next_hc       = wavefront_hc_[getCellIndex(next.index_x, next.index_y)];
 
       // Calculate euclid distance heuristic cost
       if (!use_wavefront_heuristic_)
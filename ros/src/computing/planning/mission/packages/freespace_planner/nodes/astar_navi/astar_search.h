@@ -14,6 +14,7 @@
 #include <iostream>
 #include <vector>
 #include <queue>
+#include <cstdint>
 #include <string>
 #include <chrono>
 
@@ -36,6 +37,11 @@ class AstarSearch
  private:
   bool search();
   void resizeNode(int width, int height, int angle_size);
+  AstarNode *getNode(int index_x, int index_y, int index_theta);
+  int getCellIndex(int index_x, int index_y) const
+  {
+    return index_y * static_cast<int>(map_info_.width) + index_x;
+  }
   void createStateUpdateTable(int angle_size);
   void createStateUpdateTableLocal(int angle_size); //
   void poseToIndex(const geometry_msgs::Pose &pose, int *index_x, int *index_y, int *index_theta);
@@ -64,12 +70,30 @@ class AstarSearch
   double reverse_weight_;
   bool use_wavefront_heuristic_;
   bool use_2dnav_goal_;
+  double bucket_width_;           // cost range of one open list bucket
+  bool reuse_wavefront_;          // keep the wavefront heuristic while the map and goal do not change
 
   bool node_initialized_;
   std::vector<std::vector<NodeUpdate>> state_update_table_;
   nav_msgs::MapMetaData map_info_;
-  std::vector<std::vector<std::vector<AstarNode>>> nodes_;
-  std::priority_queue<SimpleNode, std::vector<SimpleNode>, std::greater<SimpleNode>> openlist_;
+
+  // Flat node arena, indexed by (index_y * width + index_x) * angle_size + index_theta.
+  // A node whose generation differs from generation_ has not been touched by the
+  // current search and is reset when first accessed, so nothing is cleared per plan.
+  std::vector<AstarNode> nodes_;
+  uint32_t generation_;
+
+  // Per cell of the map
+  std::vector<uint8_t> obstacles_;
+  std::vector<double> wavefront_hc_;
+
+  // What the current wavefront heuristic was computed for
+  bool wavefront_valid_;
+  int wavefront_goal_x_;
+  int wavefront_goal_y_;
+  std::vector<int8_t> wavefront_map_;
+
+  OpenList openlist_;
   std::vector<SimpleNode> goallist_;
 
   // Pose in global(/map) frame
@@ -319,3 +319,91 @@ geometry_msgs::Point ObstaclePoints::getObstaclePoint(const EControl &kind) cons
     return point;
   }
 }
+
+PointsGrid::PointsGrid(const pcl::PointCloud<pcl::PointXYZ> &points, double cell_size)
+  : points_(&points), cell_size_(cell_size), min_x_(0), min_y_(0), width_(0), height_(0)
+{
+  constexpr int MAX_CELLS = 1 << 20;
+
+  double max_x = -std::numeric_limits<double>::max();
+  double max_y = -std::numeric_limits<double>::max();
+  min_x_ = std::numeric_limits<double>::max();
+  min_y_ = std::numeric_limits<double>::max();
+  for (const auto &p : points)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y))
+      continue;
+    min_x_ = std::min(min_x_, static_cast<double>(p.x));
+    min_y_ = std::min(min_y_, static_cast<double>(p.y));
+    max_x = std::max(max_x, static_cast<double>(p.x));
+    max_y = std::max(max_y, static_cast<double>(p.y));
+  }
+
+  // no finite points
+  if (min_x_ > max_x)
+    return;
+
+  // a few far points must not blow up the grid, coarsen it instead
+  if (cell_size_ <= 0)
+    cell_size_ = 1.0;
+  while (((max_x - min_x_) / cell_size_ + 1) * ((max_y - min_y_) / cell_size_ + 1) > MAX_CELLS)
+    cell_size_ *= 2;
+
+  width_ = static_cast<int>((max_x - min_x_) / cell_size_) + 1;
+  height_ = static_cast<int>((max_y - min_y_) / cell_size_) + 1;
+
+  // counting sort of the point indices by cell
+  std::vector<int> point_cell(points.size(), -1);
+  cell_start_.assign(width_ * height_ + 1, 0);
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const auto &p = points.points[i];
+    if (!std::isfinite(p.x) || !std::isfinite(p.y))
+      continue;
+    int cx = static_cast<int>((p.x - min_x_) / cell_size_);
+    int cy = static_cast<int>((p.y - min_y_) / cell_size_);
+    point_cell[i] = cy * width_ + cx;
+    cell_start_[point_cell[i] + 1]++;
+  }
+  for (size_t c = 1; c < cell_start_.size(); c++)
+    cell_start_[c] += cell_start_[c - 1];
+
+  indices_.resize(cell_start_.back());
+  std::vector<int> cursor(cell_start_.begin(), cell_start_.end() - 1);
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    if (point_cell[i] >= 0)
+      indices_[cursor[point_cell[i]]++] = i;
+  }
+}
+
+void PointsGrid::findPoints(double x, double y, double min_range, double max_range, std::vector<int> *indices) const
+{
+  indices->clear();
+  if (width_ == 0 || max_range <= 0)
+    return;
+
+  int min_cx = std::max(0, static_cast<int>(std::floor((x - max_range - min_x_) / cell_size_)));
+  int min_cy = std::max(0, static_cast<int>(std::floor((y - max_range - min_y_) / cell_size_)));
+  int max_cx = std::min(width_ - 1, static_cast<int>(std::floor((x + max_range - min_x_) / cell_size_)));
+  int max_cy = std::min(height_ - 1, static_cast<int>(std::floor((y + max_range - min_y_) / cell_size_)));
+
+  double min_range2 = min_range < 0 ? -1 : min_range * min_range;
+  double max_range2 = max_range * max_range;
+  for (int cy = min_cy; cy <= max_cy; cy++)
+  {
+    for (int cx = min_cx; cx <= max_cx; cx++)
+    {
+      int cell = cy * width_ + cx;
+      for (int k = cell_start_[cell]; k < cell_start_[cell + 1]; k++)
+      {
+        const auto &p = points_->points[indices_[k]];
+        double dx = p.x - x;
+        double dy = p.y - y;
+        double d2 = dx * dx + dy * dy;
+        if (d2 > min_range2 && d2 < max_range2)
+          indices->push_back(indices_[k]);
+      }
+    }
+  }
+}
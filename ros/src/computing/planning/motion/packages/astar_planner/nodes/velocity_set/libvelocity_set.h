@@ -4,11 +4,15 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <limits>
+#include <algorithm>
 #include <unordered_map>
 #include <math.h>
 
 #include <ros/ros.h>
 #include <geometry_msgs/Point.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
 #include <vector_map/vector_map.h>
 
 #include "waypoint_follower/libwaypoint_follower.h"
@@ -140,6 +144,30 @@ public:
   }
 };
 
+//////////////////////////////////////
+// 2D grid over the obstacle points
+//////////////////////////////////////
+class PointsGrid
+{
+private:
+  const pcl::PointCloud<pcl::PointXYZ> *points_;
+  double cell_size_;
+  double min_x_;
+  double min_y_;
+  int width_;
+  int height_;
+  // indices_[cell_start_[c] .. cell_start_[c + 1]) are the points in cell c
+  std::vector<int> cell_start_;
+  std::vector<int> indices_;
+
+public:
+  // bin the points once per frame, the cloud must outlive the grid
+  PointsGrid(const pcl::PointCloud<pcl::PointXYZ> &points, double cell_size);
+
+  // indices of the points whose 2D distance from (x, y) is in (min_range, max_range)
+  void findPoints(double x, double y, double min_range, double max_range, std::vector<int> *indices) const;
+};
+
 inline double calcSquareOfLength(const geometry_msgs::Point &p1, const geometry_msgs::Point &p2)
 {
   return (p1.x - p2.x) * (p1.x - p2.x) + (p1.y - p2.y) * (p1.y - p2.y) + (p1.z - p2.z) * (p1.z - p2.z);
@@ -195,32 +195,32 @@ void displayDetectionRange(const waypoint_follower::lane& lane, const CrossWalk&
 }
 
 // obstacle detection for crosswalk
-EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const CrossWalk& crosswalk, const geometry_msgs::PoseStamped& localizer_pose, const int points_threshold, ObstaclePoints* obstacle_points)
+EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const PointsGrid& grid, const CrossWalk& crosswalk, const geometry_msgs::PoseStamped& localizer_pose, const int points_threshold, ObstaclePoints* obstacle_points)
 {
   int crosswalk_id = crosswalk.getDetectionCrossWalkID();
   double search_radius = crosswalk.getDetectionPoints(crosswalk_id).width / 2;
+  std::vector<int> indices;
 
   // Search each calculated points in the crosswalk
   for (const auto &p : crosswalk.getDetectionPoints(crosswalk_id).points)
   {
     geometry_msgs::Point detection_point = calcRelativeCoordinate(p, localizer_pose.pose);
-    tf::Vector3 detection_vector = point2vector(detection_point);
-    detection_vector.setZ(0.0);
+
+    // only the points in the grid cells around the detection point
+    grid.findPoints(detection_point.x, detection_point.y, -1, search_radius, &indices);
+    // the search stops at the threshold, so keep the cloud order for the same stop points
+    std::sort(indices.begin(), indices.end());
 
     int stop_count = 0;  // the number of points in the detection area
-    for (const auto &p : points)
+    for (const auto &index : indices)
     {
-      tf::Vector3 point_vector(p.x, p.y, 0.0);
-      double distance = tf::tfDistance(point_vector, detection_vector);
-      if (distance < search_radius)
-      {
-        stop_count++;
-        geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
-      }
+      const auto &p = points.points[index];
+      stop_count++;
+      geometry_msgs::Point point_temp;
+      point_temp.x = p.x;
+      point_temp.y = p.y;
+      point_temp.z = p.z;
+      obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
       if (stop_count > points_threshold)
         return EControl::STOP;
     }
@@ -231,9 +231,10 @@ EControl crossWalkDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const
   return EControl::KEEP;  // find no obstacles
 }
 
-int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, double stop_range, double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
+int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const PointsGrid& grid, const int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, double stop_range, double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
 {
   int stop_obstacle_waypoint = -1;
+  std::vector<int> indices;
   // start search from the closest waypoint
   for (int i = closest_waypoint; i < closest_waypoint + STOP_SEARCH_DISTANCE; i++)
   {
@@ -245,7 +246,7 @@ int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int c
     if (i == crosswalk.getDetectionWaypoint())
     {
       // found an obstacle in the cross walk
-      if (crossWalkDetection(points, crosswalk, localizer_pose, points_threshold, obstacle_points) == EControl::STOP)
+      if (crossWalkDetection(points, grid, crosswalk, localizer_pose, points_threshold, obstacle_points) == EControl::STOP)
       {
         stop_obstacle_waypoint = i;
         break;
@@ -254,25 +255,20 @@ int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int c
 
     // waypoint seen by localizer
     geometry_msgs::Point waypoint = calcRelativeCoordinate(lane.waypoints[i].pose.pose.position, localizer_pose.pose);
-    tf::Vector3 tf_waypoint = point2vector(waypoint);
-    tf_waypoint.setZ(0);
+
+    // points (obstacle) within stop_range of the waypoint in 2D
+    grid.findPoints(waypoint.x, waypoint.y, -1, stop_range, &indices);
 
     int stop_point_count = 0;
-    for (const auto& p : points)
+    for (const auto& index : indices)
     {
-      tf::Vector3 point_vector(p.x, p.y, 0);
-
-      // 2D distance between waypoint and points (obstacle)
-      double dt = tf::tfDistance(point_vector, tf_waypoint);
-      if (dt < stop_range)
-      {
-        stop_point_count++;
-        geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
-      }
+      const auto& p = points.points[index];
+      stop_point_count++;
+      geometry_msgs::Point point_temp;
+      point_temp.x = p.x;
+      point_temp.y = p.y;
+      point_temp.z = p.z;
+      obstacle_points->setStopPoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
     }
 
     // there is an obstacle if the number of points exceeded the threshold
@@ -290,9 +286,10 @@ int detectStopObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int c
   return stop_obstacle_waypoint;
 }
 
-int detectDecelerateObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const int closest_waypoint, const waypoint_follower::lane& lane, const double stop_range, const double deceleration_range, const double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
+int detectDecelerateObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const PointsGrid& grid, const int closest_waypoint, const waypoint_follower::lane& lane, const double stop_range, const double deceleration_range, const double points_threshold, const geometry_msgs::PoseStamped& localizer_pose, ObstaclePoints* obstacle_points)
 {
   int decelerate_obstacle_waypoint = -1;
+  std::vector<int> indices;
   // start search from the closest waypoint
   for (int i = closest_waypoint; i < closest_waypoint + DECELERATION_SEARCH_DISTANCE; i++)
   {
@@ -302,25 +299,20 @@ int detectDecelerateObstacle(const pcl::PointCloud<pcl::PointXYZ>& points, const
 
     // waypoint seen by localizer
     geometry_msgs::Point waypoint = calcRelativeCoordinate(lane.waypoints[i].pose.pose.position, localizer_pose.pose);
-    tf::Vector3 tf_waypoint = point2vector(waypoint);
-    tf_waypoint.setZ(0);
+
+    // points (obstacle) between stop_range and stop_range + deceleration_range from the waypoint in 2D
+    grid.findPoints(waypoint.x, waypoint.y, stop_range, stop_range + deceleration_range, &indices);
 
     int decelerate_point_count = 0;
-    for (const auto& p : points)
+    for (const auto& index : indices)
     {
-      tf::Vector3 point_vector(p.x, p.y, 0);
-
-      // 2D distance between waypoint and points (obstacle)
-      double dt = tf::tfDistance(point_vector, tf_waypoint);
-      if (dt > stop_range && dt < stop_range + deceleration_range)
-      {
-        decelerate_point_count++;
-        geometry_msgs::Point point_temp;
-        point_temp.x = p.x;
-        point_temp.y = p.y;
-        point_temp.z = p.z;
-	obstacle_points->setDeceleratePoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
-      }
+      const auto& p = points.points[index];
+      decelerate_point_count++;
+      geometry_msgs::Point point_temp;
+      point_temp.x = p.x;
+      point_temp.y = p.y;
+      point_temp.z = p.z;
+      obstacle_points->setDeceleratePoint(calcAbsoluteCoordinate(point_temp, localizer_pose.pose));
     }
 
     // there is an obstacle if the number of points exceeded the threshold
@@ -345,7 +337,10 @@ EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int
   if (points.empty() == true || closest_waypoint < 0)
     return EControl::KEEP;
 
-  int stop_obstacle_waypoint = detectStopObstacle(points, closest_waypoint, lane, crosswalk, vs_info.getStopRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
+  // bin the points in the localizer frame once, each waypoint only visits the cells around it
+  PointsGrid grid(points, vs_info.getStopRange());
+
+  int stop_obstacle_waypoint = detectStopObstacle(points, grid, closest_waypoint, lane, crosswalk, vs_info.getStopRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
 
   // skip searching deceleration range
   if (vs_info.getDecelerationRange() < 0.01)
@@ -354,7 +349,7 @@ EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int
     return stop_obstacle_waypoint < 0 ? EControl::KEEP : EControl::STOP;
   }
 
-  int decelerate_obstacle_waypoint = detectDecelerateObstacle(points, closest_waypoint, lane, vs_info.getStopRange(), vs_info.getDecelerationRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
+  int decelerate_obstacle_waypoint = detectDecelerateObstacle(points, grid, closest_waypoint, lane, vs_info.getStopRange(), vs_info.getDecelerationRange(), vs_info.getPointsThreshold(), vs_info.getLocalizerPose(), obstacle_points);
 
   // stop obstacle was not found
   if (stop_obstacle_waypoint < 0)
@@ -388,7 +383,7 @@ EControl pointsDetection(const pcl::PointCloud<pcl::PointXYZ>& points, const int
 
 }
 
-EControl obstacleDetection(int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo vs_info, const ros::Publisher& detection_range_pub, const ros::Publisher& obstacle_pub, int* obstacle_waypoint)
+EControl obstacleDetection(int closest_waypoint, const waypoint_follower::lane& lane, const CrossWalk& crosswalk, const VelocitySetInfo& vs_info, const ros::Publisher& detection_range_pub, const ros::Publisher& obstacle_pub, int* obstacle_waypoint)
 {
   ObstaclePoints obstacle_points;
   EControl detection_result = pointsDetection(vs_info.getPoints(), closest_waypoint, lane, crosswalk, vs_info, obstacle_waypoint, &obstacle_points);
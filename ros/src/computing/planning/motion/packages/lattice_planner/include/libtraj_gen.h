@@ -39,6 +39,9 @@
 #ifndef TRAJECTORYGENERATOR_H
 #define TRAJECTORYGENERATOR_H
 
+#include <string>
+#include <vector>
+
 // ---------DEFINE MODE---------//
 //#define GEN_PLOT_FILES
 //#define DEBUG_OUTPUT
@@ -181,6 +184,26 @@ union Spline
     double spline_value[6];
 };
 
+// One axis of the spline lookup table
+struct LookupAxis
+{
+    double min;
+    double step;
+    int count;
+};
+
+// Converged spline parameters over a grid of goal states, used to warm start the Newton correction
+// The vehicle starts at the origin heading along x with zero curvature, the goal curvature is zero
+// Entries are stored with sx varying fastest, then sy, theta and v
+struct SplineLookupTable
+{
+    LookupAxis sx;
+    LookupAxis sy;
+    LookupAxis theta;
+    LookupAxis v;
+    std::vector<union Spline> splines;
+};
+
 union Command
 {
     struct
@@ -228,6 +251,25 @@ union State nextState(union State veh, union Spline curvature, double vdes, doub
 // trajectoryGenerator is like a "main function" used to iterate through a series of goal states
 union Spline trajectoryGenerator(double sx, double sy, double theta, double v, double kappa);
 
+// solveTrajectory runs the Newton correction from the given initial parameters until the goal is reached
+union Spline solveTrajectory(union State veh, union State goal, union Spline curvature, int max_iterations);
+
+// generateLookupTable solves every goal of the table grid, warm starting from the previous converged neighbor
+void generateLookupTable(SplineLookupTable *table, int max_iterations);
+
+// saveLookupTable and loadLookupTable store the table as plain text
+bool saveLookupTable(const std::string &path, const SplineLookupTable &table);
+bool loadLookupTable(const std::string &path, SplineLookupTable *table);
+
+// lookupInitParams interpolates the initial guess from the table, falling back to initParams outside of it
+union Spline lookupInitParams(const SplineLookupTable &table, union State veh, union State goal);
+
+// generateLatticeGoals shifts the goal sideways by each offset, for each speed
+std::vector<union State> generateLatticeGoals(union State goal, const std::vector<double> &offsets, const std::vector<double> &speeds);
+
+// generateTrajectoryBatch solves a spline for each goal in parallel, the table is optional
+void generateTrajectoryBatch(union State veh, const std::vector<union State> &goals, const SplineLookupTable *table, int max_iterations, std::vector<union Spline> *splines);
+
 // plotTraj is used by rViz to compute points for line strip, it is a lighter weight version of nextState
 union State genLineStrip(union State veh, union Spline curvature, double vdes, double t);
 
@@ -724,6 +724,315 @@ union State genLineStrip(union State veh, union Spline curvature, double vdes, d
     return veh_next;
 }
 
+// ------------SOLVE TRAJECTORY----------//
+// Iterates the motion model and the parameter correction
+// INPUT: Initial state, goal state, initial guess, maximum number of corrections
+// OUTPUT: Spline parameters, success is FALSE if the goal was not reached
+
+union Spline solveTrajectory(union State veh, union State goal, union Spline curvature, int max_iterations)
+{
+    double dt = step_size;
+    veh.v = goal.v;
+    curvature.success = TRUE;
+
+    for(int iteration = 0; ; iteration++)
+    {
+        double horizon = curvature.s/goal.v;
+        union State veh_next = motionModel(veh, goal, curvature, dt, horizon, 0);
+
+        if(checkConvergence(veh_next, goal)==TRUE)
+        {
+            curvature.success = TRUE;
+            return curvature;
+        }
+
+        if(iteration >= max_iterations)
+        {
+            break;
+        }
+
+        // Escape route for poorly conditioned Jacobian
+        curvature = generateCorrection(veh, veh_next, goal, curvature, dt, horizon);
+        if(curvature.success==FALSE)
+        {
+            return curvature;
+        }
+    }
+
+    curvature.success = FALSE;
+    return curvature;
+}
+
+// ------------LOOKUP TABLE----------//
+// Offline table of converged parameters for warm starting the online solve
+
+static double axisValue(const LookupAxis &axis, int i)
+{
+    return axis.min + axis.step*i;
+}
+
+static union State lookupGoal(const SplineLookupTable &table, int ix, int iy, int itheta, int iv)
+{
+    union State goal;
+    goal.sx = axisValue(table.sx, ix);
+    goal.sy = axisValue(table.sy, iy);
+    goal.theta = axisValue(table.theta, itheta);
+    goal.kappa = 0.0;
+    goal.v = axisValue(table.v, iv);
+    goal.vdes = goal.v;
+    goal.timestamp = 0.0;
+    return goal;
+}
+
+static union State lookupVehicle(double v)
+{
+    union State veh;
+    veh.sx = 0.0;
+    veh.sy = 0.0;
+    veh.theta = 0.0;
+    veh.kappa = 0.0;
+    veh.v = v;
+    veh.vdes = v;
+    veh.timestamp = 0.0;
+    return veh;
+}
+
+void generateLookupTable(SplineLookupTable *table, int max_iterations)
+{
+    const int nx = table->sx.count;
+    const int ny = table->sy.count;
+    const int rows = table->theta.count * table->v.count;
+    table->splines.resize(static_cast<size_t>(nx)*ny*rows);
+
+    // Each (theta, v) slice is independent, within a slice the sweep along sx and sy
+    // starts every solve from the closest goal solved before it
+    #pragma omp parallel for schedule(dynamic)
+    for(int row = 0; row < rows; row++)
+    {
+        int itheta = row % table->theta.count;
+        int iv = row / table->theta.count;
+        union State veh = lookupVehicle(axisValue(table->v, iv));
+        union Spline *slice = &table->splines[static_cast<size_t>(row)*nx*ny];
+
+        for(int iy = 0; iy < ny; iy++)
+        {
+            for(int ix = 0; ix < nx; ix++)
+            {
+                union State goal = lookupGoal(*table, ix, iy, itheta, iv);
+                union Spline guess = initParams(veh, goal);
+
+                if(ix > 0 && slice[iy*nx + ix - 1].success==TRUE)
+                {
+                    guess = slice[iy*nx + ix - 1];
+                }
+                else if(iy > 0 && slice[(iy - 1)*nx + ix].success==TRUE)
+                {
+                    guess = slice[(iy - 1)*nx + ix];
+                }
+
+                union Spline result = solveTrajectory(veh, goal, guess, max_iterations);
+
+                // A bad neighbor can lead the correction astray, retry from the heuristic
+                if(result.success==FALSE)
+                {
+                    result = solveTrajectory(veh, goal, initParams(veh, goal), max_iterations);
+                }
+
+                slice[iy*nx + ix] = result;
+            }
+        }
+    }
+}
+
+bool saveLookupTable(const std::string &path, const SplineLookupTable &table)
+{
+    ofstream file(path.c_str());
+    if(!file)
+    {
+        return false;
+    }
+
+    file.precision(17);
+    const LookupAxis *axes[4] = {&table.sx, &table.sy, &table.theta, &table.v};
+    for(int i = 0; i < 4; i++)
+    {
+        file << axes[i]->min << " " << axes[i]->step << " " << axes[i]->count << "\n";
+    }
+
+    for(size_t i = 0; i < table.splines.size(); i++)
+    {
+        const union Spline &spline = table.splines[i];
+        file << spline.s << " " << spline.kappa_1 << " " << spline.kappa_2 << " " << (spline.success ? 1 : 0) << "\n";
+    }
+
+    return file.good();
+}
+
+bool loadLookupTable(const std::string &path, SplineLookupTable *table)
+{
+    ifstream file(path.c_str());
+    if(!file)
+    {
+        return false;
+    }
+
+    LookupAxis *axes[4] = {&table->sx, &table->sy, &table->theta, &table->v};
+    for(int i = 0; i < 4; i++)
+    {
+        file >> axes[i]->min >> axes[i]->step >> axes[i]->count;
+        // axisPosition divides by the step and needs at least one entry per axis
+        if(!file || axes[i]->count < 1 || !(axes[i]->step > 0.0) || !std::isfinite(axes[i]->min) ||
+           !std::isfinite(axes[i]->step))
+        {
+            return false;
+        }
+    }
+
+    size_t size = static_cast<size_t>(table->sx.count)*table->sy.count*table->theta.count*table->v.count;
+    table->splines.resize(size);
+    for(size_t i = 0; i < size; i++)
+    {
+        union Spline &spline = table->splines[i];
+        int success;
+        file >> spline.s >> spline.kappa_1 >> spline.kappa_2 >> success;
+        spline.kappa_0 = 0.0;
+        spline.kappa_3 = 0.0;
+        spline.success = success != 0;
+    }
+
+    if(!file)
+    {
+        table->splines.clear();
+        return false;
+    }
+
+    return true;
+}
+
+// Position of value on the axis as cell index and weight of the upper neighbor
+static bool axisPosition(const LookupAxis &axis, double value, int *index, double *weight)
+{
+    if(axis.count == 1)
+    {
+        *index = 0;
+        *weight = 0.0;
+        return true;
+    }
+
+    double position = (value - axis.min)/axis.step;
+    if(position < 0.0 || position > axis.count - 1)
+    {
+        return false;
+    }
+
+    *index = min(static_cast<int>(position), axis.count - 2);
+    *weight = position - *index;
+    return true;
+}
+
+union Spline lookupInitParams(const SplineLookupTable &table, union State veh, union State goal)
+{
+    int index[4];
+    double weight[4];
+    const LookupAxis *axes[4] = {&table.sx, &table.sy, &table.theta, &table.v};
+    double values[4] = {goal.sx, goal.sy, goal.theta, goal.v};
+
+    if(table.splines.empty())
+    {
+        return initParams(veh, goal);
+    }
+
+    for(int i = 0; i < 4; i++)
+    {
+        if(!axisPosition(*axes[i], values[i], &index[i], &weight[i]))
+        {
+            return initParams(veh, goal);
+        }
+    }
+
+    // Multilinear interpolation over the converged corners of the surrounding cell
+    double sum = 0.0;
+    double s = 0.0;
+    double kappa_1 = 0.0;
+    double kappa_2 = 0.0;
+    for(int corner = 0; corner < 16; corner++)
+    {
+        size_t entry = 0;
+        double w = 1.0;
+        for(int i = 3; i >= 0; i--)
+        {
+            int upper = (corner >> i) & 1;
+            if(upper && axes[i]->count == 1)
+            {
+                w = 0.0;
+                break;
+            }
+            entry = entry*axes[i]->count + index[i] + upper;
+            w *= upper ? weight[i] : 1.0 - weight[i];
+        }
+
+        if(w <= 0.0 || table.splines[entry].success==FALSE)
+        {
+            continue;
+        }
+
+        sum += w;
+        s += w*table.splines[entry].s;
+        kappa_1 += w*table.splines[entry].kappa_1;
+        kappa_2 += w*table.splines[entry].kappa_2;
+    }
+
+    if(sum < 1e-6)
+    {
+        return initParams(veh, goal);
+    }
+
+    union Spline curvature;
+    curvature.s = s/sum;
+    curvature.kappa_1 = kappa_1/sum;
+    curvature.kappa_2 = kappa_2/sum;
+    curvature.kappa_0 = veh.kappa;
+    curvature.kappa_3 = goal.kappa;
+    curvature.success = TRUE;
+    return curvature;
+}
+
+// ------------BATCH GENERATION----------//
+// Solves a whole lattice of goals at once
+
+std::vector<union State> generateLatticeGoals(union State goal, const std::vector<double> &offsets, const std::vector<double> &speeds)
+{
+    std::vector<union State> goals;
+    goals.reserve(offsets.size()*speeds.size());
+
+    for(size_t i = 0; i < speeds.size(); i++)
+    {
+        for(size_t j = 0; j < offsets.size(); j++)
+        {
+            // Shift along the normal of the goal heading
+            union State lattice_goal = goal;
+            lattice_goal.sx = goal.sx - offsets[j]*sin(goal.theta);
+            lattice_goal.sy = goal.sy + offsets[j]*cos(goal.theta);
+            lattice_goal.v = speeds[i];
+            goals.push_back(lattice_goal);
+        }
+    }
+
+    return goals;
+}
+
+void generateTrajectoryBatch(union State veh, const std::vector<union State> &goals, const SplineLookupTable *table, int max_iterations, std::vector<union Spline> *splines)
+{
+    splines->resize(goals.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < static_cast<int>(goals.size()); i++)
+    {
+        union Spline guess = table ? lookupInitParams(*table, veh, goals[i]) : initParams(veh, goals[i]);
+        (*splines)[i] = solveTrajectory(veh, goals[i], guess, max_iterations);
+    }
+}
+
 //------------------MAIN FUNCTION AND HELPER FOR STANDALONE OPERATION------------------------//
 
 #ifdef STANDALONE
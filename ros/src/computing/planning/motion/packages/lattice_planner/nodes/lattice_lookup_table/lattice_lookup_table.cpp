@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2015, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Offline generation of the spline lookup table used by lattice_trajectory_gen
+ * to warm start its trajectory solves.
+ */
+
+#include <ros/ros.h>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include "libtraj_gen.h"
+
+static LookupAxis getAxis(const ros::NodeHandle &nh, const std::string &name, double min, double max, double step)
+{
+  nh.param<double>(name + "_min", min, min);
+  nh.param<double>(name + "_max", max, max);
+  nh.param<double>(name + "_step", step, step);
+
+  LookupAxis axis;
+  axis.min = min;
+  axis.step = step > 0 ? step : 1.0;
+  axis.count = std::max(1, static_cast<int>((max - min) / axis.step + 1.5));
+  return axis;
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "lattice_lookup_table");
+  ros::NodeHandle private_nh("~");
+
+  std::string output;
+  int max_iterations;
+  private_nh.param<std::string>("output", output, "lattice_lookup_table.txt");
+  private_nh.param<int>("max_iterations", max_iterations, 10);
+
+  // Goal grid in the vehicle frame, defaults cover the lookahead of lattice_trajectory_gen
+  SplineLookupTable table;
+  table.sx = getAxis(private_nh, "sx", 4.0, 40.0, 2.0);
+  table.sy = getAxis(private_nh, "sy", -8.0, 8.0, 1.0);
+  table.theta = getAxis(private_nh, "theta", -0.6, 0.6, 0.1);
+  table.v = getAxis(private_nh, "v", 2.0, 16.0, 2.0);
+
+  ROS_INFO_STREAM("Generating " << table.sx.count * table.sy.count * table.theta.count * table.v.count
+                  << " splines...");
+  generateLookupTable(&table, max_iterations);
+
+  size_t converged = 0;
+  for (const auto &spline : table.splines)
+  {
+    if (spline.success)
+      converged++;
+  }
+  ROS_INFO_STREAM(converged << " of " << table.splines.size() << " splines converged");
+
+  if (!saveLookupTable(output, table))
+  {
+    ROS_ERROR_STREAM("Could not write " << output);
+    return 1;
+  }
+
+  ROS_INFO_STREAM("Saved " << output);
+  return 0;
+}
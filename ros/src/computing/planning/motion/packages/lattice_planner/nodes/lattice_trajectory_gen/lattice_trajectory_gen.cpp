@@ -93,6 +93,10 @@ static double g_mkz_info_curvature;
 
 static int SPLINE_INDEX=0;
 
+// Offline table of spline parameters to warm start the solves, empty if not given
+static SplineLookupTable g_lookup_table;
+static bool g_use_lookup_table = false;
+
 //config topic
 static int g_param_flag = 0; //0 = waypoint, 1 = Dialog
 static double g_lookahead_threshold = 4.0; //meter
@@ -101,6 +105,7 @@ static double g_look_ahead_threshold_calc_ratio = 2.0;
 static double g_minimum_look_ahead_threshold = 6.0; // the next waypoint must be outside of this threshold.
 
 static WayPoints g_current_waypoints;
+static WaypointIndex g_waypoint_index;
 
 static void ConfigCallback(const runtime_manager::ConfigWaypointFollowerConstPtr &config)
 {
@@ -127,6 +132,7 @@ static void currentVelCallback(const geometry_msgs::TwistStampedConstPtr &msg)
 static void WayPointCallback(const waypoint_follower::laneConstPtr &msg)
 {
   g_current_waypoints.setPath(*msg);
+  g_waypoint_index.setPath(*msg);
   g_waypoint_set = true;
   ROS_INFO_STREAM("waypoint subscribed");
 }
@@ -528,12 +534,26 @@ int main(int argc, char **argv)
   ROS_INFO_STREAM("prius_mode : " << g_prius_mode);
   ROS_INFO_STREAM("mkz_mode : " << g_mkz_mode);
 
+  // Load the spline lookup table generated by lattice_lookup_table
+  std::string lookup_table;
+  private_nh.param<std::string>("lookup_table", lookup_table, "");
+  if (!lookup_table.empty())
+  {
+    g_use_lookup_table = loadLookupTable(lookup_table, &g_lookup_table);
+    if (g_use_lookup_table)
+      ROS_INFO_STREAM("Loaded spline lookup table: " << lookup_table << " (" << g_lookup_table.splines.size() << " entries)");
+    else
+      ROS_WARN_STREAM("Could not load spline lookup table: " << lookup_table);
+  }
+
   // Publish the following topics: 
   g_vis_pub = nh.advertise<visualization_msgs::Marker>("next_waypoint_mark", 1);
   g_stat_pub = nh.advertise<std_msgs::Bool>("wf_stat", 0);
   // Publish the curvature information:
   ros::Publisher spline_parameters_pub = nh.advertise<std_msgs::Float64MultiArray>("spline", 10);
   ros::Publisher state_parameters_pub = nh.advertise<std_msgs::Float64MultiArray>("state", 10);
+  // Publish the extra trajectories, one per lateral offset, for a planner to select from
+  ros::Publisher spline_candidates_pub = nh.advertise<std_msgs::Float64MultiArray>("spline_candidates", 10);
   // Publish the trajectory visualization
   g_marker_pub = nh.advertise<visualization_msgs::Marker>("cubic_splines_viz", 10);
 
@@ -564,17 +584,13 @@ int main(int argc, char **argv)
   // Set the loop rate unit is Hz
   ros::Rate loop_rate(LOOP_RATE); 
 
-  // Set up arrays for perturb and flag to enable easy parallelization via OpenMP pragma
-  double perturb[30];
+  // Lateral offsets of the extra trajectories from the waypoint
+  std::vector<double> perturb(30);
   perturb[0]=-3.00;
 
-  int flag[30];
-  flag[0]=1;
-
   for(int i=1; i<30; i++)
   {
     perturb[i] = perturb[i-1] + 0.2;
-    flag[i-1] = flag[i]+1;
   }
   bool initFlag = FALSE;
   union Spline prev_curvature;
@@ -596,7 +612,7 @@ int main(int argc, char **argv)
     }
 
     // Get the closest waypoinmt
-    int closest_waypoint = getClosestWaypoint(g_current_waypoints.getCurrentWaypoints(), g_current_pose.pose);
+    int closest_waypoint = g_waypoint_index.getClosestWaypoint(g_current_pose.pose);
     ROS_INFO_STREAM("closest waypoint = " << closest_waypoint);
 
       // If the current  waypoint has a valid index
@@ -627,7 +643,7 @@ int main(int argc, char **argv)
           }
         
           // Initialize the estimate for the curvature
-          union Spline curvature = initParams(veh, goal);
+          union Spline curvature = g_use_lookup_table ? lookupInitParams(g_lookup_table, veh, goal) : initParams(veh, goal);
 
           // Generate a cubic spline (trajectory) for the vehicle to follow
           curvature = waypointTrajectory(veh, goal, curvature, next_waypoint);
@@ -673,34 +689,43 @@ int main(int argc, char **argv)
                 SPLINE_INDEX++;
                 ROS_INFO_STREAM("Spline published to RVIZ");
               }
-              
-                // This is a messy for loop which generates extra trajectories for visualization
-                // Likely will change when valid cost map arrives.
-                // Note: pragma indicates parallelization for OpenMP
-
-                // Setup variables
-                union State tempGoal= goal;
-                int i;
-                union Spline extra;
-                
-                // Tell OpenMP how to parallelize (keep i private because it is a counter)
-                #pragma omp parallel for private(i)
-
-                // Index through all the predefined perturbations from waypoint
-                for(i=1; i<31; i++)
-                {
-                  // Shift the y-coordinate of the goal
-                  tempGoal.sy = tempGoal.sy + perturb[i-1];
-
-                  // Compute new spline 
-                  extra= waypointTrajectory(veh, tempGoal, curvature, next_waypoint);
-
-                  // Display trajectory
-                  if(veh.v>5.00)
-                  {
-                    drawSpline(extra, veh, i,1);
-                  }
-                }
+          }
+
+          // Extra trajectories, one per lateral offset from the waypoint, solved in parallel (OpenMP)
+          // Only computed when drawn or subscribed to, selecting among them needs a valid cost map
+          bool draw_extra = g_sim_mode && veh.v>5.00;
+          if(draw_extra || spline_candidates_pub.getNumSubscribers() > 0)
+          {
+            std::vector<union State> extra_goals = generateLatticeGoals(goal, perturb, std::vector<double>(1, goal.v));
+            std::vector<union Spline> extra;
+            generateTrajectoryBatch(veh, extra_goals, g_use_lookup_table ? &g_lookup_table : NULL, 4, &extra);
+
+            // Row i holds the spline values (as on the spline topic) of the goal offset by perturb[i]
+            std_msgs::Float64MultiArray candidates;
+            candidates.layout.dim.resize(2);
+            candidates.layout.dim[0].label = "candidate";
+            candidates.layout.dim[0].size = extra.size();
+            candidates.layout.dim[0].stride = extra.size()*6;
+            candidates.layout.dim[1].label = "spline_value";
+            candidates.layout.dim[1].size = 6;
+            candidates.layout.dim[1].stride = 6;
+            for(size_t i=0; i<extra.size(); i++)
+            {
+              for(int j = 0; j < 6; j++)
+              {
+                candidates.data.push_back(extra[i].spline_value[j]);
+              }
+            }
+            spline_candidates_pub.publish(candidates);
+
+            // Display trajectory
+            if(draw_extra)
+            {
+              for(size_t i=0; i<extra.size(); i++)
+              {
+                drawSpline(extra[i], veh, i+1,1);
+              }
+            }
           }
 
           // Update previous time and orientation measurements
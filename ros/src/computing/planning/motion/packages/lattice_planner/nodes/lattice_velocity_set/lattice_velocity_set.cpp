@@ -112,6 +112,7 @@ public:
   }
 };
 PathVset g_path_change;
+WaypointIndex g_waypoint_index;
 
 //===============================
 //       class function
@@ -334,6 +335,7 @@ void baseWaypointCallback(const waypoint_follower::laneConstPtr &msg)
 {
   g_path_dk.setPath(*msg);
   g_path_change.setPath(*msg);
+  g_waypoint_index.setPath(*msg);
   if (g_path_flag == false)
   {
     g_path_flag = true;
@@ -857,7 +859,7 @@ int main(int argc, char **argv)
       continue;
     }
 
-    g_closest_waypoint = getClosestWaypoint(g_path_change.getCurrentWaypoints(), g_control_pose.pose);
+    g_closest_waypoint = g_waypoint_index.getClosestWaypoint(g_control_pose.pose);
 
     std_msgs::Int32 closest_waypoint;
     closest_waypoint.data = g_closest_waypoint;
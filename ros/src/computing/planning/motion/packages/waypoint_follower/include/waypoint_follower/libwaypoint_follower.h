@@ -35,6 +35,10 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cmath>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
 
 // ROS header
 #include <tf/transform_broadcaster.h>
@@ -61,13 +65,44 @@ public:
   geometry_msgs::Quaternion getWaypointOrientation(int waypoint) const;
   geometry_msgs::Pose getWaypointPose(int waypoint) const;
   double getWaypointVelocityMPS(int waypoint) const;
-  waypoint_follower::lane getCurrentWaypoints() const
+  const waypoint_follower::lane &getCurrentWaypoints() const
   {
     return current_waypoints_;
   }
   bool isFront(int waypoint, geometry_msgs::Pose current_pose) const;
 };
 
+// closest waypoint search over a path that is kept between calls
+class WaypointIndex
+{
+private:
+  std::vector<tf::Vector3> positions_;
+  std::vector<tf::Vector3> directions_;  // x axis of each waypoint
+  std::unordered_map<int64_t, std::vector<int>> grid_;  // waypoints binned by search_distance_ cells
+  double search_distance_;
+  int previous_;
+
+  int64_t getCellKey(int x, int y) const
+  {
+    return (static_cast<int64_t>(x) << 32) ^ static_cast<uint32_t>(y);
+  }
+
+public:
+  explicit WaypointIndex(double search_distance = 5.0) : search_distance_(search_distance), previous_(-1)
+  {
+  }
+  void setPath(const waypoint_follower::lane &waypoints);  // rebuild the index, once per received lane
+  bool isEmpty() const
+  {
+    return positions_.empty();
+  }
+  void reset()
+  {
+    previous_ = -1;
+  }
+  int getClosestWaypoint(const geometry_msgs::Pose &current_pose);
+};
+
 // inline function (less than 10 lines )
 inline double kmph2mps(double velocity_kmph)
 {
@@ -171,73 +171,174 @@ double getRelativeAngle(geometry_msgs::Pose waypoint_pose, geometry_msgs::Pose v
   return angle;
 }
 
+namespace
+{
+// closest waypoint in front of the vehicle, and the closest one within search_distance
+// that also faces the same way as the vehicle (relative angle of 90 degrees or less)
+class ClosestWaypointSearch
+{
+private:
+  tf::Vector3 position_;
+  tf::Vector3 forward_;
+  double search_distance_;
+
+public:
+  int candidate;
+  double candidate_distance;
+  int front;
+  double front_distance;
+
+  ClosestWaypointSearch(const geometry_msgs::Pose &current_pose, double search_distance)
+    : search_distance_(search_distance), candidate(-1), candidate_distance(DBL_MAX), front(-1), front_distance(DBL_MAX)
+  {
+    tf::Transform transform;
+    tf::poseMsgToTF(current_pose, transform);
+    position_ = transform.getOrigin();
+    forward_ = transform.getBasis().getColumn(0);
+  }
+
+  double getDistance(const tf::Vector3 &position) const
+  {
+    return std::hypot(position.x() - position_.x(), position.y() - position_.y());
+  }
+
+  // returns the plane distance of the waypoint from the vehicle
+  double check(int index, const tf::Vector3 &position, const tf::Vector3 &direction)
+  {
+    double d = getDistance(position);
+
+    // behind the vehicle
+    if ((position - position_).dot(forward_) < 0)
+      return d;
+
+    if (d < front_distance || (d == front_distance && index < front))
+    {
+      front = index;
+      front_distance = d;
+    }
+
+    if (d > search_distance_ || direction.dot(forward_) < 0)
+      return d;
+
+    if (d < candidate_distance || (d == candidate_distance && index < candidate))
+    {
+      candidate = index;
+      candidate_distance = d;
+    }
+    return d;
+  }
+};
+
+tf::Vector3 getDirection(const geometry_msgs::Quaternion &orientation)
+{
+  tf::Quaternion q;
+  tf::quaternionMsgToTF(orientation, q);
+  return tf::Matrix3x3(q).getColumn(0);
+}
+}  // namespace
+
 // get closest waypoint from current pose
 int getClosestWaypoint(const waypoint_follower::lane &current_path, geometry_msgs::Pose current_pose)
 {
-  WayPoints wp;
-  wp.setPath(current_path);
-
-  if (wp.isEmpty())
+  if (current_path.waypoints.empty())
     return -1;
 
-  // search closest candidate within a certain meter
-  double search_distance = 5.0;
-  std::vector<int> waypoint_candidates;
-  for (int i = 1; i < wp.getSize(); i++)
+  // search closest candidate within a certain meter, in a single pass over the path
+  ClosestWaypointSearch search(current_pose, 5.0);
+  for (int i = 1; i < static_cast<int>(current_path.waypoints.size()); i++)
   {
-    if (getPlaneDistance(wp.getWaypointPosition(i), current_pose.position) > search_distance)
-      continue;
+    const geometry_msgs::Pose &pose = current_path.waypoints[i].pose.pose;
+    tf::Vector3 position;
+    tf::pointMsgToTF(pose.position, position);
+    search.check(i, position, getDirection(pose.orientation));
+  }
 
-    if (!wp.isFront(i, current_pose))
-      continue;
+  if (search.candidate >= 0)
+    return search.candidate;
 
-    double angle_threshold = 90;
-    if (getRelativeAngle(wp.getWaypointPose(i), current_pose) > angle_threshold)
-      continue;
+  ROS_INFO("no candidate. search closest waypoint from all waypoints...");
+  return search.front;
+}
+
+void WaypointIndex::setPath(const waypoint_follower::lane &waypoints)
+{
+  positions_.resize(waypoints.waypoints.size());
+  directions_.resize(waypoints.waypoints.size());
+  grid_.clear();
+  previous_ = -1;
 
-    waypoint_candidates.push_back(i);
+  for (int i = 0; i < static_cast<int>(waypoints.waypoints.size()); i++)
+  {
+    const geometry_msgs::Pose &pose = waypoints.waypoints[i].pose.pose;
+    tf::pointMsgToTF(pose.position, positions_[i]);
+    directions_[i] = getDirection(pose.orientation);
+
+    // waypoint 0 is never returned, as in getClosestWaypoint()
+    if (i == 0)
+      continue;
+    int x = static_cast<int>(std::floor(positions_[i].x() / search_distance_));
+    int y = static_cast<int>(std::floor(positions_[i].y() / search_distance_));
+    grid_[getCellKey(x, y)].push_back(i);
   }
+}
+
+// Same result as getClosestWaypoint() for a cold start. When the previous waypoint is known,
+// only the stretch of path around it that stays within the search distance is visited, so a
+// path passing by again (a loop, the opposite lane) does not steal the match.
+int WaypointIndex::getClosestWaypoint(const geometry_msgs::Pose &current_pose)
+{
+  const int size = positions_.size();
+  if (size == 0)
+    return -1;
+
+  ClosestWaypointSearch search(current_pose, search_distance_);
 
-  // get closest waypoint from candidates
-  if (!waypoint_candidates.empty())
+  // incremental search, walk both ways from the previous closest waypoint
+  if (previous_ > 0 && previous_ < size)
   {
-    int waypoint_min = -1;
-    double distance_min = DBL_MAX;
-    for (auto el : waypoint_candidates)
+    for (int i = previous_; i > 0; i--)
     {
-      // ROS_INFO("closest_candidates : %d",el);
-      double d = getPlaneDistance(wp.getWaypointPosition(el), current_pose.position);
-      if (d < distance_min)
-      {
-        waypoint_min = el;
-        distance_min = d;
-      }
+      if (search.check(i, positions_[i], directions_[i]) > search_distance_)
+        break;
+    }
+    for (int i = previous_ + 1; i < size; i++)
+    {
+      if (search.check(i, positions_[i], directions_[i]) > search_distance_)
+        break;
     }
-    return waypoint_min;
   }
-  else
+
+  // cold start, or the vehicle jumped, look up the cells around the vehicle
+  if (search.candidate < 0)
   {
-    ROS_INFO("no candidate. search closest waypoint from all waypoints...");
-    // if there is no candidate...
-    int waypoint_min = -1;
-    double distance_min = DBL_MAX;
-    for (int i = 1; i < wp.getSize(); i++)
+    int x = static_cast<int>(std::floor(current_pose.position.x / search_distance_));
+    int y = static_cast<int>(std::floor(current_pose.position.y / search_distance_));
+    for (int dx = -1; dx <= 1; dx++)
     {
-      if (!wp.isFront(i, current_pose))
-        continue;
-
-      // if (!wp.isValid(i, current_pose))
-      //  continue;
-
-      double d = getPlaneDistance(wp.getWaypointPosition(i), current_pose.position);
-      if (d < distance_min)
+      for (int dy = -1; dy <= 1; dy++)
       {
-        waypoint_min = i;
-        distance_min = d;
+        auto cell = grid_.find(getCellKey(x + dx, y + dy));
+        if (cell == grid_.end())
+          continue;
+        for (int i : cell->second)
+          search.check(i, positions_[i], directions_[i]);
       }
     }
-    return waypoint_min;
   }
+
+  if (search.candidate >= 0)
+  {
+    previous_ = search.candidate;
+    return previous_;
+  }
+
+  ROS_INFO("no candidate. search closest waypoint from all waypoints...");
+  ClosestWaypointSearch full_search(current_pose, search_distance_);
+  for (int i = 1; i < size; i++)
+    full_search.check(i, positions_[i], directions_[i]);
+
+  previous_ = full_search.front;
+  return previous_;
 }
 
 // let the linear equation be "ax + by + c = 0"
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2016, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _POINTS_MAP_TILE_H_
+#define _POINTS_MAP_TILE_H_
+
+/*
+ * Points map tile (.pmt) format
+ *
+ *   PointsMapTileHeader (80 bytes)
+ *   width * point_step bytes of little-endian float32 points
+ *
+ * Each point holds x, y, z followed by the optional channels selected by
+ * the header's fields mask, in the order of the TILE_FIELD_* bits.  The
+ * payload has exactly the layout of sensor_msgs::PointCloud2::data, so a
+ * tile can be memory-mapped and copied into a message without parsing.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <sensor_msgs/PointCloud2.h>
+
+namespace map_file {
+
+constexpr char TILE_MAGIC[8] = { 'P', 'M', 'T', 'I', 'L', 'E', '\0', '\0' };
+constexpr uint32_t TILE_VERSION = 1;
+constexpr uint32_t TILE_FIELD_INTENSITY = 1 << 0;
+constexpr uint32_t TILE_FIELD_RGB = 1 << 1;
+const std::string TILE_EXTENSION = ".pmt";
+
+struct PointsMapTileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t fields; // TILE_FIELD_* mask
+	uint32_t point_step;
+	uint32_t reserved;
+	uint64_t width;
+	double x_min;
+	double y_min;
+	double z_min;
+	double x_max;
+	double y_max;
+	double z_max;
+};
+
+static_assert(sizeof(PointsMapTileHeader) == 80, "PointsMapTileHeader must be packed");
+
+inline bool is_tile_path(const std::string& path)
+{
+	return (path.size() > TILE_EXTENSION.size() &&
+		path.compare(path.size() - TILE_EXTENSION.size(), TILE_EXTENSION.size(), TILE_EXTENSION) == 0);
+}
+
+inline std::vector<sensor_msgs::PointField> tile_point_fields(uint32_t fields)
+{
+	std::vector<std::string> names = { "x", "y", "z" };
+	if (fields & TILE_FIELD_INTENSITY)
+		names.push_back("intensity");
+	if (fields & TILE_FIELD_RGB)
+		names.push_back("rgb");
+
+	std::vector<sensor_msgs::PointField> ret;
+	for (size_t i = 0; i < names.size(); ++i) {
+		sensor_msgs::PointField f;
+		f.name = names[i];
+		f.offset = i * sizeof(float);
+		f.datatype = sensor_msgs::PointField::FLOAT32;
+		f.count = 1;
+		ret.push_back(f);
+	}
+	return ret;
+}
+
+inline uint32_t tile_point_step(uint32_t fields)
+{
+	return tile_point_fields(fields).size() * sizeof(float);
+}
+
+// Read-only mapping of a tile file; the mapping is released on close() or
+// destruction.
+class MappedTile {
+private:
+	void *addr_;
+	size_t length_;
+
+	MappedTile(const MappedTile&) = delete;
+	MappedTile& operator=(const MappedTile&) = delete;
+
+public:
+	MappedTile() : addr_(MAP_FAILED), length_(0) {}
+	~MappedTile() { close(); }
+
+	bool open(const std::string& path)
+	{
+		close();
+
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(PointsMapTileHeader)) {
+			::close(fd);
+			return false;
+		}
+		length_ = st.st_size;
+		addr_ = mmap(NULL, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (addr_ == MAP_FAILED) {
+			length_ = 0;
+			return false;
+		}
+		madvise(addr_, length_, MADV_SEQUENTIAL);
+
+		const PointsMapTileHeader& h = header();
+		if (std::memcmp(h.magic, TILE_MAGIC, sizeof(h.magic)) != 0 || h.version != TILE_VERSION ||
+		    h.point_step != tile_point_step(h.fields) ||
+		    length_ - sizeof(PointsMapTileHeader) < h.width * h.point_step) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		if (addr_ != MAP_FAILED)
+			munmap(addr_, length_);
+		addr_ = MAP_FAILED;
+		length_ = 0;
+	}
+
+	bool is_open() const { return addr_ != MAP_FAILED; }
+
+	const PointsMapTileHeader& header() const
+	{
+		return *static_cast<const PointsMapTileHeader *>(addr_);
+	}
+
+	const uint8_t *data() const
+	{
+		return static_cast<const uint8_t *>(addr_) + sizeof(PointsMapTileHeader);
+	}
+
+	size_t data_size() const { return header().width * header().point_step; }
+};
+
+// Write pcd as a tile.  pcd must already have the layout given by
+// tile_point_fields(fields); the bounding box is computed from its points.
+inline bool write_tile(const std::string& path, const sensor_msgs::PointCloud2& pcd, uint32_t fields)
+{
+	PointsMapTileHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, TILE_MAGIC, sizeof(h.magic));
+	h.version = TILE_VERSION;
+	h.fields = fields;
+	h.point_step = tile_point_step(fields);
+	h.width = static_cast<uint64_t>(pcd.width) * pcd.height;
+	if (pcd.point_step != h.point_step || pcd.data.size() < h.width * h.point_step)
+		return false;
+
+	for (uint64_t i = 0; i < h.width; ++i) {
+		float p[3];
+		std::memcpy(p, &pcd.data[i * h.point_step], sizeof(p));
+		if (i == 0) {
+			h.x_min = h.x_max = p[0];
+			h.y_min = h.y_max = p[1];
+			h.z_min = h.z_max = p[2];
+			continue;
+		}
+		if (p[0] < h.x_min) h.x_min = p[0];
+		if (p[0] > h.x_max) h.x_max = p[0];
+		if (p[1] < h.y_min) h.y_min = p[1];
+		if (p[1] > h.y_max) h.y_max = p[1];
+		if (p[2] < h.z_min) h.z_min = p[2];
+		if (p[2] > h.z_max) h.z_max = p[2];
+	}
+
+	std::ofstream ofs(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!ofs)
+		return false;
+	ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+	ofs.write(reinterpret_cast<const char *>(pcd.data.data()), h.width * h.point_step);
+	return static_cast<bool>(ofs);
+}
+
+} // namespace map_file
+
+#endif /* _POINTS_MAP_TILE_H_ */
@@ -28,8 +28,15 @@
  *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
 #include <queue>
+#include <set>
 #include <thread>
 
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
@@ -40,6 +47,8 @@
 #include <waypoint_follower/LaneArray.h>
 
 #include <map_file/get_file.h>
+#include <map_file/points_map_tile.h>
+#include <map_file/PointsMapDelta.h>
 
 namespace {
 
@@ -102,6 +111,48 @@ geometry_msgs::Point RequestQueue::dequeue()
 	}
 }
 
+// Decoded map tiles kept resident up to a memory budget and evicted in LRU
+// order.  Tiles can be requested synchronously with get() or queued with
+// prefetch() for the worker threads running run_prefetcher().  A tile that
+// fails to load is not tried again before its retry time.
+class TileCache {
+public:
+	typedef std::shared_ptr<const sensor_msgs::PointCloud2> Tile;
+	typedef std::chrono::steady_clock Clock;
+
+private:
+	struct Entry {
+		Tile tile;
+		std::list<std::string>::iterator lru;
+	};
+
+	std::map<std::string, Entry> tiles_;
+	std::list<std::string> lru_; // front is the most recently used
+	std::set<std::string> loading_;
+	std::map<std::string, Clock::time_point> failed_; // retry time
+	size_t size_;
+	size_t budget_;
+	std::mutex mtx_;
+	std::condition_variable loaded_cv_;
+
+	std::queue<std::string> prefetch_queue_;
+	std::set<std::string> prefetch_queued_;
+	std::condition_variable prefetch_cv_;
+
+	void evict();
+	bool has_failed(const std::string& path);
+
+public:
+	TileCache() : size_(0), budget_(0) {}
+
+	void set_budget(size_t budget);
+	size_t prefetch_limit();
+	Tile get(const std::string& path);
+	void prefetch(const std::string& path);
+	void clear_prefetch();
+	void run_prefetcher();
+};
+
 struct Area {
 	std::string path;
 	double x_min;
@@ -116,6 +167,10 @@ typedef std::vector<Area> AreaList;
 typedef std::vector<std::vector<std::string>> Tbl;
 
 constexpr int DEFAULT_UPDATE_RATE = 1000; // ms
+constexpr int DEFAULT_CACHE_SIZE = 2048; // MB
+constexpr int DEFAULT_PREFETCH_THREADS = 2;
+constexpr int LOAD_RETRY_INTERVAL = 10000; // ms
+constexpr double DEFAULT_LOOK_AHEAD_DISTANCE = 500; // meter
 constexpr double MARGIN_UNIT = 100; // meter
 constexpr int ROUNDING_UNIT = 1000; // meter
 const std::string AREALIST_FILENAME = "arealist.txt";
@@ -138,8 +193,21 @@ AreaList downloaded_areas;
 std::mutex downloaded_areas_mtx;
 std::vector<std::string> cached_arealist_paths;
 
+bool publish_delta;
+ros::Publisher delta_pub;
+std::vector<std::string> published_paths;
+std::vector<TileCache::Tile> published_tiles; // kept for new delta subscribers
+std::map<std::string, int64_t> tile_ids;
+
+double look_ahead_distance;
+waypoint_follower::LaneArray look_ahead_lanes;
+geometry_msgs::Point look_ahead_position;
+bool has_look_ahead_position = false;
+std::vector<size_t> look_ahead_starts; // nearest waypoint of each lane when last requested
+
 GetFile gf;
 RequestQueue request_queue;
+TileCache tile_cache;
 
 Tbl read_csv(const std::string& path)
 {
@@ -302,60 +370,328 @@ void download_map()
 				std::string loc = create_location(x_area, y_area);
 				if (is_downloaded(area.path) ||
 				    download(gf, TEMPORARY_DIRNAME, loc, basename(area.path.c_str())) == 0) {
-					std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
-					cache_arealist(area, downloaded_areas);
+					{
+						std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
+						cache_arealist(area, downloaded_areas);
+					}
+					tile_cache.prefetch(area.path);
 				}
 			}
 		}
 	}
 }
 
-sensor_msgs::PointCloud2 create_pcd(const geometry_msgs::Point& p)
+bool has_same_layout(const sensor_msgs::PointCloud2& a, const sensor_msgs::PointCloud2& b)
 {
-	sensor_msgs::PointCloud2 pcd, part;
-	std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
-	for (const Area& area : downloaded_areas) {
-		if (is_in_area(p.x, p.y, area, margin)) {
-			if (pcd.width == 0)
-				pcl::io::loadPCDFile(area.path.c_str(), pcd);
-			else {
-				pcl::io::loadPCDFile(area.path.c_str(), part);
-				pcd.width += part.width;
-				pcd.row_step += part.row_step;
-				pcd.data.insert(pcd.data.end(), part.data.begin(), part.data.end());
-			}
-		}
+	if (a.point_step != b.point_step || a.fields.size() != b.fields.size())
+		return false;
+	for (size_t i = 0; i < a.fields.size(); ++i) {
+		if (a.fields[i].name != b.fields[i].name || a.fields[i].offset != b.fields[i].offset ||
+		    a.fields[i].datatype != b.fields[i].datatype)
+			return false;
 	}
+	return true;
+}
 
-	return pcd;
+bool load_part(const std::string& path, sensor_msgs::PointCloud2& part)
+{
+	if (!map_file::is_tile_path(path))
+		return (pcl::io::loadPCDFile(path.c_str(), part) != -1);
+
+	map_file::MappedTile tile;
+	if (!tile.open(path))
+		return false;
+	part.height = 1;
+	part.width = tile.header().width;
+	part.fields = map_file::tile_point_fields(tile.header().fields);
+	part.is_bigendian = false;
+	part.point_step = tile.header().point_step;
+	part.row_step = tile.data_size();
+	part.data.assign(tile.data(), tile.data() + tile.data_size());
+	part.is_dense = true;
+	return true;
+}
+
+void TileCache::set_budget(size_t budget)
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	budget_ = budget;
+	evict();
+}
+
+void TileCache::evict()
+{
+	// The most recently used tile stays even if it alone exceeds the budget.
+	while (size_ > budget_ && lru_.size() > 1) {
+		std::map<std::string, Entry>::iterator it = tiles_.find(lru_.back());
+		size_ -= it->second.tile->data.size();
+		tiles_.erase(it);
+		lru_.pop_back();
+	}
+}
+
+bool TileCache::has_failed(const std::string& path)
+{
+	std::map<std::string, Clock::time_point>::iterator it = failed_.find(path);
+	if (it == failed_.end())
+		return false;
+	if (Clock::now() < it->second)
+		return true;
+	failed_.erase(it);
+	return false;
+}
+
+// Number of tiles of the average resident size fitting in half of the
+// budget, so that prefetched tiles cannot evict those around the vehicle.
+size_t TileCache::prefetch_limit()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	size_t tile_size = tiles_.empty() ? 0 : size_ / tiles_.size();
+	if (tile_size == 0)
+		return std::numeric_limits<size_t>::max();
+	return std::max<size_t>(budget_ / 2 / tile_size, 1);
 }
 
-sensor_msgs::PointCloud2 create_pcd(const std::vector<std::string>& pcd_paths, int* ret_err = NULL)
+TileCache::Tile TileCache::get(const std::string& path)
 {
-	sensor_msgs::PointCloud2 pcd, part;
+	std::unique_lock<std::mutex> lock(mtx_);
+	while (loading_.count(path) != 0)
+		loaded_cv_.wait(lock);
+
+	std::map<std::string, Entry>::iterator it = tiles_.find(path);
+	if (it != tiles_.end()) {
+		lru_.splice(lru_.begin(), lru_, it->second.lru);
+		return it->second.tile;
+	}
+	if (has_failed(path))
+		return Tile();
+
+	loading_.insert(path);
+	lock.unlock();
+	std::shared_ptr<sensor_msgs::PointCloud2> tile = std::make_shared<sensor_msgs::PointCloud2>();
+	bool loaded = load_part(path, *tile);
+	lock.lock();
+	loading_.erase(path);
+	loaded_cv_.notify_all();
+
+	if (!loaded) {
+		std::cerr << "load failed " << path << std::endl;
+		failed_[path] = Clock::now() + std::chrono::milliseconds(LOAD_RETRY_INTERVAL);
+		return Tile();
+	}
+	lru_.push_front(path);
+	Entry& entry = tiles_[path];
+	entry.tile = tile;
+	entry.lru = lru_.begin();
+	size_ += tile->data.size();
+	evict();
+	return tile;
+}
+
+void TileCache::prefetch(const std::string& path)
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	if (tiles_.count(path) != 0 || loading_.count(path) != 0 || prefetch_queued_.count(path) != 0 ||
+	    has_failed(path))
+		return;
+	prefetch_queue_.push(path);
+	prefetch_queued_.insert(path);
+	prefetch_cv_.notify_one();
+}
+
+void TileCache::clear_prefetch()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	while (!prefetch_queue_.empty())
+		prefetch_queue_.pop();
+	prefetch_queued_.clear();
+}
+
+void TileCache::run_prefetcher()
+{
+	while (true) {
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			while (prefetch_queue_.empty())
+				prefetch_cv_.wait(lock);
+			path = prefetch_queue_.front();
+			prefetch_queue_.pop();
+			prefetch_queued_.erase(path);
+		}
+		get(path);
+	}
+}
+
+// Tiles are memory-mapped and copied straight into the message; PCD files
+// are parsed first.  Either way the output buffer is allocated only once.
+sensor_msgs::PointCloud2 create_pcd(const std::vector<std::string>& pcd_paths, int* ret_err = NULL,
+				    bool progress = true)
+{
+	struct Part {
+		std::shared_ptr<map_file::MappedTile> tile;
+		sensor_msgs::PointCloud2 pcd;
+	};
+
+	sensor_msgs::PointCloud2 pcd;
+	std::vector<Part> parts;
+	size_t size = 0;
 	for (const std::string& path : pcd_paths) {
-		// Following outputs are used for progress bar of Runtime Manager.
-		if (pcd.width == 0) {
-			if (pcl::io::loadPCDFile(path.c_str(), pcd) == -1) {
-				std::cerr << "load failed " << path << std::endl;
-				if (ret_err) *ret_err = 1;
+		Part part;
+		bool loaded;
+		if (map_file::is_tile_path(path)) {
+			part.tile = std::make_shared<map_file::MappedTile>();
+			loaded = part.tile->open(path);
+			if (loaded) {
+				part.pcd.height = 1;
+				part.pcd.width = part.tile->header().width;
+				part.pcd.fields = map_file::tile_point_fields(part.tile->header().fields);
+				part.pcd.point_step = part.tile->header().point_step;
+				part.pcd.is_dense = true;
 			}
+		} else
+			loaded = (pcl::io::loadPCDFile(path.c_str(), part.pcd) != -1);
+
+		// Following outputs are used for progress bar of Runtime Manager.
+		if (!loaded) {
+			std::cerr << "load failed " << path << std::endl;
+			if (ret_err) *ret_err = 1;
+		} else if (!parts.empty() && !has_same_layout(parts.front().pcd, part.pcd)) {
+			std::cerr << "load failed " << path << " (point fields differ)" << std::endl;
+			if (ret_err) *ret_err = 1;
 		} else {
-			if (pcl::io::loadPCDFile(path.c_str(), part) == -1) {
-				std::cerr << "load failed " << path << std::endl;
-				if (ret_err) *ret_err = 1;
-			}
-			pcd.width += part.width;
-			pcd.row_step += part.row_step;
-			pcd.data.insert(pcd.data.end(), part.data.begin(), part.data.end());
+			size += (part.tile) ? part.tile->data_size() : part.pcd.data.size();
+			parts.push_back(part);
 		}
-		std::cerr << "load " << path << std::endl;
+		if (progress)
+			std::cerr << "load " << path << std::endl;
 		if (!ros::ok()) break;
 	}
+	if (parts.empty())
+		return pcd;
+
+	pcd.height = 1;
+	pcd.fields = parts.front().pcd.fields;
+	pcd.is_bigendian = false;
+	pcd.point_step = parts.front().pcd.point_step;
+	pcd.is_dense = parts.front().pcd.is_dense;
+	pcd.data.reserve(size);
+	for (const Part& part : parts) {
+		if (part.tile)
+			pcd.data.insert(pcd.data.end(), part.tile->data(), part.tile->data() + part.tile->data_size());
+		else
+			pcd.data.insert(pcd.data.end(), part.pcd.data.begin(), part.pcd.data.end());
+	}
+	pcd.width = pcd.data.size() / pcd.point_step;
+	pcd.row_step = pcd.data.size();
+
+	return pcd;
+}
+
+std::vector<std::string> find_area_paths(const geometry_msgs::Point& p)
+{
+	std::vector<std::string> paths;
+	std::unique_lock<std::mutex> lock(downloaded_areas_mtx);
+	for (const Area& area : downloaded_areas) {
+		if (is_in_area(p.x, p.y, area, margin))
+			paths.push_back(area.path);
+	}
+	return paths;
+}
+
+// Collect the cached tiles around p, skipping those whose point fields
+// differ from the first one.
+void find_area_tiles(const geometry_msgs::Point& p, std::vector<std::string>& paths,
+		     std::vector<TileCache::Tile>& tiles)
+{
+	for (const std::string& path : find_area_paths(p)) {
+		TileCache::Tile tile = tile_cache.get(path);
+		if (!tile)
+			continue;
+		if (!tiles.empty() && !has_same_layout(*tiles.front(), *tile)) {
+			std::cerr << "load failed " << path << " (point fields differ)" << std::endl;
+			continue;
+		}
+		paths.push_back(path);
+		tiles.push_back(tile);
+	}
+}
+
+sensor_msgs::PointCloud2 create_pcd(const std::vector<TileCache::Tile>& tiles)
+{
+	sensor_msgs::PointCloud2 pcd;
+	if (tiles.empty())
+		return pcd;
+
+	size_t size = 0;
+	for (const TileCache::Tile& tile : tiles)
+		size += tile->data.size();
+
+	pcd.height = 1;
+	pcd.fields = tiles.front()->fields;
+	pcd.is_bigendian = false;
+	pcd.point_step = tiles.front()->point_step;
+	pcd.is_dense = tiles.front()->is_dense;
+	pcd.data.reserve(size);
+	for (const TileCache::Tile& tile : tiles)
+		pcd.data.insert(pcd.data.end(), tile->data.begin(), tile->data.end());
+	pcd.width = pcd.data.size() / pcd.point_step;
+	pcd.row_step = pcd.data.size();
 
 	return pcd;
 }
 
+int64_t tile_id(const std::string& path)
+{
+	std::map<std::string, int64_t>::const_iterator it = tile_ids.find(path);
+	if (it != tile_ids.end())
+		return it->second;
+	int64_t id = tile_ids.size();
+	tile_ids[path] = id;
+	return id;
+}
+
+// Tiles in paths but not in published_paths are added, tiles only in
+// published_paths are removed.
+map_file::PointsMapDelta create_delta(const std::vector<std::string>& paths, const std::vector<TileCache::Tile>& tiles)
+{
+	map_file::PointsMapDelta delta;
+	delta.reset = published_paths.empty();
+
+	std::set<std::string> current(paths.begin(), paths.end());
+	std::set<std::string> previous(published_paths.begin(), published_paths.end());
+	for (const std::string& path : published_paths) {
+		if (current.count(path) == 0)
+			delta.removed_ids.push_back(tile_id(path));
+	}
+	for (size_t i = 0; i < paths.size(); ++i) {
+		if (previous.count(paths[i]) == 0) {
+			delta.added_ids.push_back(tile_id(paths[i]));
+			delta.added_tiles.push_back(*tiles[i]);
+			delta.added_tiles.back().header.frame_id = "map";
+		}
+	}
+
+	return delta;
+}
+
+// A new delta subscriber gets the whole published tile set first.  The
+// published tiles are held with their paths, so nothing is loaded here.
+void publish_delta_snapshot(const ros::SingleSubscriberPublisher& pub)
+{
+	map_file::PointsMapDelta delta;
+	delta.header.frame_id = "map";
+	delta.header.stamp = ros::Time::now();
+	delta.reset = true;
+	for (size_t i = 0; i < published_paths.size(); ++i) {
+		delta.added_ids.push_back(tile_id(published_paths[i]));
+		delta.added_tiles.push_back(*published_tiles[i]);
+		delta.added_tiles.back().header.frame_id = "map";
+	}
+	if (!delta.added_ids.empty())
+		pub.publish(delta);
+}
+
 void publish_pcd(sensor_msgs::PointCloud2 pcd, const int* errp = NULL)
 {
 	if (pcd.width != 0) {
@@ -369,6 +705,133 @@ void publish_pcd(sensor_msgs::PointCloud2 pcd, const int* errp = NULL)
 	}
 }
 
+// Publish the tiles around p, as a whole cloud or as a change of the tile
+// set.  Nothing is sent while the tile set stays the same.  Leaving the
+// map removes every published tile from the delta subscribers.
+void publish_area_pcd(const geometry_msgs::Point& p)
+{
+	std::vector<std::string> paths;
+	std::vector<TileCache::Tile> tiles;
+	find_area_tiles(p, paths, tiles);
+	if (paths == published_paths)
+		return;
+
+	if (publish_delta) {
+		map_file::PointsMapDelta delta = create_delta(paths, tiles);
+		delta.header.frame_id = "map";
+		delta.header.stamp = ros::Time::now();
+		delta_pub.publish(delta);
+		stat_msg.data = true;
+		stat_pub.publish(stat_msg);
+	} else if (!tiles.empty())
+		publish_pcd(create_pcd(tiles));
+	published_paths = paths;
+	published_tiles = tiles;
+}
+
+void request_look_ahead(const geometry_msgs::Point& p, std::set<std::string>& requested, size_t limit)
+{
+	if (requested.size() >= limit)
+		return;
+	if (can_download)
+		request_queue.enqueue_look_ahead(p);
+	for (const std::string& path : find_area_paths(p)) {
+		if (requested.size() >= limit)
+			break;
+		if (requested.insert(path).second)
+			tile_cache.prefetch(path);
+	}
+}
+
+size_t find_nearest_waypoint(const waypoint_follower::lane& l)
+{
+	size_t nearest = 0;
+	if (!has_look_ahead_position)
+		return nearest;
+
+	double min_distance = std::numeric_limits<double>::max();
+	for (size_t i = 0; i < l.waypoints.size(); ++i) {
+		const geometry_msgs::Point& p = l.waypoints[i].pose.pose.position;
+		double d = hypot(p.x - look_ahead_position.x, p.y - look_ahead_position.y);
+		if (d < min_distance) {
+			min_distance = d;
+			nearest = i;
+		}
+	}
+	return nearest;
+}
+
+// Prefetch the tiles along each lane from the waypoint nearest to the
+// vehicle up to look_ahead_distance, no more than half of the cache holds.
+// The queued requests are kept while the nearest waypoints do not change.
+void update_look_ahead()
+{
+	std::vector<size_t> starts;
+	for (const waypoint_follower::lane& l : look_ahead_lanes.lanes)
+		starts.push_back(find_nearest_waypoint(l));
+	if (starts == look_ahead_starts)
+		return;
+	look_ahead_starts = starts;
+
+	request_queue.clear_look_ahead();
+	tile_cache.clear_prefetch();
+
+	std::set<std::string> requested;
+	size_t limit = tile_cache.prefetch_limit();
+	double threshold = (MARGIN_UNIT / 2) + margin; // XXX better way?
+	for (size_t n = 0; n < look_ahead_lanes.lanes.size(); ++n) {
+		const waypoint_follower::lane& l = look_ahead_lanes.lanes[n];
+		if (l.waypoints.empty())
+			continue;
+
+		size_t start = starts[n];
+		double horizon = 0;
+		double distance = 0;
+		size_t last = start;
+		for (size_t i = start; i < l.waypoints.size(); ++i) {
+			geometry_msgs::Point p1;
+			p1.x = l.waypoints[i].pose.pose.position.x;
+			p1.y = l.waypoints[i].pose.pose.position.y;
+			if (i != start) {
+				const geometry_msgs::Point& p2 = l.waypoints[i - 1].pose.pose.position;
+				double step = hypot(p2.x - p1.x, p2.y - p1.y);
+				horizon += step;
+				if (horizon > look_ahead_distance)
+					break;
+				distance += step;
+			}
+			last = i;
+			if (i == start || distance > threshold) {
+				request_look_ahead(p1, requested, limit);
+				distance = 0;
+			}
+		}
+		if (distance > 0) {
+			geometry_msgs::Point p;
+			p.x = l.waypoints[last].pose.pose.position.x;
+			p.y = l.waypoints[last].pose.pose.position.y;
+			request_look_ahead(p, requested, limit);
+		}
+	}
+}
+
+void update_look_ahead(const geometry_msgs::Point& p)
+{
+	look_ahead_position = p;
+	has_look_ahead_position = true;
+	if (!look_ahead_lanes.lanes.empty())
+		update_look_ahead();
+}
+
+void request_lookahead_download(const waypoint_follower::LaneArray& msg)
+{
+	look_ahead_lanes = msg;
+	look_ahead_starts.clear();
+	request_queue.clear_look_ahead();
+	tile_cache.clear_prefetch();
+	update_look_ahead();
+}
+
 void publish_gnss_pcd(const geometry_msgs::PoseStamped& msg)
 {
 	ros::Time now = ros::Time::now();
@@ -381,7 +844,8 @@ void publish_gnss_pcd(const geometry_msgs::PoseStamped& msg)
 	if (can_download)
 		request_queue.enqueue(msg.pose.position);
 
-	publish_pcd(create_pcd(msg.pose.position));
+	publish_area_pcd(msg.pose.position);
+	update_look_ahead(msg.pose.position);
 }
 
 void publish_current_pcd(const geometry_msgs::PoseStamped& msg)
@@ -394,7 +858,8 @@ void publish_current_pcd(const geometry_msgs::PoseStamped& msg)
 	if (can_download)
 		request_queue.enqueue(msg.pose.position);
 
-	publish_pcd(create_pcd(msg.pose.position));
+	publish_area_pcd(msg.pose.position);
+	update_look_ahead(msg.pose.position);
 }
 
 void publish_dragged_pcd(const geometry_msgs::PoseWithCovarianceStamped& msg)
@@ -416,44 +881,15 @@ void publish_dragged_pcd(const geometry_msgs::PoseWithCovarianceStamped& msg)
 	if (can_download)
 		request_queue.enqueue(p);
 
-	publish_pcd(create_pcd(p));
-}
-
-void request_lookahead_download(const waypoint_follower::LaneArray& msg)
-{
-	request_queue.clear_look_ahead();
-
-	for (const waypoint_follower::lane& l : msg.lanes) {
-		size_t end = l.waypoints.size() - 1;
-		double distance = 0;
-		double threshold = (MARGIN_UNIT / 2) + margin; // XXX better way?
-		for (size_t i = 0; i <= end; ++i) {
-			if (i == 0 || i == end) {
-				geometry_msgs::Point p;
-				p.x = l.waypoints[i].pose.pose.position.x;
-				p.y = l.waypoints[i].pose.pose.position.y;
-				request_queue.enqueue_look_ahead(p);
-			} else {
-				geometry_msgs::Point p1, p2;
-				p1.x = l.waypoints[i].pose.pose.position.x;
-				p1.y = l.waypoints[i].pose.pose.position.y;
-				p2.x = l.waypoints[i - 1].pose.pose.position.x;
-				p2.y = l.waypoints[i - 1].pose.pose.position.y;
-				distance += hypot(p2.x - p1.x, p2.y - p1.y);
-				if (distance > threshold) {
-					request_queue.enqueue_look_ahead(p1);
-					distance = 0;
-				}
-			}
-		}
-	}
+	publish_area_pcd(p);
+	update_look_ahead(p);
 }
 
 void print_usage()
 {
 	ROS_ERROR_STREAM("Usage:");
-	ROS_ERROR_STREAM("rosrun map_file points_map_loader noupdate [PCD]...");
-	ROS_ERROR_STREAM("rosrun map_file points_map_loader {1x1|3x3|5x5|7x7|9x9} AREALIST [PCD]...");
+	ROS_ERROR_STREAM("rosrun map_file points_map_loader noupdate [PCD|PMT]...");
+	ROS_ERROR_STREAM("rosrun map_file points_map_loader {1x1|3x3|5x5|7x7|9x9} AREALIST [PCD|PMT]...");
 	ROS_ERROR_STREAM("rosrun map_file points_map_loader {1x1|3x3|5x5|7x7|9x9} download");
 }
 
@@ -536,12 +972,33 @@ int main(int argc, char **argv)
 		n.param<int>("points_map_loader/update_rate", update_rate, DEFAULT_UPDATE_RATE);
 		fallback_rate = update_rate * 2; // XXX better way?
 
+		n.param<bool>("points_map_loader/publish_delta", publish_delta, false);
+		if (publish_delta)
+			delta_pub = n.advertise<map_file::PointsMapDelta>("points_map_delta", 10,
+									   ros::SubscriberStatusCallback(publish_delta_snapshot));
+
+		int cache_size;
+		n.param<int>("points_map_loader/cache_size", cache_size, DEFAULT_CACHE_SIZE);
+		tile_cache.set_budget(static_cast<size_t>(std::max(cache_size, 0)) * 1024 * 1024);
+		n.param<double>("points_map_loader/look_ahead_distance", look_ahead_distance,
+				DEFAULT_LOOK_AHEAD_DISTANCE);
+		int prefetch_threads;
+		n.param<int>("points_map_loader/prefetch_threads", prefetch_threads, DEFAULT_PREFETCH_THREADS);
+		try {
+			for (int i = 0; i < prefetch_threads; ++i) {
+				std::thread prefetcher(&TileCache::run_prefetcher, &tile_cache);
+				prefetcher.detach();
+			}
+		} catch (std::exception &ex) {
+			ROS_ERROR_STREAM("failed to create thread from " << ex.what());
+		}
+
 		gnss_sub = n.subscribe("gnss_pose", 1000, publish_gnss_pcd);
 		current_sub = n.subscribe("current_pose", 1000, publish_current_pcd);
 		initial_sub = n.subscribe("initialpose", 1, publish_dragged_pcd);
+		waypoints_sub = n.subscribe("traffic_waypoints_array", 1, request_lookahead_download);
 
 		if (can_download) {
-			waypoints_sub = n.subscribe("traffic_waypoints_array", 1, request_lookahead_download);
 			try {
 				std::thread downloader(download_map);
 				downloader.detach();
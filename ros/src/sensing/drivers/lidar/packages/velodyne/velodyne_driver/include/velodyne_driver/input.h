@@ -35,6 +35,8 @@
 #include <stdio.h>
 #include <pcap.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
 
 #include <ros/ros.h>
 #include <velodyne_msgs/VelodynePacket.h>
@@ -59,6 +61,19 @@ namespace velodyne_driver
      */
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt) = 0;
 
+    /** @brief Read up to npackets Velodyne packets.
+     *
+     * The default implementation calls getPacket() once per packet.
+     *
+     * @param pkts points to an array of at least npackets messages
+     * @param npackets maximum number of packets to read
+     *
+     * @returns number of complete packets stored at the start of pkts,
+     *          -1 if end of file
+     */
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int npackets);
+
 
     /** @brief Set source IP, from where packets are accepted
      *
@@ -78,11 +93,22 @@ namespace velodyne_driver
     ~InputSocket();
 
     virtual int getPacket(velodyne_msgs::VelodynePacket *pkt);
+    virtual int getPackets(velodyne_msgs::VelodynePacket *pkts,
+                           int npackets);
     void setDeviceIP( const std::string& ip );
   private:
 
+    bool waitForData(void);
+
     int sockfd_;
     in_addr devip_;
+
+    // recvmmsg() state, preallocated for batch_size_ packets
+    int batch_size_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_in> addrs_;
+    std::vector<char> control_;
   };
 
 
@@ -90,6 +116,11 @@ namespace velodyne_driver
    *
    * Dump files can be grabbed by libpcap, Velodyne's DSR software,
    * ethereal, wireshark, tcpdump, or the \ref vdump_command.
+   *
+   * Classic pcap files are memory-mapped and indexed, so they can be
+   * replayed at a multiple of their recorded rate, started at an
+   * offset, and looped without reopening.  Other formats (pcapng) are
+   * read sequentially through libpcap.
    */
   class InputPCAP: public Input
   {
@@ -107,6 +138,11 @@ namespace velodyne_driver
 
   private:
 
+    bool openIndex(void);
+    bool seek(double offset);
+    double packetTime(size_t index) const;
+    int getIndexedPacket(velodyne_msgs::VelodynePacket *pkt);
+
     std::string filename_;
     FILE *fp_;
     pcap_t *pcap_;
@@ -117,6 +153,22 @@ namespace velodyne_driver
     double repeat_delay_;
     ros::Rate packet_rate_;
     bpf_program velodyne_pointdata_filter_;
+
+    // memory-mapped, indexed replay
+    double replay_rate_;              ///< multiple of recorded rate, 0 for packet_rate
+    double start_time_;               ///< replay start offset (s)
+    bool use_pcap_time_;              ///< stamp packets with capture time
+    const uint8_t *map_;
+    size_t map_size_;
+    bool swapped_;                    ///< file byte order differs from ours
+    double ts_scale_;                 ///< seconds per fractional timestamp unit
+    std::vector<uint64_t> records_;   ///< file offsets of Velodyne data records
+    size_t next_;                     ///< next record to replay
+    size_t start_index_;              ///< first record of each loop
+    ros::WallTime wall_origin_;       ///< wall time of pacing origin
+    double pcap_origin_;              ///< capture time of pacing origin
+    bool filter_ip_;
+    in_addr devip_;
   };
 
 } // velodyne_driver namespace
@@ -133,16 +133,14 @@ bool VelodyneDriver::poll(void)
   scan->packets.resize(config_.npackets);
 
   // Since the velodyne delivers data at a very high rate, keep
-  // reading and publishing scans as fast as possible.
-  for (int i = 0; i < config_.npackets; ++i)
+  // reading and publishing scans as fast as possible.  The input may
+  // return several packets per call, written in place into the scan.
+  int i = 0;
+  while (i < config_.npackets)
     {
-      while (true)
-        {
-          // keep reading until full packet received
-          int rc = input_->getPacket(&scan->packets[i]);
-          if (rc == 0) break;       // got a full packet?
-          if (rc < 0) return false; // end of file reached?
-        }
+      int rc = input_->getPackets(&scan->packets[i], config_.npackets - i);
+      if (rc < 0) return false;     // end of file reached?
+      i += rc;
     }
 
   // publish message using time of last packet read
@@ -28,12 +28,51 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <byteswap.h>
+#include <time.h>
+#include <algorithm>
 #include <velodyne_driver/input.h>
 
 namespace velodyne_driver
 {
   static const size_t packet_size = sizeof(velodyne_msgs::VelodynePacket().data);
 
+  // ancillary data space for one SO_TIMESTAMPNS control message
+  static const size_t control_size = CMSG_SPACE(sizeof(timespec));
+
+  // classic pcap file layout
+  static const size_t pcap_file_header_size = 24;
+  static const size_t pcap_record_header_size = 16;
+  static const uint32_t pcap_linktype_ethernet = 1;
+
+  /** @brief Read a 32-bit pcap header field in file byte order. */
+  static inline uint32_t load32(const uint8_t *p, bool swapped)
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swapped? bswap_32(v): v;
+  }
+
+  ////////////////////////////////////////////////////////////////////////
+  // Input class implementation
+  ////////////////////////////////////////////////////////////////////////
+
+  /** @brief Read up to npackets packets, one getPacket() at a time. */
+  int Input::getPackets(velodyne_msgs::VelodynePacket *pkts, int npackets)
+  {
+    for (int i = 0; i < npackets; ++i)
+      {
+        int rc = getPacket(&pkts[i]);
+        if (rc < 0)                     // end of file reached?
+          return -1;
+        if (rc > 0)                     // timeout or incomplete packet
+          return i;
+      }
+    return npackets;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputSocket class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -48,6 +87,13 @@ namespace velodyne_driver
   {
     sockfd_ = -1;
 
+    // packets per recvmmsg() call, zero for one recvfrom() per packet
+    private_nh.param("batch_size", batch_size_, 0);
+    if (batch_size_ < 0)
+      batch_size_ = 0;
+    int buffer_size;
+    private_nh.param("socket_buffer_size", buffer_size, 0);
+
     // connect to Velodyne UDP port
     ROS_INFO_STREAM("Opening UDP socket: port " << udp_port);
     sockfd_ = socket(PF_INET, SOCK_DGRAM, 0);
@@ -75,6 +121,34 @@ namespace velodyne_driver
         return;
       }
 
+    // A larger receive buffer rides out scheduling delays on a loaded
+    // host, which otherwise show up as dropped packets.
+    if (buffer_size > 0
+        && setsockopt(sockfd_, SOL_SOCKET, SO_RCVBUF,
+                      &buffer_size, sizeof(buffer_size)) < 0)
+      {
+        perror("setsockopt(SO_RCVBUF)");
+      }
+
+    if (batch_size_ > 0)
+      {
+        // Have the kernel stamp each datagram on arrival, since a batch
+        // read no longer brackets the arrival of any single packet.
+        int on = 1;
+        if (setsockopt(sockfd_, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &on, sizeof(on)) < 0)
+          {
+            perror("setsockopt(SO_TIMESTAMPNS)");
+          }
+
+        msgs_.resize(batch_size_);
+        iovecs_.resize(batch_size_);
+        addrs_.resize(batch_size_);
+        control_.resize(batch_size_ * control_size);
+        ROS_INFO_STREAM("Receiving up to " << batch_size_
+                        << " packets per system call");
+      }
+
     ROS_DEBUG("Velodyne socket fd is %d\n", sockfd_);
   }
 
@@ -90,61 +164,74 @@ namespace velodyne_driver
     inet_aton(ip.c_str(),&devip_);
   }
 
-  /** @brief Get one velodyne packet. */
-  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt)
+  /** @brief Wait until the socket has input available.
+   *
+   *  @returns true if a read should now succeed, false after a
+   *           timeout or device error
+   */
+  bool InputSocket::waitForData(void)
   {
-    double time1 = ros::Time::now().toSec();
-
     struct pollfd fds[1];
     fds[0].fd = sockfd_;
     fds[0].events = POLLIN;
     static const int POLL_TIMEOUT = 1000; // one second (in msec)
 
+    // Unfortunately, the Linux kernel recvfrom() implementation
+    // uses a non-interruptible sleep() when waiting for data,
+    // which would cause this method to hang if the device is not
+    // providing data.  We poll() the device first to make sure
+    // the recvfrom() will not block.
+    //
+    // Note, however, that there is a known Linux kernel bug:
+    //
+    //   Under Linux, select() may report a socket file descriptor
+    //   as "ready for reading", while nevertheless a subsequent
+    //   read blocks.  This could for example happen when data has
+    //   arrived but upon examination has wrong checksum and is
+    //   discarded.  There may be other circumstances in which a
+    //   file descriptor is spuriously reported as ready.  Thus it
+    //   may be safer to use O_NONBLOCK on sockets that should not
+    //   block.
+
+    // poll() until input available
+    do
+      {
+        int retval = poll(fds, 1, POLL_TIMEOUT);
+        if (retval < 0)             // poll() error?
+          {
+            if (errno != EINTR)
+              ROS_ERROR("poll() error: %s", strerror(errno));
+            return false;
+          }
+        if (retval == 0)            // poll() timeout?
+          {
+            ROS_WARN("Velodyne poll() timeout");
+            return false;
+          }
+        if ((fds[0].revents & POLLERR)
+            || (fds[0].revents & POLLHUP)
+            || (fds[0].revents & POLLNVAL)) // device error?
+          {
+            ROS_ERROR("poll() reports Velodyne error");
+            return false;
+          }
+      } while ((fds[0].revents & POLLIN) == 0);
+
+    return true;
+  }
+
+  /** @brief Get one velodyne packet. */
+  int InputSocket::getPacket(velodyne_msgs::VelodynePacket *pkt)
+  {
+    double time1 = ros::Time::now().toSec();
+
     sockaddr_in sender_address;
     socklen_t sender_address_len = sizeof(sender_address);
 
     while (true)
       {
-        // Unfortunately, the Linux kernel recvfrom() implementation
-        // uses a non-interruptible sleep() when waiting for data,
-        // which would cause this method to hang if the device is not
-        // providing data.  We poll() the device first to make sure
-        // the recvfrom() will not block.
-        //
-        // Note, however, that there is a known Linux kernel bug:
-        //
-        //   Under Linux, select() may report a socket file descriptor
-        //   as "ready for reading", while nevertheless a subsequent
-        //   read blocks.  This could for example happen when data has
-        //   arrived but upon examination has wrong checksum and is
-        //   discarded.  There may be other circumstances in which a
-        //   file descriptor is spuriously reported as ready.  Thus it
-        //   may be safer to use O_NONBLOCK on sockets that should not
-        //   block.
-
-        // poll() until input available
-        do
-          {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-              {
-                if (errno != EINTR)
-                  ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
-              }
-            if (retval == 0)            // poll() timeout?
-              {
-                ROS_WARN("Velodyne poll() timeout");
-                return 1;
-              }
-            if ((fds[0].revents & POLLERR)
-                || (fds[0].revents & POLLHUP)
-                || (fds[0].revents & POLLNVAL)) // device error?
-              {
-                ROS_ERROR("poll() reports Velodyne error");
-                return 1;
-              }
-          } while ((fds[0].revents & POLLIN) == 0);
+        if (!waitForData())
+          return 1;
 
         // Receive packets that should now be available from the
         // socket using a blocking read.
@@ -184,6 +271,89 @@ namespace velodyne_driver
     return 0;
   }
 
+  /** @brief Get up to npackets velodyne packets with one recvmmsg().
+   *
+   *  Datagrams are received straight into the caller's packet
+   *  messages, which are usually the packets of the VelodyneScan being
+   *  assembled.  Short datagrams and packets from other devices are
+   *  squeezed out, so the result may hold fewer packets than arrived.
+   */
+  int InputSocket::getPackets(velodyne_msgs::VelodynePacket *pkts,
+                              int npackets)
+  {
+    if (batch_size_ == 0)
+      return Input::getPackets(pkts, npackets);
+
+    if (!waitForData())
+      return 0;
+
+    int count = std::min(npackets, batch_size_);
+    for (int i = 0; i < count; ++i)
+      {
+        iovecs_[i].iov_base = &pkts[i].data[0];
+        iovecs_[i].iov_len = packet_size;
+
+        msghdr &hdr = msgs_[i].msg_hdr;
+        hdr.msg_name = &addrs_[i];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &iovecs_[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = &control_[i * control_size];
+        hdr.msg_controllen = control_size;
+        hdr.msg_flags = 0;
+        msgs_[i].msg_len = 0;
+      }
+
+    int nmsgs = recvmmsg(sockfd_, &msgs_[0], count, MSG_DONTWAIT, NULL);
+    if (nmsgs < 0)
+      {
+        if (errno != EWOULDBLOCK && errno != EINTR)
+          {
+            perror("recvfail");
+            ROS_INFO("recvfail");
+          }
+        return 0;
+      }
+
+    ros::Time now = ros::Time::now();
+    int kept = 0;
+    for (int i = 0; i < nmsgs; ++i)
+      {
+        const msghdr &hdr = msgs_[i].msg_hdr;
+        if (msgs_[i].msg_len != packet_size || (hdr.msg_flags & MSG_TRUNC))
+          {
+            ROS_DEBUG_STREAM("incomplete Velodyne packet read: "
+                             << msgs_[i].msg_len << " bytes");
+            continue;
+          }
+
+        // if packet is not from the lidar scanner we selected by IP, drop it
+        if (devip_str_ != "" && addrs_[i].sin_addr.s_addr != devip_.s_addr)
+          continue;
+
+        // use the kernel receive time, or now if it is missing
+        pkts[kept].stamp = now;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(const_cast<msghdr *>(&hdr), cmsg))
+          {
+            if (cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+              {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                pkts[kept].stamp = ros::Time(ts.tv_sec, ts.tv_nsec);
+                break;
+              }
+          }
+
+        if (kept != i)
+          pkts[kept].data = pkts[i].data;
+        ++kept;
+      }
+
+    return kept;
+  }
+
   ////////////////////////////////////////////////////////////////////////
   // InputPCAP class implementation
   ////////////////////////////////////////////////////////////////////////
@@ -210,11 +380,22 @@ namespace velodyne_driver
     fp_ = NULL;  
     pcap_ = NULL;  
     empty_ = true;
+    map_ = NULL;
+    map_size_ = 0;
+    swapped_ = false;
+    ts_scale_ = 1e-6;
+    next_ = 0;
+    start_index_ = 0;
+    pcap_origin_ = -1.0;
+    filter_ip_ = false;
 
     // get parameters using private node handle
     private_nh.param("read_once", read_once_, read_once);
     private_nh.param("read_fast", read_fast_, read_fast);
     private_nh.param("repeat_delay", repeat_delay_, repeat_delay);
+    private_nh.param("replay_rate", replay_rate_, 0.0);
+    private_nh.param("start_time", start_time_, 0.0);
+    private_nh.param("use_pcap_time", use_pcap_time_, false);
 
     if (read_once_)
       ROS_INFO("Read input file only once.");
@@ -223,9 +404,18 @@ namespace velodyne_driver
     if (repeat_delay_ > 0.0)
       ROS_INFO("Delay %.3f seconds before repeating input file.",
                repeat_delay_);
+    if (replay_rate_ > 0.0 && !read_fast_)
+      ROS_INFO("Replay input file at %.2f times its recorded rate.",
+               replay_rate_);
 
     // Open the PCAP dump file
     ROS_INFO("Opening PCAP file \"%s\"", filename_.c_str());
+    if (openIndex())
+      {
+        if (start_time_ > 0.0)
+          seek(start_time_);
+        return;
+      }
     if ((pcap_ = pcap_open_offline(filename_.c_str(), errbuf_) ) == NULL)
       {
         ROS_FATAL("Error opening Velodyne socket dump file.");
@@ -237,19 +427,215 @@ namespace velodyne_driver
   /** destructor */
   InputPCAP::~InputPCAP(void)
   {
-    pcap_close(pcap_);
+    if (map_ != NULL)
+      munmap((void *) map_, map_size_);
+    if (pcap_ != NULL)
+      pcap_close(pcap_);
   }
 
   void InputPCAP::setDeviceIP(const std::string &ip)
   {
+      devip_str_ = ip;
+      filter_ip_ = !ip.empty() && inet_aton(ip.c_str(), &devip_) != 0;
+      if (pcap_ == NULL)                // indexed file, filtered on replay
+        return;
+
       std::string filter_str = "src host " + devip_str_ + " && udp src port 2368 && udp dst port 2368";
       if( devip_str_ != "" )
         pcap_compile(pcap_, &velodyne_pointdata_filter_, filter_str.c_str(), 1, PCAP_NETMASK_UNKNOWN);
   }
 
+  /** @brief Memory-map a classic pcap file and index its Velodyne packets.
+   *
+   *  @returns false if the file cannot be mapped, is not a classic
+   *           Ethernet pcap file or holds no Velodyne data packets
+   */
+  bool InputPCAP::openIndex(void)
+  {
+    int fd = open(filename_.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= pcap_file_header_size)
+      addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (addr == MAP_FAILED)
+      return false;
+
+    map_ = (const uint8_t *) addr;
+    map_size_ = st.st_size;
+    madvise(addr, map_size_, MADV_SEQUENTIAL);
+
+    uint32_t magic;
+    memcpy(&magic, map_, sizeof(magic));
+    bool valid = true;
+    switch (magic)
+      {
+      case 0xa1b2c3d4: swapped_ = false; ts_scale_ = 1e-6; break;
+      case 0xd4c3b2a1: swapped_ = true;  ts_scale_ = 1e-6; break;
+      case 0xa1b23c4d: swapped_ = false; ts_scale_ = 1e-9; break;
+      case 0x4d3cb2a1: swapped_ = true;  ts_scale_ = 1e-9; break;
+      default: valid = false;           // pcapng, or not a capture
+      }
+    if (valid && load32(map_ + 20, swapped_) != pcap_linktype_ethernet)
+      valid = false;
+
+    // Index every IPv4 UDP frame to the data port carrying exactly one
+    // data packet, which skips position packets and other traffic.
+    size_t offset = pcap_file_header_size;
+    while (valid && offset + pcap_record_header_size <= map_size_)
+      {
+        const uint8_t *frame = map_ + offset + pcap_record_header_size;
+        uint32_t incl_len = load32(map_ + offset + 8, swapped_);
+        if (offset + pcap_record_header_size + incl_len > map_size_)
+          break;                        // truncated capture
+
+        size_t udp = incl_len > 14? 14 + (frame[14] & 0x0f) * 4: 0; // UDP header
+        if (incl_len >= 14 + 20 + 8
+            && frame[12] == 0x08 && frame[13] == 0x00   // IPv4
+            && (frame[14] >> 4) == 4
+            && frame[23] == IPPROTO_UDP
+            && incl_len == udp + 8 + packet_size
+            && ((frame[udp + 2] << 8) | frame[udp + 3]) == UDP_PORT_NUMBER)
+          records_.push_back(offset);
+
+        offset += pcap_record_header_size + incl_len;
+      }
+
+    if (records_.empty())
+      {
+        munmap(addr, map_size_);
+        map_ = NULL;
+        map_size_ = 0;
+        return false;
+      }
+
+    ROS_INFO("Indexed %lu Velodyne packets, %.1f seconds of data.",
+             (unsigned long) records_.size(),
+             packetTime(records_.size() - 1) - packetTime(0));
+    return true;
+  }
+
+  /** @brief Capture time of an indexed packet (s). */
+  double InputPCAP::packetTime(size_t index) const
+  {
+    const uint8_t *record = map_ + records_[index];
+    return load32(record, swapped_) + load32(record + 4, swapped_) * ts_scale_;
+  }
+
+  /** @brief Start replay at offset seconds into the file (start_time).
+   *
+   *  Looping replays also restart here.
+   */
+  bool InputPCAP::seek(double offset)
+  {
+    if (map_ == NULL)
+      return false;
+
+    // first packet captured at or after the requested time
+    double target = packetTime(0) + offset;
+    size_t lo = 0, hi = records_.size();
+    while (lo < hi)
+      {
+        size_t mid = lo + (hi - lo) / 2;
+        if (packetTime(mid) < target)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+    if (lo == records_.size())
+      {
+        ROS_WARN("Start time %.3f is past the end of the input file.", offset);
+        lo = 0;
+      }
+
+    start_index_ = next_ = lo;
+    pcap_origin_ = -1.0;                // resynchronize pacing
+    return true;
+  }
+
+  /** @brief Get one velodyne packet from the indexed file. */
+  int InputPCAP::getIndexedPacket(velodyne_msgs::VelodynePacket *pkt)
+  {
+    while (true)
+      {
+        while (next_ < records_.size())
+          {
+            size_t index = next_++;
+            const uint8_t *record = map_ + records_[index];
+            const uint8_t *frame = record + pcap_record_header_size;
+            uint32_t incl_len = load32(record + 8, swapped_);
+
+            // if packet is not from the lidar scanner we selected by IP, continue
+            if (filter_ip_ && memcmp(frame + 26, &devip_.s_addr, 4) != 0)
+              continue;
+
+            double pcap_time = packetTime(index);
+            if (read_fast_)
+              ;                         // no pacing
+            else if (replay_rate_ > 0.0)
+              {
+                // Follow the capture timestamps, scaled by replay_rate.
+                if (pcap_origin_ < 0.0)
+                  {
+                    pcap_origin_ = pcap_time;
+                    wall_origin_ = ros::WallTime::now();
+                  }
+                ros::WallTime due = wall_origin_
+                  + ros::WallDuration((pcap_time - pcap_origin_) / replay_rate_);
+                ros::WallDuration wait = due - ros::WallTime::now();
+                if (wait > ros::WallDuration(0.0))
+                  wait.sleep();
+              }
+            else
+              {
+                // Keep the reader from blowing through the file.
+                packet_rate_.sleep();
+              }
+
+            memcpy(&pkt->data[0], frame + incl_len - packet_size, packet_size);
+            pkt->stamp = use_pcap_time_? ros::Time(pcap_time): ros::Time::now();
+            empty_ = false;
+            return 0;                   // success
+          }
+
+        if (empty_)                     // no data from this device?
+          {
+            ROS_WARN("No Velodyne packets from %s in input file.",
+                     devip_str_.c_str());
+            return -1;
+          }
+
+        if (read_once_)
+          {
+            ROS_INFO("end of file reached -- done reading.");
+            return -1;
+          }
+
+        if (repeat_delay_ > 0.0)
+          {
+            ROS_INFO("end of file reached -- delaying %.3f seconds.",
+                     repeat_delay_);
+            usleep(rint(repeat_delay_ * 1000000.0));
+          }
+
+        ROS_DEBUG("replaying Velodyne dump file");
+
+        // Every loop replays the same packets from the same start.
+        next_ = start_index_;
+        pcap_origin_ = -1.0;
+        empty_ = true;
+      } // loop back and try again
+  }
+
   /** @brief Get one velodyne packet. */
   int InputPCAP::getPacket(velodyne_msgs::VelodynePacket *pkt)
   {
+    if (map_ != NULL)
+      return getIndexedPacket(pkt);
+
     struct pcap_pkthdr *header;
     const u_char *pkt_data;
 
@@ -138,6 +138,17 @@ namespace velodyne_rawdata
     int setup(ros::NodeHandle private_nh);
 
     void unpack(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
+
+    /** \brief Convert a whole scan to a point cloud.
+     *
+     *  Gives the same points as calling unpack() for each packet, but
+     *  the cloud is grown once per scan and HDL-32E/64E blocks are
+     *  converted for all 32 lasers at a time with SIMD.
+     *
+     *  @param scan raw scan to unpack
+     *  @param pc point cloud (points are appended)
+     */
+    void unpackScan(const velodyne_msgs::VelodyneScan &scan, VPointCloud &pc);
     
     void setParameters(double min_range, double max_range, double view_direction,
                        double view_width);
@@ -163,6 +174,48 @@ namespace velodyne_rawdata
     velodyne_pointcloud::Calibration calibration_;
     float sin_rot_table_[ROTATION_MAX_UNITS];
     float cos_rot_table_[ROTATION_MAX_UNITS];
+
+    /** Correction terms of each laser number, laid out for SIMD loads.
+     *  The two point correction is folded into a slope and an offset
+     *  that are zero for lasers without it. */
+    static const int MAX_LASERS = 64;
+    typedef struct {
+      float dist_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float cos_vert_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float sin_vert_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float cos_rot_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float sin_rot_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float horiz_offset_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float vert_offset_correction[MAX_LASERS] __attribute__ ((aligned (16)));
+      float two_pt_slope_x[MAX_LASERS] __attribute__ ((aligned (16)));
+      float two_pt_offset_x[MAX_LASERS] __attribute__ ((aligned (16)));
+      float two_pt_slope_y[MAX_LASERS] __attribute__ ((aligned (16)));
+      float two_pt_offset_y[MAX_LASERS] __attribute__ ((aligned (16)));
+      float min_intensity[MAX_LASERS] __attribute__ ((aligned (16)));
+      float max_intensity[MAX_LASERS] __attribute__ ((aligned (16)));
+      float focal_offset[MAX_LASERS] __attribute__ ((aligned (16)));
+      float focal_slope[MAX_LASERS] __attribute__ ((aligned (16)));
+      int laser_ring[MAX_LASERS];
+    } LaserTable;
+    LaserTable lasers_;
+
+    /** fill lasers_ from calibration_ */
+    void setupLaserTable();
+
+    /** in-line test whether a block is in the published angle range */
+    bool rotationInView(int rotation)
+    {
+      return ((rotation >= config_.min_angle
+               && rotation <= config_.max_angle
+               && config_.min_angle < config_.max_angle)
+              || (config_.min_angle > config_.max_angle
+                  && (rotation <= config_.max_angle
+                      || rotation >= config_.min_angle)));
+    }
+
+    /** convert one HDL-32E/64E block, in-range points are written to
+     *  points and counted in npoints */
+    void unpackBlock(const raw_block_t &block, VPoint *points, size_t &npoints);
     
     /** add private function to handle the VLP16 **/ 
     void unpack_vlp16(const velodyne_msgs::VelodynePacket &pkt, VPointCloud &pc);
@@ -66,11 +66,8 @@ namespace velodyne_pointcloud
     outMsg->header.frame_id = scanMsg->header.frame_id;
     outMsg->height = 1;
 
-    // process each packet provided by the driver
-    for (size_t i = 0; i < scanMsg->packets.size(); ++i)
-      {
-        data_->unpack(scanMsg->packets[i], *outMsg);
-      }
+    // process all packets provided by the driver at once
+    data_->unpackScan(*scanMsg, *outMsg);
 
     // publish the accumulated cloud message
     ROS_DEBUG_STREAM("Publishing " << outMsg->height * outMsg->width
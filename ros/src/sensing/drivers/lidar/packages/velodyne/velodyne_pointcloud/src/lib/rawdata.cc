@@ -25,6 +25,7 @@
  *  HDL-64E S2 calibration support provided by Nick Hillier
  */
 
+#include <cstring>
 #include <fstream>
 #include <math.h>
 
@@ -34,8 +35,62 @@
 
 #include <velodyne_pointcloud/rawdata.h>
 
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
 namespace velodyne_rawdata
 {
+  namespace
+  {
+#ifdef __SSE2__
+    /** Four float lanes held in one SSE register. */
+    struct Lanes
+    {
+      static const int SIZE = 4;
+
+      Lanes() {}
+      Lanes(__m128 x) : v(x) {}
+      explicit Lanes(float x) : v(_mm_set1_ps(x)) {}
+
+      static Lanes load(const float *p) { return Lanes(_mm_load_ps(p)); }
+      void store(float *p) const { _mm_store_ps(p, v); }
+
+      __m128 v;
+    };
+
+    inline Lanes operator+(const Lanes &a, const Lanes &b) { return Lanes(_mm_add_ps(a.v, b.v)); }
+    inline Lanes operator-(const Lanes &a, const Lanes &b) { return Lanes(_mm_sub_ps(a.v, b.v)); }
+    inline Lanes operator*(const Lanes &a, const Lanes &b) { return Lanes(_mm_mul_ps(a.v, b.v)); }
+    inline Lanes operator/(const Lanes &a, const Lanes &b) { return Lanes(_mm_div_ps(a.v, b.v)); }
+    inline Lanes absolute(const Lanes &a) { return Lanes(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+    inline Lanes maximum(const Lanes &a, const Lanes &b) { return Lanes(_mm_max_ps(a.v, b.v)); }
+    inline Lanes minimum(const Lanes &a, const Lanes &b) { return Lanes(_mm_min_ps(a.v, b.v)); }
+#else
+    /** Scalar fallback with the same interface. */
+    struct Lanes
+    {
+      static const int SIZE = 1;
+
+      Lanes() {}
+      explicit Lanes(float x) : v(x) {}
+
+      static Lanes load(const float *p) { return Lanes(*p); }
+      void store(float *p) const { *p = v; }
+
+      float v;
+    };
+
+    inline Lanes operator+(const Lanes &a, const Lanes &b) { return Lanes(a.v + b.v); }
+    inline Lanes operator-(const Lanes &a, const Lanes &b) { return Lanes(a.v - b.v); }
+    inline Lanes operator*(const Lanes &a, const Lanes &b) { return Lanes(a.v * b.v); }
+    inline Lanes operator/(const Lanes &a, const Lanes &b) { return Lanes(a.v / b.v); }
+    inline Lanes absolute(const Lanes &a) { return Lanes(fabsf(a.v)); }
+    inline Lanes maximum(const Lanes &a, const Lanes &b) { return Lanes(a.v < b.v ? b.v : a.v); }
+    inline Lanes minimum(const Lanes &a, const Lanes &b) { return Lanes(a.v > b.v ? b.v : a.v); }
+#endif
+  } // namespace
+
   ////////////////////////////////////////////////////////////////////////
   //
   // RawData base class implementation
@@ -103,9 +158,53 @@ namespace velodyne_rawdata
       cos_rot_table_[rot_index] = cosf(rotation);
       sin_rot_table_[rot_index] = sinf(rotation);
     }
+
+    setupLaserTable();
    return 0;
   }
 
+  /** Hoist the per-laser correction terms into lasers_. */
+  void RawData::setupLaserTable()
+  {
+    memset(&lasers_, 0, sizeof(lasers_));
+    for (int laser = 0; laser < MAX_LASERS; ++laser) {
+      std::map<int, velodyne_pointcloud::LaserCorrection>::const_iterator it =
+        calibration_.laser_corrections.find(laser);
+      if (it == calibration_.laser_corrections.end())
+        continue;
+      const velodyne_pointcloud::LaserCorrection &corrections = it->second;
+
+      lasers_.dist_correction[laser] = corrections.dist_correction;
+      lasers_.cos_vert_correction[laser] = corrections.cos_vert_correction;
+      lasers_.sin_vert_correction[laser] = corrections.sin_vert_correction;
+      lasers_.cos_rot_correction[laser] = corrections.cos_rot_correction;
+      lasers_.sin_rot_correction[laser] = corrections.sin_rot_correction;
+      lasers_.horiz_offset_correction[laser] = corrections.horiz_offset_correction;
+      lasers_.vert_offset_correction[laser] = corrections.vert_offset_correction;
+      if (corrections.two_pt_correction_available) {
+        // distance_corr = (dist_correction - dist_correction_x) * (xx - 2.4) / (25.04 - 2.4)
+        //                 + dist_correction_x - dist_correction
+        lasers_.two_pt_slope_x[laser] =
+          (corrections.dist_correction - corrections.dist_correction_x) / (25.04 - 2.4);
+        lasers_.two_pt_offset_x[laser] =
+          corrections.dist_correction_x - corrections.dist_correction
+          - 2.4 * lasers_.two_pt_slope_x[laser];
+        lasers_.two_pt_slope_y[laser] =
+          (corrections.dist_correction - corrections.dist_correction_y) / (25.04 - 1.93);
+        lasers_.two_pt_offset_y[laser] =
+          corrections.dist_correction_y - corrections.dist_correction
+          - 1.93 * lasers_.two_pt_slope_y[laser];
+      }
+      lasers_.min_intensity[laser] = corrections.min_intensity;
+      lasers_.max_intensity[laser] = corrections.max_intensity;
+      lasers_.focal_offset[laser] = 256
+                                  * (1 - corrections.focal_distance / 13100)
+                                  * (1 - corrections.focal_distance / 13100);
+      lasers_.focal_slope[laser] = corrections.focal_slope;
+      lasers_.laser_ring[laser] = corrections.laser_ring;
+    }
+  }
+
   /** @brief convert raw packet to point cloud
    *
    *  @param pkt raw packet to unpack
@@ -275,6 +374,136 @@ namespace velodyne_rawdata
     }
   }
   
+  /** @brief convert a whole raw scan to point cloud
+   *
+   *  @param scan raw scan to unpack
+   *  @param pc shared pointer to point cloud (points are appended)
+   */
+  void RawData::unpackScan(const velodyne_msgs::VelodyneScan &scan,
+                           VPointCloud &pc)
+  {
+    if (scan.packets.empty())
+      return;
+
+    if (calibration_.num_lasers == 16)
+    {
+      pc.points.reserve(pc.points.size() + scan.packets.size() * SCANS_PER_PACKET);
+      for (size_t i = 0; i < scan.packets.size(); ++i)
+        unpack_vlp16(scan.packets[i], pc);
+      return;
+    }
+
+    // Grow the cloud to the upper bound once and trim it afterwards
+    size_t npoints = pc.points.size();
+    pc.points.resize(npoints + scan.packets.size() * SCANS_PER_PACKET);
+    VPoint *points = &pc.points[0];
+    size_t start = npoints;
+
+    for (size_t i = 0; i < scan.packets.size(); ++i) {
+      const raw_packet_t *raw = (const raw_packet_t *) &scan.packets[i].data[0];
+      for (int j = 0; j < BLOCKS_PER_PACKET; j++) {
+        if (rotationInView(raw->blocks[j].rotation))
+          unpackBlock(raw->blocks[j], points, npoints);
+      }
+    }
+
+    pc.points.resize(npoints);
+    pc.width += npoints - start;
+  }
+
+  /** @brief convert one HDL-32E/64E block with SIMD over its lasers
+   *
+   *  Same arithmetic as unpack(), done on SCANS_PER_BLOCK lanes; the
+   *  range test and the output stay scalar.
+   */
+  void RawData::unpackBlock(const raw_block_t &block, VPoint *points,
+                            size_t &npoints)
+  {
+    // upper bank lasers are numbered [0..31], lower bank lasers [32..63]
+    int bank_origin = (block.header == LOWER_BANK) ? 32 : 0;
+
+    float raw_distance[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    float raw_intensity[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    for (int j = 0, k = 0; j < SCANS_PER_BLOCK; j++, k += RAW_SCAN_SIZE) {
+      union two_bytes tmp;
+      tmp.bytes[0] = block.data[k];
+      tmp.bytes[1] = block.data[k+1];
+      raw_distance[j] = tmp.uint;
+      raw_intensity[j] = block.data[k+2];
+    }
+
+    float distance[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    float x_coord[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    float y_coord[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    float z_coord[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+    float intensity[SCANS_PER_BLOCK] __attribute__ ((aligned (16)));
+
+    const Lanes cos_rot(cos_rot_table_[block.rotation]);
+    const Lanes sin_rot(sin_rot_table_[block.rotation]);
+    const Lanes zero(0.0f);
+
+    for (int j = 0; j < SCANS_PER_BLOCK; j += Lanes::SIZE) {
+      int laser = bank_origin + j;
+
+      Lanes d = Lanes::load(raw_distance + j) * Lanes(DISTANCE_RESOLUTION)
+        + Lanes::load(lasers_.dist_correction + laser);
+
+      Lanes cos_vert_angle = Lanes::load(lasers_.cos_vert_correction + laser);
+      Lanes sin_vert_angle = Lanes::load(lasers_.sin_vert_correction + laser);
+      Lanes cos_rot_correction = Lanes::load(lasers_.cos_rot_correction + laser);
+      Lanes sin_rot_correction = Lanes::load(lasers_.sin_rot_correction + laser);
+
+      // cos(a-b) = cos(a)*cos(b) + sin(a)*sin(b)
+      // sin(a-b) = sin(a)*cos(b) - cos(a)*sin(b)
+      Lanes cos_rot_angle = cos_rot * cos_rot_correction + sin_rot * sin_rot_correction;
+      Lanes sin_rot_angle = sin_rot * cos_rot_correction - cos_rot * sin_rot_correction;
+
+      Lanes horiz_offset = Lanes::load(lasers_.horiz_offset_correction + laser);
+      Lanes vert_offset = Lanes::load(lasers_.vert_offset_correction + laser);
+      Lanes vert_offset_xy = vert_offset * sin_vert_angle;
+
+      Lanes xy_distance = d * cos_vert_angle + vert_offset_xy;
+      Lanes xx = absolute(xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle);
+      Lanes yy = absolute(xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle);
+
+      // two point correction, zero slope and offset when not available
+      Lanes distance_x = d + xx * Lanes::load(lasers_.two_pt_slope_x + laser)
+        + Lanes::load(lasers_.two_pt_offset_x + laser);
+      Lanes distance_y = d + yy * Lanes::load(lasers_.two_pt_slope_y + laser)
+        + Lanes::load(lasers_.two_pt_offset_y + laser);
+
+      xy_distance = distance_x * cos_vert_angle + vert_offset_xy;
+      Lanes x = xy_distance * sin_rot_angle - horiz_offset * cos_rot_angle;
+      xy_distance = distance_y * cos_vert_angle + vert_offset_xy;
+      Lanes y = xy_distance * cos_rot_angle + horiz_offset * sin_rot_angle;
+      Lanes z = distance_y * sin_vert_angle + vert_offset * cos_vert_angle;
+
+      // Use standard ROS coordinate system (right-hand rule)
+      d.store(distance + j);
+      y.store(x_coord + j);
+      (zero - x).store(y_coord + j);
+      z.store(z_coord + j);
+
+      Lanes focal = Lanes(1.0f) - Lanes::load(raw_distance + j) / Lanes(65535.0f);
+      Lanes i = Lanes::load(raw_intensity + j) + Lanes::load(lasers_.focal_slope + laser)
+        * absolute(Lanes::load(lasers_.focal_offset + laser) - Lanes(256.0f) * focal * focal);
+      i = maximum(i, Lanes::load(lasers_.min_intensity + laser));
+      i = minimum(i, Lanes::load(lasers_.max_intensity + laser));
+      i.store(intensity + j);
+    }
+
+    for (int j = 0; j < SCANS_PER_BLOCK; j++) {
+      if (pointInRange(distance[j])) {
+        VPoint &point = points[npoints++];
+        point.ring = lasers_.laser_ring[bank_origin + j];
+        point.x = x_coord[j];
+        point.y = y_coord[j];
+        point.z = z_coord[j];
+        point.intensity = (uint8_t) intensity[j];
+      }
+    }
+  }
+
   /** @brief convert raw VLP16 packet to point cloud
    *
    *  @param pkt raw packet to unpack
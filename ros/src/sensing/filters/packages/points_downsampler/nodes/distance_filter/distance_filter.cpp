@@ -29,10 +29,10 @@
 */
 
 #include <ros/ros.h>
-#include <sensor_msgs/PointCloud2.h>
 
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl/filters/voxel_grid.h>
 
 #include <runtime_manager/ConfigDistanceFilter.h>
@@ -41,7 +41,12 @@
 
 #include <chrono>
 
-ros::Publisher filtered_points_pub;
+#ifdef POINTS_DOWNSAMPLER_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
+static ros::Publisher filtered_points_pub;
 
 static int sample_num = 1000;
 
@@ -56,17 +61,18 @@ static std::string filename;
 
 static std::string POINTS_TOPIC;
 
+static ros::Subscriber config_sub;
+static ros::Subscriber scan_sub;
+
 static void config_callback(const runtime_manager::ConfigDistanceFilter::ConstPtr& input)
 {
   sample_num = input->sample_num;
 }
 
-static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
+static void scan_callback(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& input)
 {
   pcl::PointXYZI sampled_p;
-  pcl::PointCloud<pcl::PointXYZI> scan;
-
-  pcl::fromROSMsg(*input, scan);
+  const pcl::PointCloud<pcl::PointXYZI>& scan = *input;
   pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
   filtered_scan_ptr->header = scan.header;
 
@@ -100,15 +106,11 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     filtered_scan_ptr->points.push_back(sampled_p);
   }
 
-  sensor_msgs::PointCloud2 filtered_msg;
-  pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
-
   filter_end = std::chrono::system_clock::now();
 
-  filtered_msg.header = input->header;
-  filtered_points_pub.publish(filtered_msg);
+  filtered_points_pub.publish(filtered_scan_ptr);
 
-  points_downsampler_info_msg.header = input->header;
+  points_downsampler_info_msg.header = pcl_conversions::fromPCL(input->header);
   points_downsampler_info_msg.filter_name = "distance_filter";
   points_downsampler_info_msg.original_points_size = points_num;
   points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
@@ -136,13 +138,8 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
 }
 
-int main(int argc, char** argv)
+static void setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "distance_filter");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   private_nh.getParam("points_topic", POINTS_TOPIC);
   private_nh.getParam("output_log", _output_log);
   if(_output_log == true){
@@ -155,14 +152,41 @@ int main(int argc, char** argv)
   }
 
   // Publishers
-  filtered_points_pub = nh.advertise<sensor_msgs::PointCloud2>("/filtered_points", 10);
+  filtered_points_pub = nh.advertise<pcl::PointCloud<pcl::PointXYZI> >("/filtered_points", 10);
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
 
   // Subscribers
-  ros::Subscriber config_sub = nh.subscribe("config/distance_filter", 10, config_callback);
-  ros::Subscriber scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+  config_sub = nh.subscribe("config/distance_filter", 10, config_callback);
+  scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+}
+
+#ifdef POINTS_DOWNSAMPLER_NODELET
+namespace points_downsampler
+{
+// Filter state is file-static, so load at most one instance per manager.
+class DistanceFilterNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    setup(getNodeHandle(), getPrivateNodeHandle());
+  }
+};
+}  // namespace points_downsampler
+
+PLUGINLIB_EXPORT_CLASS(points_downsampler::DistanceFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "distance_filter");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  setup(nh, private_nh);
 
   ros::spin();
 
   return 0;
 }
+#endif
@@ -29,10 +29,10 @@
 */
 
 #include <ros/ros.h>
-#include <sensor_msgs/PointCloud2.h>
 
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl/filters/voxel_grid.h>
 
 #include <velodyne_pointcloud/point_types.h>
@@ -43,13 +43,18 @@
 
 #include <chrono>
 
-ros::Publisher filtered_points_pub;
+#ifdef POINTS_DOWNSAMPLER_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
+static ros::Publisher filtered_points_pub;
 
 // Leaf size of VoxelGrid filter.
 static double voxel_leaf_size = 2.0;
 
-int ring_max = 0;
-int ring_div = 3;
+static int ring_max = 0;
+static int ring_div = 3;
 
 static ros::Publisher points_downsampler_info_pub;
 static points_downsampler::PointsDownsamplerInfo points_downsampler_info_msg;
@@ -62,27 +67,26 @@ static std::string filename;
 
 static std::string POINTS_TOPIC;
 
+static ros::Subscriber config_sub;
+static ros::Subscriber scan_sub;
+
 static void config_callback(const runtime_manager::ConfigRingFilter::ConstPtr& input)
 {
   ring_div = input->ring_div;
   voxel_leaf_size = input->voxel_leaf_size;
 }
 
-static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
+static void scan_callback(const pcl::PointCloud<velodyne_pointcloud::PointXYZIR>::ConstPtr& input)
 {
   pcl::PointXYZI p;
-  pcl::PointCloud<pcl::PointXYZI> scan;
-  pcl::PointCloud<velodyne_pointcloud::PointXYZIR> tmp;
-  sensor_msgs::PointCloud2 filtered_msg;
-
-  pcl::fromROSMsg(*input, scan);
-  pcl::fromROSMsg(*input, tmp);
+  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
+  pcl::PointCloud<pcl::PointXYZI>& scan = *scan_ptr;
 
   filter_start = std::chrono::system_clock::now();
 
-  scan.points.clear();
+  scan.points.reserve(input->size());
 
-  for (pcl::PointCloud<velodyne_pointcloud::PointXYZIR>::const_iterator item = tmp.begin(); item != tmp.end(); item++)
+  for (pcl::PointCloud<velodyne_pointcloud::PointXYZIR>::const_iterator item = input->begin(); item != input->end(); item++)
   {
     p.x = (double)item->x;
     p.y = (double)item->y;
@@ -98,7 +102,9 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     }
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
+  scan.width = scan.points.size();
+  scan.height = 1;
+
   pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
 
   // if voxel_leaf_size < 0.1 voxel_grid_filter cannot down sample (It is specification in PCL)
@@ -109,30 +115,21 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     voxel_grid_filter.setLeafSize(voxel_leaf_size, voxel_leaf_size, voxel_leaf_size);
     voxel_grid_filter.setInputCloud(scan_ptr);
     voxel_grid_filter.filter(*filtered_scan_ptr);
-
-    pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
   }
   else
   {
-    pcl::toROSMsg(*scan_ptr, filtered_msg);
+    filtered_scan_ptr = scan_ptr;
   }
 
   filter_end = std::chrono::system_clock::now();
 
-  filtered_msg.header = input->header;
-  filtered_points_pub.publish(filtered_msg);
+  filtered_scan_ptr->header = input->header;
+  filtered_points_pub.publish(filtered_scan_ptr);
 
-  points_downsampler_info_msg.header = input->header;
+  points_downsampler_info_msg.header = pcl_conversions::fromPCL(input->header);
   points_downsampler_info_msg.filter_name = "ring_filter";
   points_downsampler_info_msg.original_points_size = scan.size();
-  if (voxel_leaf_size >= 0.1)
-  {
-    points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
-  }
-  else
-  {
-    points_downsampler_info_msg.filtered_points_size = scan_ptr->size();
-  }
+  points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
   points_downsampler_info_msg.original_ring_size = ring_max;
   points_downsampler_info_msg.filtered_ring_size = ring_max / ring_div;
   points_downsampler_info_msg.exe_time = std::chrono::duration_cast<std::chrono::microseconds>(filter_end - filter_start).count() / 1000.0;
@@ -157,13 +154,8 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
 }
 
-int main(int argc, char** argv)
+static void setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "ring_filter");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   private_nh.getParam("points_topic", POINTS_TOPIC);
   private_nh.getParam("output_log", _output_log);
   if(_output_log == true){
@@ -176,14 +168,41 @@ int main(int argc, char** argv)
   }
 
   // Publishers
-  filtered_points_pub = nh.advertise<sensor_msgs::PointCloud2>("/filtered_points", 10);
+  filtered_points_pub = nh.advertise<pcl::PointCloud<pcl::PointXYZI> >("/filtered_points", 10);
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
 
   // Subscribers
-  ros::Subscriber config_sub = nh.subscribe("config/ring_filter", 10, config_callback);
-  ros::Subscriber scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+  config_sub = nh.subscribe("config/ring_filter", 10, config_callback);
+  scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+}
+
+#ifdef POINTS_DOWNSAMPLER_NODELET
+namespace points_downsampler
+{
+// Filter state is file-static, so load at most one instance per manager.
+class RingFilterNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    setup(getNodeHandle(), getPrivateNodeHandle());
+  }
+};
+}  // namespace points_downsampler
+
+PLUGINLIB_EXPORT_CLASS(points_downsampler::RingFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "ring_filter");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  setup(nh, private_nh);
 
   ros::spin();
 
   return 0;
 }
+#endif
@@ -29,10 +29,10 @@
 */
 
 #include <ros/ros.h>
-#include <sensor_msgs/PointCloud2.h>
 
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
 #include <pcl/filters/voxel_grid.h>
 
 #include <runtime_manager/ConfigVoxelGridFilter.h>
@@ -41,7 +41,12 @@
 
 #include <chrono>
 
-ros::Publisher filtered_points_pub;
+#ifdef POINTS_DOWNSAMPLER_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
+static ros::Publisher filtered_points_pub;
 
 // Leaf size of VoxelGrid filter.
 static double voxel_leaf_size = 2.0;
@@ -57,20 +62,18 @@ static std::string filename;
 
 static std::string POINTS_TOPIC;
 
+static ros::Subscriber config_sub;
+static ros::Subscriber scan_sub;
+
 static void config_callback(const runtime_manager::ConfigVoxelGridFilter::ConstPtr& input)
 {
   voxel_leaf_size = input->voxel_leaf_size;
 }
 
-static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
+static void scan_callback(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& input)
 {
-  pcl::PointCloud<pcl::PointXYZI> scan;
-  pcl::fromROSMsg(*input, scan);
-  pcl::PointCloud<pcl::PointXYZI>::Ptr scan_ptr(new pcl::PointCloud<pcl::PointXYZI>(scan));
   pcl::PointCloud<pcl::PointXYZI>::Ptr filtered_scan_ptr(new pcl::PointCloud<pcl::PointXYZI>());
 
-  sensor_msgs::PointCloud2 filtered_msg;
-
   filter_start = std::chrono::system_clock::now();
 
   // if voxel_leaf_size < 0.1 voxel_grid_filter cannot down sample (It is specification in PCL)
@@ -79,32 +82,23 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
     // Downsampling the velodyne scan using VoxelGrid filter
     pcl::VoxelGrid<pcl::PointXYZI> voxel_grid_filter;
     voxel_grid_filter.setLeafSize(voxel_leaf_size, voxel_leaf_size, voxel_leaf_size);
-    voxel_grid_filter.setInputCloud(scan_ptr);
+    voxel_grid_filter.setInputCloud(input);
     voxel_grid_filter.filter(*filtered_scan_ptr);
-
-    pcl::toROSMsg(*filtered_scan_ptr, filtered_msg);
   }
   else
   {
-    pcl::toROSMsg(*scan_ptr, filtered_msg);
+    *filtered_scan_ptr = *input;
   }
 
   filter_end = std::chrono::system_clock::now();
 
-  filtered_msg.header = input->header;
-  filtered_points_pub.publish(filtered_msg);
+  filtered_scan_ptr->header = input->header;
+  filtered_points_pub.publish(filtered_scan_ptr);
 
-  points_downsampler_info_msg.header = input->header;
+  points_downsampler_info_msg.header = pcl_conversions::fromPCL(input->header);
   points_downsampler_info_msg.filter_name = "voxel_grid_filter";
-  points_downsampler_info_msg.original_points_size = scan.size();
-  if (voxel_leaf_size >= 0.1)
-  {
-    points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
-  }
-  else
-  {
-    points_downsampler_info_msg.filtered_points_size = scan_ptr->size();
-  }
+  points_downsampler_info_msg.original_points_size = input->size();
+  points_downsampler_info_msg.filtered_points_size = filtered_scan_ptr->size();
   points_downsampler_info_msg.original_ring_size = 0;
   points_downsampler_info_msg.filtered_ring_size = 0;
   points_downsampler_info_msg.exe_time = std::chrono::duration_cast<std::chrono::microseconds>(filter_end - filter_start).count() / 1000.0;
@@ -129,13 +123,8 @@ static void scan_callback(const sensor_msgs::PointCloud2::ConstPtr& input)
 
 }
 
-int main(int argc, char** argv)
+static void setup(ros::NodeHandle& nh, ros::NodeHandle& private_nh)
 {
-  ros::init(argc, argv, "voxel_grid_filter");
-
-  ros::NodeHandle nh;
-  ros::NodeHandle private_nh("~");
-
   private_nh.getParam("points_topic", POINTS_TOPIC);
   private_nh.getParam("output_log", _output_log);
   if(_output_log == true){
@@ -148,14 +137,41 @@ int main(int argc, char** argv)
   }
 
   // Publishers
-  filtered_points_pub = nh.advertise<sensor_msgs::PointCloud2>("/filtered_points", 10);
+  filtered_points_pub = nh.advertise<pcl::PointCloud<pcl::PointXYZI> >("/filtered_points", 10);
   points_downsampler_info_pub = nh.advertise<points_downsampler::PointsDownsamplerInfo>("/points_downsampler_info", 1000);
 
   // Subscribers
-  ros::Subscriber config_sub = nh.subscribe("config/voxel_grid_filter", 10, config_callback);
-  ros::Subscriber scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+  config_sub = nh.subscribe("config/voxel_grid_filter", 10, config_callback);
+  scan_sub = nh.subscribe(POINTS_TOPIC, 10, scan_callback);
+}
+
+#ifdef POINTS_DOWNSAMPLER_NODELET
+namespace points_downsampler
+{
+// Filter state is file-static, so load at most one instance per manager.
+class VoxelGridFilterNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    setup(getNodeHandle(), getPrivateNodeHandle());
+  }
+};
+}  // namespace points_downsampler
+
+PLUGINLIB_EXPORT_CLASS(points_downsampler::VoxelGridFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "voxel_grid_filter");
+
+  ros::NodeHandle nh;
+  ros::NodeHandle private_nh("~");
+
+  setup(nh, private_nh);
 
   ros::spin();
 
   return 0;
 }
+#endif
@@ -11,12 +11,17 @@
 #include <sensor_msgs/point_cloud_conversion.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <pcl_ros/point_cloud.h>
 
+#ifdef POINTS_PREPROCESSOR_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
 
 class GroundFilter
 {
 public:
-	GroundFilter();
+	explicit GroundFilter(const ros::NodeHandle& in_private_handle = ros::NodeHandle("~"));
 
 private:
 
@@ -33,8 +38,8 @@ private:
 	double 			angle_threshold_;
 
 
-	void VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr);
-	void RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+	void VelodyneCallback(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& in_sensor_cloud_ptr);
+	void RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 				pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr,
 				pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr,
 				float in_max_height,
@@ -42,8 +47,8 @@ private:
 
 };
 
-GroundFilter::GroundFilter() :
-		node_handle_("~")
+GroundFilter::GroundFilter(const ros::NodeHandle& in_private_handle) :
+		node_handle_(in_private_handle)
 {
 
 	node_handle_.param<std::string>("subscribe_topic",  subscribe_topic_,  "/points_clipped");
@@ -53,11 +58,11 @@ GroundFilter::GroundFilter() :
 	node_handle_.param("angle_threshold",  angle_threshold_,  0.35);
 
 	cloud_sub_ = node_handle_.subscribe(subscribe_topic_, 10, &GroundFilter::VelodyneCallback, this);
-	cloud_lanes_pub_ = node_handle_.advertise<sensor_msgs::PointCloud2>( "/points_lanes", 10);
-	cloud_ground_pub_ = node_handle_.advertise<sensor_msgs::PointCloud2>( "/points_ground", 10);
+	cloud_lanes_pub_ = node_handle_.advertise<pcl::PointCloud<pcl::PointXYZ> >( "/points_lanes", 10);
+	cloud_ground_pub_ = node_handle_.advertise<pcl::PointCloud<pcl::PointXYZ> >( "/points_ground", 10);
 }
 
-void GroundFilter::RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+void GroundFilter::RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 		pcl::PointCloud<pcl::PointXYZ>::Ptr out_nofloor_cloud_ptr,
 		pcl::PointCloud<pcl::PointXYZ>::Ptr out_onlyfloor_cloud_ptr,
 		float in_max_distance,
@@ -95,36 +100,41 @@ void GroundFilter::RemoveFloor(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_clou
 	extract.filter(*out_onlyfloor_cloud_ptr);
 }
 
-void GroundFilter::VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr)
+void GroundFilter::VelodyneCallback(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& in_sensor_cloud_ptr)
 {
-	pcl::PointCloud<pcl::PointXYZ>::Ptr current_sensor_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
 	pcl::PointCloud<pcl::PointXYZ>::Ptr ground_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
 	pcl::PointCloud<pcl::PointXYZ>::Ptr lanes_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr output_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
 
-	pcl::fromROSMsg(*in_sensor_cloud_ptr, *current_sensor_cloud_ptr);
-
-
-	RemoveFloor(current_sensor_cloud_ptr, lanes_cloud_ptr, ground_cloud_ptr, points_distance_, angle_threshold_);
+	RemoveFloor(in_sensor_cloud_ptr, lanes_cloud_ptr, ground_cloud_ptr, points_distance_, angle_threshold_);
 
 	if (!floor_removal_)
-		output_cloud_ptr = current_sensor_cloud_ptr;
-	else
-		output_cloud_ptr = lanes_cloud_ptr;
+		*lanes_cloud_ptr = *in_sensor_cloud_ptr;
 
-	sensor_msgs::PointCloud2 cloud_ground_msg;
-	sensor_msgs::PointCloud2 cloud_output_msg;
+	//published by pointer, shared with subscribers in the same nodelet manager
+	ground_cloud_ptr->header=in_sensor_cloud_ptr->header;
+	cloud_ground_pub_.publish(ground_cloud_ptr);
 
-	pcl::toROSMsg(*ground_cloud_ptr, cloud_ground_msg);
-	pcl::toROSMsg(*output_cloud_ptr, cloud_output_msg);
+	lanes_cloud_ptr->header=in_sensor_cloud_ptr->header;
+	cloud_lanes_pub_.publish(lanes_cloud_ptr);
+}
 
-	cloud_ground_msg.header=in_sensor_cloud_ptr->header;
-	cloud_ground_pub_.publish(cloud_ground_msg);
+#ifdef POINTS_PREPROCESSOR_NODELET
+namespace points_preprocessor
+{
+class GroundFilterNodelet : public nodelet::Nodelet
+{
+private:
+	virtual void onInit()
+	{
+		filter_.reset(new GroundFilter(getPrivateNodeHandle()));
+	}
 
-	cloud_output_msg.header=in_sensor_cloud_ptr->header;
-	cloud_lanes_pub_.publish(cloud_output_msg);
+	boost::shared_ptr<GroundFilter> filter_;
+};
 }
 
+PLUGINLIB_EXPORT_CLASS(points_preprocessor::GroundFilterNodelet, nodelet::Nodelet)
+#else
 int main(int argc, char **argv)
 {
 
@@ -134,7 +144,4 @@ int main(int argc, char **argv)
 
 	return 0;
 }
-
-
-
-
+#endif
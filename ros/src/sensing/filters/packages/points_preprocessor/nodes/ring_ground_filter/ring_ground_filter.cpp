@@ -0,0 +1,303 @@
+/*
+ * ring_ground_filter.cpp
+ *
+ * Scan-line ground segmentation on the ring field of velodyne_pointcloud.
+ * Instead of fitting one plane per frame, points are binned into azimuth
+ * columns and classified by the slope to the last ground point on the
+ * previous (lower) rings of the same column, then checked against their
+ * neighbors along the ring. Every pass is linear in the number of points
+ * and the columns are split into sectors processed in parallel.
+ */
+#include <ros/ros.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl_ros/point_cloud.h>
+#include <velodyne_pointcloud/point_types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef POINTS_PREPROCESSOR_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
+
+typedef velodyne_pointcloud::PointXYZIR RingPoint;
+typedef pcl::PointCloud<RingPoint> RingCloud;
+
+class RingGroundFilter
+{
+public:
+	explicit RingGroundFilter(const ros::NodeHandle& in_private_handle = ros::NodeHandle("~"));
+
+private:
+
+	enum Label
+	{
+		LABEL_INVALID = 0,
+		LABEL_GROUND,
+		LABEL_OBSTACLE
+	};
+
+	ros::NodeHandle node_handle_;
+	ros::Subscriber cloud_sub_;
+	ros::Publisher 	cloud_lanes_pub_;
+	ros::Publisher 	cloud_ground_pub_;
+
+	std::string 	subscribe_topic_;
+
+	double 			sensor_height_;
+	double 			max_slope_;
+	double 			height_tolerance_;
+	double 			angular_resolution_;
+	int 			thread_count_;
+
+	//per frame buffers, kept between callbacks to avoid reallocation
+	std::vector<int> 			cell_start_;
+	std::vector<int> 			cell_points_;
+	std::vector<unsigned char> 	labels_;
+	std::vector<unsigned char> 	cell_label_;
+	std::vector<float> 			cell_z_;
+
+	void VelodyneCallback(const RingCloud::ConstPtr& in_sensor_cloud_ptr);
+	void ClassifyColumns(const RingCloud& in_cloud, int in_rings, int in_begin, int in_end);
+	void SmoothRings(const RingCloud& in_cloud, int in_columns, int in_rings, int in_begin, int in_end);
+
+	template <typename Function>
+	void ForEachSector(int in_columns, Function in_function);
+};
+
+RingGroundFilter::RingGroundFilter(const ros::NodeHandle& in_private_handle) :
+		node_handle_(in_private_handle)
+{
+	node_handle_.param<std::string>("subscribe_topic",  subscribe_topic_,  "/points_raw");
+
+	node_handle_.param("sensor_height",  sensor_height_,  1.8);
+	node_handle_.param("max_slope",  max_slope_,  10.0);//degrees
+	node_handle_.param("height_tolerance",  height_tolerance_,  0.15);
+	node_handle_.param("angular_resolution",  angular_resolution_,  0.4);//degrees, no finer than the sensor
+	int default_threads = 1;
+#ifdef _OPENMP
+	default_threads = omp_get_max_threads();
+#endif
+	node_handle_.param("threads",  thread_count_,  default_threads);
+
+	if (angular_resolution_ <= 0.)
+		angular_resolution_ = 0.4;
+	if (thread_count_ < 1)
+		thread_count_ = 1;
+
+	cloud_sub_ = node_handle_.subscribe(subscribe_topic_, 10, &RingGroundFilter::VelodyneCallback, this);
+	cloud_lanes_pub_ = node_handle_.advertise<RingCloud>( "/points_lanes", 10);
+	cloud_ground_pub_ = node_handle_.advertise<RingCloud>( "/points_ground", 10);
+}
+
+template <typename Function>
+void RingGroundFilter::ForEachSector(int in_columns, Function in_function)
+{
+	int sectors = std::min(thread_count_, in_columns);
+
+	//the OpenMP team is kept between frames, so no thread is started per callback
+#pragma omp parallel for num_threads(sectors) schedule(static)
+	for (int i = 0; i < sectors; i++)
+		in_function(in_columns * i / sectors, in_columns * (i + 1) / sectors);
+}
+
+/*
+ * Walks each column from the lowest ring outwards. A point is ground when the
+ * rise from the last ground point of the column stays within max_slope (plus
+ * a fixed tolerance for sensor noise); the column starts at the ground under
+ * the sensor. Obstacles do not move the reference, so ground seen behind a
+ * car is still compared against the road in front of it.
+ */
+void RingGroundFilter::ClassifyColumns(const RingCloud& in_cloud, int in_rings, int in_begin, int in_end)
+{
+	const float tan_slope = std::tan(max_slope_ * M_PI / 180.);
+	const float tolerance = height_tolerance_;
+
+	for (int column = in_begin; column < in_end; column++)
+	{
+		float ref_range = 0.f;
+		float ref_z = -sensor_height_;
+
+		for (int ring = 0; ring < in_rings; ring++)
+		{
+			int cell = column * in_rings + ring;
+			cell_label_[cell] = LABEL_INVALID;
+
+			for (int k = cell_start_[cell]; k < cell_start_[cell + 1]; k++)
+			{
+				int index = cell_points_[k];
+				const RingPoint& point = in_cloud.points[index];
+
+				float range = std::sqrt(point.x * point.x + point.y * point.y);
+				float rise = std::fabs(point.z - ref_z);
+				float run = std::max(range - ref_range, 0.f);
+
+				if (rise <= tolerance + run * tan_slope)
+				{
+					labels_[index] = LABEL_GROUND;
+					ref_range = range;
+					ref_z = point.z;
+				}
+				else
+					labels_[index] = LABEL_OBSTACLE;
+
+				if (cell_label_[cell] == LABEL_INVALID)
+				{
+					cell_label_[cell] = labels_[index];
+					cell_z_[cell] = point.z;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Checks every point against the cells on either side of it along the same
+ * ring. When both neighbors agree with each other, disagree with the point
+ * and sit at its height, the point takes their label. This removes isolated
+ * ground holes in obstacles and single obstacle spikes on the road.
+ */
+void RingGroundFilter::SmoothRings(const RingCloud& in_cloud, int in_columns, int in_rings, int in_begin, int in_end)
+{
+	const float tolerance = height_tolerance_;
+
+	for (int column = in_begin; column < in_end; column++)
+	{
+		int left = (column + in_columns - 1) % in_columns;
+		int right = (column + 1) % in_columns;
+
+		for (int ring = 0; ring < in_rings; ring++)
+		{
+			int cell = column * in_rings + ring;
+			int left_cell = left * in_rings + ring;
+			int right_cell = right * in_rings + ring;
+
+			unsigned char neighbor_label = cell_label_[left_cell];
+			if (neighbor_label == LABEL_INVALID || neighbor_label != cell_label_[right_cell])
+				continue;
+
+			for (int k = cell_start_[cell]; k < cell_start_[cell + 1]; k++)
+			{
+				int index = cell_points_[k];
+				float z = in_cloud.points[index].z;
+
+				if (labels_[index] != neighbor_label
+					&& std::fabs(z - cell_z_[left_cell]) <= tolerance
+					&& std::fabs(z - cell_z_[right_cell]) <= tolerance)
+				{
+					labels_[index] = neighbor_label;
+				}
+			}
+		}
+	}
+}
+
+void RingGroundFilter::VelodyneCallback(const RingCloud::ConstPtr& in_sensor_cloud_ptr)
+{
+	const RingCloud& cloud = *in_sensor_cloud_ptr;
+	const int point_count = cloud.points.size();
+
+	int rings = 0;
+	for (int i = 0; i < point_count; i++)
+		rings = std::max(rings, (int)cloud.points[i].ring + 1);
+
+	const int columns = std::max(1, (int)std::ceil(360. / angular_resolution_));
+	const int cells = columns * rings;
+	const double column_scale = columns / (2. * M_PI);
+
+	//counting sort of the points into (column, ring) cells
+	std::vector<int> point_cell(point_count, -1);
+	cell_start_.assign(cells + 1, 0);
+	for (int i = 0; i < point_count; i++)
+	{
+		const RingPoint& point = cloud.points[i];
+		if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+			continue;
+
+		int column = (int)((std::atan2(point.y, point.x) + M_PI) * column_scale);
+		if (column >= columns)
+			column = columns - 1;
+
+		point_cell[i] = column * rings + point.ring;
+		cell_start_[point_cell[i] + 1]++;
+	}
+	for (int cell = 0; cell < cells; cell++)
+		cell_start_[cell + 1] += cell_start_[cell];
+
+	cell_points_.resize(cell_start_[cells]);
+	{
+		std::vector<int> cursor(cell_start_.begin(), cell_start_.end() - 1);
+		for (int i = 0; i < point_count; i++)
+			if (point_cell[i] >= 0)
+				cell_points_[cursor[point_cell[i]]++] = i;
+	}
+
+	labels_.assign(point_count, LABEL_INVALID);
+	cell_label_.resize(cells);
+	cell_z_.resize(cells);
+
+	//the second pass reads the cell summaries of the first, so the sectors meet in between
+	ForEachSector(columns, [&](int in_begin, int in_end) { ClassifyColumns(cloud, rings, in_begin, in_end); });
+	ForEachSector(columns, [&](int in_begin, int in_end) { SmoothRings(cloud, columns, rings, in_begin, in_end); });
+
+	RingCloud::Ptr ground_cloud_ptr (new RingCloud);
+	RingCloud::Ptr lanes_cloud_ptr (new RingCloud);
+	ground_cloud_ptr->points.reserve(point_count);
+	lanes_cloud_ptr->points.reserve(point_count);
+
+	//as in ground_filter, every point that is not ground goes to the lanes, NaN returns included
+	for (int i = 0; i < point_count; i++)
+	{
+		if (labels_[i] == LABEL_GROUND)
+			ground_cloud_ptr->points.push_back(cloud.points[i]);
+		else
+			lanes_cloud_ptr->points.push_back(cloud.points[i]);
+	}
+
+	ground_cloud_ptr->width = ground_cloud_ptr->points.size();
+	ground_cloud_ptr->height = 1;
+	lanes_cloud_ptr->width = lanes_cloud_ptr->points.size();
+	lanes_cloud_ptr->height = 1;
+	lanes_cloud_ptr->is_dense = cloud.is_dense;
+
+	//published by pointer, shared with subscribers in the same nodelet manager
+	ground_cloud_ptr->header=cloud.header;
+	cloud_ground_pub_.publish(ground_cloud_ptr);
+
+	lanes_cloud_ptr->header=cloud.header;
+	cloud_lanes_pub_.publish(lanes_cloud_ptr);
+}
+
+#ifdef POINTS_PREPROCESSOR_NODELET
+namespace points_preprocessor
+{
+class RingGroundFilterNodelet : public nodelet::Nodelet
+{
+private:
+	virtual void onInit()
+	{
+		filter_.reset(new RingGroundFilter(getPrivateNodeHandle()));
+	}
+
+	boost::shared_ptr<RingGroundFilter> filter_;
+};
+}
+
+PLUGINLIB_EXPORT_CLASS(points_preprocessor::RingGroundFilterNodelet, nodelet::Nodelet)
+#else
+int main(int argc, char **argv)
+{
+
+	ros::init(argc, argv, "ring_ground_filter");
+	RingGroundFilter node;
+	ros::spin();
+
+	return 0;
+}
+#endif
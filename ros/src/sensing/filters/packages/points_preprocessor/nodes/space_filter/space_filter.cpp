@@ -10,12 +10,17 @@
 #include <sensor_msgs/point_cloud_conversion.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <pcl_ros/point_cloud.h>
 
+#ifdef POINTS_PREPROCESSOR_NODELET
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#endif
 
 class SpaceFilter
 {
 public:
-	SpaceFilter();
+	explicit SpaceFilter(const ros::NodeHandle& in_private_handle = ros::NodeHandle("~"));
 
 private:
 
@@ -33,19 +38,19 @@ private:
 	double 			below_distance_;
 	double 			above_distance_;
 
-	void VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr);
-	void KeepLanes(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+	void VelodyneCallback(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& in_sensor_cloud_ptr);
+	void KeepLanes(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 							pcl::PointCloud<pcl::PointXYZ>::Ptr out_cloud_ptr,
 							float in_left_lane_threshold,
 							float in_right_lane_threshold);
-	void ClipCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+	void ClipCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 							pcl::PointCloud<pcl::PointXYZ>::Ptr out_cloud_ptr,
 							float in_min_height,
 							float in_max_height);
 };
 
-SpaceFilter::SpaceFilter() :
-		node_handle_("~")
+SpaceFilter::SpaceFilter(const ros::NodeHandle& in_private_handle) :
+		node_handle_(in_private_handle)
 {
 
 	node_handle_.param<std::string>("subscribe_topic",  subscribe_topic_,  "/points_raw");
@@ -59,10 +64,10 @@ SpaceFilter::SpaceFilter() :
 	node_handle_.param("above_distance",  above_distance_,  0.5);
 
 	cloud_sub_ = node_handle_.subscribe(subscribe_topic_, 10, &SpaceFilter::VelodyneCallback, this);
-	cloud_pub_ = node_handle_.advertise<sensor_msgs::PointCloud2>( "/points_clipped", 10);
+	cloud_pub_ = node_handle_.advertise<pcl::PointCloud<pcl::PointXYZ> >( "/points_clipped", 10);
 }
 
-void SpaceFilter::KeepLanes(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+void SpaceFilter::KeepLanes(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 		pcl::PointCloud<pcl::PointXYZ>::Ptr out_cloud_ptr,
 		float in_left_lane_threshold,
 		float in_right_lane_threshold)
@@ -90,7 +95,7 @@ void SpaceFilter::KeepLanes(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_p
 	extract.filter(*out_cloud_ptr);
 }
 
-void SpaceFilter::ClipCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_ptr,
+void SpaceFilter::ClipCloud(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr in_cloud_ptr,
 		pcl::PointCloud<pcl::PointXYZ>::Ptr out_cloud_ptr,
 		float in_min_height,
 		float in_max_height)
@@ -104,23 +109,20 @@ void SpaceFilter::ClipCloud(const pcl::PointCloud<pcl::PointXYZ>::Ptr in_cloud_p
 			out_cloud_ptr->points.push_back(in_cloud_ptr->points[i]);
 		}
 	}
+	out_cloud_ptr->width = out_cloud_ptr->points.size();
+	out_cloud_ptr->height = 1;
 }
 
-void SpaceFilter::VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_sensor_cloud_ptr)
+void SpaceFilter::VelodyneCallback(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& in_sensor_cloud_ptr)
 {
-	pcl::PointCloud<pcl::PointXYZ>::Ptr current_sensor_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
-	pcl::PointCloud<pcl::PointXYZ>::Ptr inlanes_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
+	pcl::PointCloud<pcl::PointXYZ>::ConstPtr inlanes_cloud_ptr = in_sensor_cloud_ptr;
 	pcl::PointCloud<pcl::PointXYZ>::Ptr clipped_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
 
-	pcl::fromROSMsg(*in_sensor_cloud_ptr, *current_sensor_cloud_ptr);
-
 	if (lateral_removal_)
 	{
-		KeepLanes(current_sensor_cloud_ptr, inlanes_cloud_ptr, left_distance_, right_distance_);
-	}
-	else
-	{
-		inlanes_cloud_ptr = current_sensor_cloud_ptr;
+		pcl::PointCloud<pcl::PointXYZ>::Ptr lanes_cloud_ptr (new pcl::PointCloud<pcl::PointXYZ>);
+		KeepLanes(in_sensor_cloud_ptr, lanes_cloud_ptr, left_distance_, right_distance_);
+		inlanes_cloud_ptr = lanes_cloud_ptr;
 	}
 	if (vertical_removal_)
 	{
@@ -128,17 +130,31 @@ void SpaceFilter::VelodyneCallback(const sensor_msgs::PointCloud2::Ptr& in_senso
 	}
 	else
 	{
-		clipped_cloud_ptr = inlanes_cloud_ptr;
+		*clipped_cloud_ptr = *inlanes_cloud_ptr;
 	}
 
-	sensor_msgs::PointCloud2 cloud_msg;
+	//published by pointer, shared with subscribers in the same nodelet manager
+	clipped_cloud_ptr->header=in_sensor_cloud_ptr->header;
+	cloud_pub_.publish(clipped_cloud_ptr);
+}
 
-	pcl::toROSMsg(*clipped_cloud_ptr, cloud_msg);
+#ifdef POINTS_PREPROCESSOR_NODELET
+namespace points_preprocessor
+{
+class SpaceFilterNodelet : public nodelet::Nodelet
+{
+private:
+	virtual void onInit()
+	{
+		filter_.reset(new SpaceFilter(getPrivateNodeHandle()));
+	}
 
-	cloud_msg.header=in_sensor_cloud_ptr->header;
-	cloud_pub_.publish(cloud_msg);
+	boost::shared_ptr<SpaceFilter> filter_;
+};
 }
 
+PLUGINLIB_EXPORT_CLASS(points_preprocessor::SpaceFilterNodelet, nodelet::Nodelet)
+#else
 int main(int argc, char **argv)
 {
 
@@ -148,7 +164,4 @@ int main(int argc, char **argv)
 
 	return 0;
 }
-
-
-
-
+#endif
@@ -31,10 +31,73 @@
  *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <atomic>
+#include <stdint.h>
+#include <vector>
 #include <opencv2/opencv.hpp>
 #include <sensor_msgs/PointCloud2.h>
 #include "points2image/PointsImage.h"
 
+/*
+ * Projects point clouds into a camera image.  The calibration is reduced
+ * to plain floats once in setCalibration(), and project() transforms the
+ * points in blocks on an OpenMP team.  Each pixel keeps the nearest point
+ * (z-test on the camera depth).
+ *
+ * projectAll() projects one cloud into several cameras in a single pass:
+ * each block of points is read once and only handed to the cameras whose
+ * view frustum intersects the bounding box of the block.
+ */
+class PointsImageProjector
+{
+public:
+	PointsImageProjector();
+	PointsImageProjector(const cv::Mat& cameraExtrinsicMat,
+			     const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+			     const cv::Size& imageSize);
+
+	void setCalibration(const cv::Mat& cameraExtrinsicMat,
+			    const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+			    const cv::Size& imageSize);
+	bool isCalibrated() const;
+
+	points2image::PointsImage
+	project(const sensor_msgs::PointCloud2ConstPtr& pointcloud2, int threads = 1);
+
+	// msgs[i] is left empty for projectors that are not calibrated
+	static void projectAll(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
+			       std::vector<PointsImageProjector>& projectors, int threads,
+			       std::vector<points2image::PointsImage> *msgs);
+
+private:
+	static void projectRange(const sensor_msgs::PointCloud2& pointcloud2,
+				 PointsImageProjector *const *projectors, size_t count,
+				 uint32_t begin, uint32_t end);
+	static void run(const sensor_msgs::PointCloud2& pointcloud2,
+			PointsImageProjector *const *projectors, size_t count, int threads);
+
+	void setFrustum();
+	bool isVisible(const float min[3], const float max[3]) const;
+	void clearDepth();
+	void projectBlock(const float *px, const float *py, const float *pz,
+			  uint32_t first, int count);
+	points2image::PointsImage createMessage(const sensor_msgs::PointCloud2& pointcloud2) const;
+
+	float rotation_[9];	// lidar to camera, row major
+	float translation_[3];
+	float fx_, fy_, cx_, cy_;
+	float k1_, k2_, k3_, p1_, p2_;
+	float fold_r2_;		// points past this squared radius are dropped
+	int width_, height_;
+
+	// view frustum in the lidar frame, n . p + d >= 0 for visible points
+	float planes_[5][4];
+	int plane_count_;
+
+	// per pixel (depth bits << 32 | point index), smallest wins
+	std::vector<std::atomic<uint64_t> > depth_;
+};
+
 points2image::PointsImage
 pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointclound2,
 		     const cv::Mat& cameraExtrinsicMat,
@@ -31,94 +31,394 @@
 #include <vector>
 #include <points_image.hpp>
 #include <stdint.h>
+#include <string.h>
+#include <cmath>
 #include <iostream>
 
+#define MIN_DEPTH	2.5f
+#define BLOCK_SIZE	256
+#define FRUSTUM_SAMPLES	32
+#define FRUSTUM_MARGIN	0.05f
+
+static const uint64_t EMPTY_PIXEL = UINT64_MAX;
+
+// d/dr of r * (1 + k1 r^2 + k2 r^4 + k3 r^6), as a function of t = r^2
+static double radialSlope(double k1, double k2, double k3, double t)
+{
+	return 1 + 3 * k1 * t + 5 * k2 * t * t + 7 * k3 * t * t * t;
+}
+
+/*
+ * Returns the squared normalized radius at which the radial distortion
+ * folds over (stops growing with the radius), or INFINITY if it never
+ * does.  Past it points land back inside the image at a wrong position.
+ */
+static float foldRadius2(double k1, double k2, double k3)
+{
+	// the slope is monotonic between the roots of its derivative
+	double a = 21 * k3, b = 10 * k2, c = 3 * k1;
+	double ends[3];
+	int count = 0;
+	if (a != 0) {
+		double d = b * b - 4 * a * c;
+		if (d >= 0) {
+			double r0 = (-b - std::sqrt(d)) / (2 * a);
+			double r1 = (-b + std::sqrt(d)) / (2 * a);
+			ends[count++] = std::min(r0, r1);
+			ends[count++] = std::max(r0, r1);
+		}
+	} else if (b != 0) {
+		ends[count++] = -c / b;
+	}
+
+	double lo = 0, hi = -1;
+	for (int i = 0; i < count && hi < 0; ++i) {
+		if (ends[i] <= lo)
+			continue;
+		if (radialSlope(k1, k2, k3, ends[i]) <= 0)
+			hi = ends[i];
+		else
+			lo = ends[i];
+	}
+	if (hi < 0) {
+		// the leading coefficient decides the sign for large radii
+		double lead = k3 != 0 ? k3 : (k2 != 0 ? k2 : k1);
+		if (!(lead < 0))
+			return INFINITY;
+		hi = std::max(lo, 1.0);
+		while (radialSlope(k1, k2, k3, hi) > 0)
+			hi *= 2;
+	}
+
+	for (int i = 0; i < 64; ++i) {
+		double mid = 0.5 * (lo + hi);
+		if (radialSlope(k1, k2, k3, mid) > 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return float(lo);
+}
+
+PointsImageProjector::PointsImageProjector()
+	: width_(0), height_(0), plane_count_(0)
+{
+}
+
+PointsImageProjector::PointsImageProjector(const cv::Mat& cameraExtrinsicMat,
+					   const cv::Mat& cameraMat,
+					   const cv::Mat& distCoeff,
+					   const cv::Size& imageSize)
+	: width_(0), height_(0), plane_count_(0)
+{
+	setCalibration(cameraExtrinsicMat, cameraMat, distCoeff, imageSize);
+}
+
+void PointsImageProjector::setCalibration(const cv::Mat& cameraExtrinsicMat,
+					  const cv::Mat& cameraMat,
+					  const cv::Mat& distCoeff,
+					  const cv::Size& imageSize)
+{
+	// invR = R^t, invT = -R^t * T
+	for (int i = 0; i < 3; ++i) {
+		double t = 0;
+		for (int j = 0; j < 3; ++j) {
+			rotation_[i * 3 + j] = float(cameraExtrinsicMat.at<double>(j, i));
+			t -= cameraExtrinsicMat.at<double>(j, i) * cameraExtrinsicMat.at<double>(j, 3);
+		}
+		translation_[i] = float(t);
+	}
+
+	fx_ = float(cameraMat.at<double>(0, 0));
+	fy_ = float(cameraMat.at<double>(1, 1));
+	cx_ = float(cameraMat.at<double>(0, 2));
+	cy_ = float(cameraMat.at<double>(1, 2));
+
+	k1_ = float(distCoeff.at<double>(0));
+	k2_ = float(distCoeff.at<double>(1));
+	p1_ = float(distCoeff.at<double>(2));
+	p2_ = float(distCoeff.at<double>(3));
+	k3_ = float(distCoeff.at<double>(4));
+	fold_r2_ = foldRadius2(k1_, k2_, k3_);
+
+	if (imageSize.width != width_ || imageSize.height != height_) {
+		width_ = imageSize.width;
+		height_ = imageSize.height;
+		depth_ = std::vector<std::atomic<uint64_t> >(size_t(width_) * height_);
+	}
+
+	setFrustum();
+}
+
+bool PointsImageProjector::isCalibrated() const
+{
+	return width_ > 0 && height_ > 0;
+}
+
+/*
+ * Builds the culling planes.  The image border is undistorted back to
+ * normalized coordinates inside the fold radius, where projectBlock()
+ * keeps points, so the side planes bound the points that can round into
+ * the image.  If the border cannot be inverted there only the near plane
+ * is used.
+ */
+void PointsImageProjector::setFrustum()
+{
+	float camera_planes[5][4];
+	int count = 0;
+
+	camera_planes[count][0] = 0;
+	camera_planes[count][1] = 0;
+	camera_planes[count][2] = 1;
+	camera_planes[count][3] = -MIN_DEPTH;
+	count++;
+
+	// int(u + 0.5) lands in [0, w) for u in (-1.5, w - 0.5)
+	float u_min = -1.5f, u_max = width_ - 0.5f;
+	float v_min = -1.5f, v_max = height_ - 0.5f;
+	float x_min = INFINITY, x_max = -INFINITY;
+	float y_min = INFINITY, y_max = -INFINITY;
+	bool invertible = true;
+
+	for (int i = 0; i < 4 * FRUSTUM_SAMPLES; ++i) {
+		int edge = i / FRUSTUM_SAMPLES;
+		float t = float(i % FRUSTUM_SAMPLES) / FRUSTUM_SAMPLES;
+		float u, v;
+		switch (edge) {
+		case 0: u = u_min + t * (u_max - u_min); v = v_min; break;
+		case 1: u = u_max; v = v_min + t * (v_max - v_min); break;
+		case 2: u = u_max - t * (u_max - u_min); v = v_max; break;
+		default: u = u_min; v = v_max - t * (v_max - v_min); break;
+		}
+
+		float xd = (u - cx_) / fx_;
+		float yd = (v - cy_) / fy_;
+		float x = xd, y = yd;
+		for (int j = 0; j < 20; ++j) {
+			float r2 = x * x + y * y;
+			float radial = 1 + k1_ * r2 + k2_ * r2 * r2 + k3_ * r2 * r2 * r2;
+			float dx = 2 * p1_ * x * y + p2_ * (r2 + 2 * x * x);
+			float dy = p1_ * (r2 + 2 * y * y) + 2 * p2_ * x * y;
+			x = (xd - dx) / radial;
+			y = (yd - dy) / radial;
+		}
+
+		float r2 = x * x + y * y;
+		float radial = 1 + k1_ * r2 + k2_ * r2 * r2 + k3_ * r2 * r2 * r2;
+		float ex = x * radial + 2 * p1_ * x * y + p2_ * (r2 + 2 * x * x) - xd;
+		float ey = y * radial + p1_ * (r2 + 2 * y * y) + 2 * p2_ * x * y - yd;
+		if (!(r2 < fold_r2_) || !(std::fabs(ex) * fx_ < 0.5f && std::fabs(ey) * fy_ < 0.5f)) {
+			invertible = false;
+			break;
+		}
+
+		x_min = std::min(x_min, x);
+		x_max = std::max(x_max, x);
+		y_min = std::min(y_min, y);
+		y_max = std::max(y_max, y);
+	}
+
+	if (invertible) {
+		float x_margin = FRUSTUM_MARGIN * (x_max - x_min);
+		float y_margin = FRUSTUM_MARGIN * (y_max - y_min);
+		x_min -= x_margin;
+		x_max += x_margin;
+		y_min -= y_margin;
+		y_max += y_margin;
+
+		// x >= x_min * z, x <= x_max * z, and the same for y
+		float sides[4][4] = {
+			{  1,  0, -x_min, 0 },
+			{ -1,  0,  x_max, 0 },
+			{  0,  1, -y_min, 0 },
+			{  0, -1,  y_max, 0 },
+		};
+		for (int i = 0; i < 4; ++i, ++count)
+			memcpy(camera_planes[count], sides[i], sizeof(sides[i]));
+	}
+
+	// n_c . (R p + t) + d = (R^t n_c) . p + (n_c . t + d)
+	for (int i = 0; i < count; ++i) {
+		const float *n = camera_planes[i];
+		for (int j = 0; j < 3; ++j)
+			planes_[i][j] = rotation_[j] * n[0] + rotation_[3 + j] * n[1] + rotation_[6 + j] * n[2];
+		planes_[i][3] = n[0] * translation_[0] + n[1] * translation_[1] + n[2] * translation_[2] + n[3];
+	}
+	plane_count_ = count;
+}
+
+bool PointsImageProjector::isVisible(const float min[3], const float max[3]) const
+{
+	for (int i = 0; i < plane_count_; ++i) {
+		const float *plane = planes_[i];
+		float distance = plane[3];
+		for (int j = 0; j < 3; ++j)
+			distance += plane[j] * (plane[j] >= 0 ? max[j] : min[j]);
+		if (distance < 0)
+			return false;
+	}
+	return true;
+}
+
+void PointsImageProjector::clearDepth()
+{
+	for (size_t i = 0; i < depth_.size(); ++i)
+		depth_[i].store(EMPTY_PIXEL, std::memory_order_relaxed);
+}
+
+void PointsImageProjector::projectBlock(const float *px, const float *py, const float *pz,
+					uint32_t first, int count)
+{
+	float u[BLOCK_SIZE], v[BLOCK_SIZE], depth[BLOCK_SIZE];
+
+	// branch free so that the compiler can vectorize it
+	for (int i = 0; i < count; ++i) {
+		float x = rotation_[0] * px[i] + rotation_[1] * py[i] + rotation_[2] * pz[i] + translation_[0];
+		float y = rotation_[3] * px[i] + rotation_[4] * py[i] + rotation_[5] * pz[i] + translation_[1];
+		float z = rotation_[6] * px[i] + rotation_[7] * py[i] + rotation_[8] * pz[i] + translation_[2];
+
+		float iz = z > MIN_DEPTH ? 1.0f / z : 0.0f;
+		float tmpx = x * iz;
+		float tmpy = y * iz;
+		float r2 = tmpx * tmpx + tmpy * tmpy;
+		float tmpdist = 1 + k1_ * r2 + k2_ * r2 * r2 + k3_ * r2 * r2 * r2;
+
+		float ix = tmpx * tmpdist + 2 * p1_ * tmpx * tmpy + p2_ * (r2 + 2 * tmpx * tmpx);
+		float iy = tmpy * tmpdist + p1_ * (r2 + 2 * tmpy * tmpy) + 2 * p2_ * tmpx * tmpy;
+		u[i] = fx_ * ix + cx_ + 0.5f;
+		v[i] = fy_ * iy + cy_ + 0.5f;
+		// folded over points would land at a wrong pixel
+		depth[i] = r2 < fold_r2_ ? z : 0.0f;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (!(depth[i] > MIN_DEPTH))
+			continue;
+		// same rounding as int(x + 0.5)
+		int ix = int(u[i]);
+		int iy = int(v[i]);
+		if (ix < 0 || ix >= width_ || iy < 0 || iy >= height_)
+			continue;
+
+		uint32_t bits;
+		memcpy(&bits, &depth[i], sizeof(bits));
+		uint64_t key = (uint64_t(bits) << 32) | (first + i);
+
+		std::atomic<uint64_t>& pixel = depth_[size_t(iy) * width_ + ix];
+		uint64_t current = pixel.load(std::memory_order_relaxed);
+		while (key < current &&
+		       !pixel.compare_exchange_weak(current, key, std::memory_order_relaxed))
+			;
+	}
+}
+
+void PointsImageProjector::projectRange(const sensor_msgs::PointCloud2& pointcloud2,
+					PointsImageProjector *const *projectors, size_t count,
+					uint32_t begin, uint32_t end)
+{
+	const uint8_t *cp = pointcloud2.data.data();
+	float px[BLOCK_SIZE], py[BLOCK_SIZE], pz[BLOCK_SIZE];
+
+	for (uint32_t first = begin; first < end; first += BLOCK_SIZE) {
+		int size = int(std::min<uint32_t>(BLOCK_SIZE, end - first));
+		float min[3] = { INFINITY, INFINITY, INFINITY };
+		float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+		for (int i = 0; i < size; ++i) {
+			const float *fp = (const float *)(cp + size_t(first + i) * pointcloud2.point_step);
+			px[i] = fp[0];
+			py[i] = fp[1];
+			pz[i] = fp[2];
+		}
+		for (int i = 0; i < size; ++i) {
+			min[0] = px[i] < min[0] ? px[i] : min[0];
+			min[1] = py[i] < min[1] ? py[i] : min[1];
+			min[2] = pz[i] < min[2] ? pz[i] : min[2];
+			max[0] = px[i] > max[0] ? px[i] : max[0];
+			max[1] = py[i] > max[1] ? py[i] : max[1];
+			max[2] = pz[i] > max[2] ? pz[i] : max[2];
+		}
+
+		for (size_t c = 0; c < count; ++c) {
+			if (projectors[c]->isVisible(min, max))
+				projectors[c]->projectBlock(px, py, pz, first, size);
+		}
+	}
+}
+
+void PointsImageProjector::run(const sensor_msgs::PointCloud2& pointcloud2,
+			       PointsImageProjector *const *projectors, size_t count, int threads)
+{
+	for (size_t c = 0; c < count; ++c)
+		projectors[c]->clearDepth();
+
+	uint32_t size = pointcloud2.width * pointcloud2.height;
+	if (threads < 1)
+		threads = 1;
+	if (uint32_t(threads) > size / BLOCK_SIZE)
+		threads = std::max<uint32_t>(1, size / BLOCK_SIZE);
+
+	// the OpenMP team is kept alive between frames
+#pragma omp parallel for num_threads(threads) schedule(static)
+	for (int i = 0; i < threads; ++i) {
+		uint32_t begin = uint32_t(uint64_t(size) * i / threads);
+		uint32_t end = uint32_t(uint64_t(size) * (i + 1) / threads);
+		projectRange(pointcloud2, projectors, count, begin, end);
+	}
+}
+
 points2image::PointsImage
-pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
-		     const cv::Mat& cameraExtrinsicMat,
-		     const cv::Mat& cameraMat, const cv::Mat& distCoeff,
-		     const cv::Size& imageSize)
+PointsImageProjector::createMessage(const sensor_msgs::PointCloud2& pointcloud2) const
 {
-	int w = imageSize.width;
-	int h = imageSize.height;
+	int w = width_;
+	int h = height_;
 
 	points2image::PointsImage msg;
 
-	msg.header = pointcloud2->header;
+	msg.header = pointcloud2.header;
 
 	msg.intensity.assign(w * h, 0);
 	msg.distance.assign(w * h, 0);
 	msg.min_height.assign(w * h, 0);
 	msg.max_height.assign(w * h, 0);
 
-	cv::Mat invR = cameraExtrinsicMat(cv::Rect(0,0,3,3)).t();
-	cv::Mat invT = -invR*(cameraExtrinsicMat(cv::Rect(3,0,1,3)));
-	uintptr_t cp = (uintptr_t)pointcloud2->data.data();
-
 	msg.max_y = -1;
 	msg.min_y = h;
 
-	msg.image_height = imageSize.height;
-	msg.image_width = imageSize.width;
+	msg.image_height = h;
+	msg.image_width = w;
 
-	for (uint32_t y = 0; y < pointcloud2->height; ++y) {
-		for (uint32_t x = 0; x < pointcloud2->width; ++x) {
-			float* fp = (float *)(cp + (x + y*pointcloud2->width) * pointcloud2->point_step);
-			double intensity = fp[4];
+	const uint8_t *cp = pointcloud2.data.data();
+	bool two_layers = pointcloud2.height == 2;
+	for (int py = 0; py < h; ++py) {
+		for (int px = 0; px < w; ++px) {
+			int pid = py * w + px;
+			uint64_t key = depth_[pid].load(std::memory_order_relaxed);
+			if (key == EMPTY_PIXEL)
+				continue;
 
-			cv::Mat point(1, 3, CV_64F);
-			point.at<double>(0) = double(fp[0]);
-			point.at<double>(1) = double(fp[1]);
-			point.at<double>(2) = double(fp[2]);
-			point = point * invR.t() + invT.t();
+			uint32_t index = uint32_t(key & 0xffffffff);
+			uint32_t bits = uint32_t(key >> 32);
+			float depth;
+			memcpy(&depth, &bits, sizeof(depth));
+			const float *fp = (const float *)(cp + size_t(index) * pointcloud2.point_step);
 
-			if (point.at<double>(2) <= 2.5) {
-				continue;
-			}
+			msg.distance[pid] = depth * 100;
+			msg.intensity[pid] = fp[4];
+
+			msg.max_y = py > msg.max_y ? py : msg.max_y;
+			msg.min_y = py < msg.min_y ? py : msg.min_y;
 
-			double tmpx = point.at<double>(0) / point.at<double>(2);
-			double tmpy = point.at<double>(1)/point.at<double>(2);
-			double r2 = tmpx * tmpx + tmpy * tmpy;
-			double tmpdist = 1 + distCoeff.at<double>(0) * r2
-				+ distCoeff.at<double>(1) * r2 * r2
-				+ distCoeff.at<double>(4) * r2 * r2 * r2;
-
-			cv::Point2d imagepoint;
-			imagepoint.x = tmpx * tmpdist
-				+ 2 * distCoeff.at<double>(2) * tmpx * tmpy
-				+ distCoeff.at<double>(3) * (r2 + 2 * tmpx * tmpx);
-			imagepoint.y = tmpy * tmpdist
-				+ distCoeff.at<double>(2) * (r2 + 2 * tmpy * tmpy)
-				+ 2 * distCoeff.at<double>(3) * tmpx * tmpy;
-			imagepoint.x = cameraMat.at<double>(0,0) * imagepoint.x + cameraMat.at<double>(0,2);
-			imagepoint.y = cameraMat.at<double>(1,1) * imagepoint.y + cameraMat.at<double>(1,2);
-
-			int px = int(imagepoint.x + 0.5);
-			int py = int(imagepoint.y + 0.5);
-			if(0 <= px && px < w && 0 <= py && py < h)
+			if (two_layers && index < pointcloud2.width)//process simultaneously min and max during the first layer
 			{
-				int pid = py * w + px;
-				if(msg.distance[pid] == 0 ||
-				   msg.distance[pid] > point.at<double>(2))
-				{
-					msg.distance[pid] = float(point.at<double>(2) * 100);
-					msg.intensity[pid] = float(intensity);
-
-					msg.max_y = py > msg.max_y ? py : msg.max_y;
-					msg.min_y = py < msg.min_y ? py : msg.min_y;
-
-				}
-				if (0 == y && pointcloud2->height == 2)//process simultaneously min and max during the first layer
-				{
-					float* fp2 = (float *)(cp + (x + (y+1)*pointcloud2->width) * pointcloud2->point_step);
-					msg.min_height[pid] = fp[2];
-					msg.max_height[pid] = fp2[2];
-				}
-				else
-				{
-					msg.min_height[pid] = -1.25;
-					msg.max_height[pid] = 0;
-				}
+				const float *fp2 = (const float *)(cp + size_t(index + pointcloud2.width) * pointcloud2.point_step);
+				msg.min_height[pid] = fp[2];
+				msg.max_height[pid] = fp2[2];
+			}
+			else
+			{
+				msg.min_height[pid] = -1.25;
+				msg.max_height[pid] = 0;
 			}
 		}
 	}
@@ -126,6 +426,46 @@ pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
 	return msg;
 }
 
+points2image::PointsImage
+PointsImageProjector::project(const sensor_msgs::PointCloud2ConstPtr& pointcloud2, int threads)
+{
+	PointsImageProjector *self = this;
+	if (isCalibrated())
+		run(*pointcloud2, &self, 1, threads);
+	return createMessage(*pointcloud2);
+}
+
+void PointsImageProjector::projectAll(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
+				      std::vector<PointsImageProjector>& projectors, int threads,
+				      std::vector<points2image::PointsImage> *msgs)
+{
+	std::vector<PointsImageProjector *> calibrated;
+	for (size_t i = 0; i < projectors.size(); ++i) {
+		if (projectors[i].isCalibrated())
+			calibrated.push_back(&projectors[i]);
+	}
+
+	if (!calibrated.empty())
+		run(*pointcloud2, calibrated.data(), calibrated.size(), threads);
+
+	msgs->clear();
+	msgs->resize(projectors.size());
+	for (size_t i = 0; i < projectors.size(); ++i) {
+		if (projectors[i].isCalibrated())
+			(*msgs)[i] = projectors[i].createMessage(*pointcloud2);
+	}
+}
+
+points2image::PointsImage
+pointcloud2_to_image(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
+		     const cv::Mat& cameraExtrinsicMat,
+		     const cv::Mat& cameraMat, const cv::Mat& distCoeff,
+		     const cv::Size& imageSize)
+{
+	PointsImageProjector projector(cameraExtrinsicMat, cameraMat, distCoeff, imageSize);
+	return projector.project(pointcloud2);
+}
+
 /*points2image::CameraExtrinsic
 pointcloud2_to_3d_calibration(const sensor_msgs::PointCloud2ConstPtr& pointcloud2,
 			      const cv::Mat& cameraExtrinsicMat)
@@ -36,58 +36,91 @@
 //#include "points2image/CameraExtrinsic.h"
 
 #include <points_image.hpp>
+#include <boost/bind.hpp>
+#include <string>
+#include <vector>
 
 #define CAMERAEXTRINSICMAT "CameraExtrinsicMat"
 #define CAMERAMAT "CameraMat"
 #define DISTCOEFF "DistCoeff"
 #define IMAGESIZE "ImageSize"
 
-
-static cv::Mat cameraExtrinsicMat;
-static cv::Mat cameraMat;
-static cv::Mat distCoeff;
-static cv::Size imageSize;
-static ros::Publisher pub;
-
-static void projection_callback(const calibration_camera_lidar::projection_matrix& msg)
+struct Camera
+{
+	cv::Mat cameraExtrinsicMat;
+	cv::Mat cameraMat;
+	cv::Mat distCoeff;
+	cv::Size imageSize;
+	bool calibration_updated;
+	ros::Subscriber projection_sub;
+	ros::Subscriber intrinsic_sub;
+	ros::Publisher pub;
+};
+
+static std::vector<Camera> cameras;
+static std::vector<PointsImageProjector> projectors;
+static int threads = 2;
+
+static void projection_callback(const calibration_camera_lidar::projection_matrix::ConstPtr& msg, size_t id)
 {
-	cameraExtrinsicMat = cv::Mat(4,4,CV_64F);
+	Camera& camera = cameras[id];
+	camera.cameraExtrinsicMat = cv::Mat(4,4,CV_64F);
 	for (int row=0; row<4; row++) {
 		for (int col=0; col<4; col++) {
-			cameraExtrinsicMat.at<double>(row, col) = msg.projection_matrix[row * 4 + col];
+			camera.cameraExtrinsicMat.at<double>(row, col) = msg->projection_matrix[row * 4 + col];
 		}
 	}
+	camera.calibration_updated = true;
 }
 
-static void intrinsic_callback(const sensor_msgs::CameraInfo& msg)
+static void intrinsic_callback(const sensor_msgs::CameraInfo::ConstPtr& msg, size_t id)
 {
-	imageSize.height = msg.height;
-	imageSize.width = msg.width;
+	Camera& camera = cameras[id];
+	camera.imageSize.height = msg->height;
+	camera.imageSize.width = msg->width;
 
-	cameraMat = cv::Mat(3,3, CV_64F);
+	camera.cameraMat = cv::Mat(3,3, CV_64F);
 	for (int row=0; row<3; row++) {
 		for (int col=0; col<3; col++) {
-			cameraMat.at<double>(row, col) = msg.K[row * 3 + col];
+			camera.cameraMat.at<double>(row, col) = msg->K[row * 3 + col];
 		}
 	}
 
-	distCoeff = cv::Mat(1,5,CV_64F);
+	camera.distCoeff = cv::Mat(1,5,CV_64F);
 	for (int col=0; col<5; col++) {
-		distCoeff.at<double>(col) = msg.D[col];
+		camera.distCoeff.at<double>(col) = msg->D[col];
 	}
+	camera.calibration_updated = true;
 }
 
 static void callback(const sensor_msgs::PointCloud2ConstPtr& msg)
 {
-	if (cameraExtrinsicMat.empty() || cameraMat.empty() || distCoeff.empty() || imageSize.height == 0 || imageSize.width == 0)
+	bool calibrated = false;
+	for (size_t i = 0; i < cameras.size(); ++i) {
+		Camera& camera = cameras[i];
+		if (camera.cameraExtrinsicMat.empty() || camera.cameraMat.empty() || camera.distCoeff.empty() || camera.imageSize.height == 0 || camera.imageSize.width == 0)
+			continue;
+		if (camera.calibration_updated) {
+			projectors[i].setCalibration(camera.cameraExtrinsicMat, camera.cameraMat,
+						     camera.distCoeff, camera.imageSize);
+			camera.calibration_updated = false;
+		}
+		calibrated = true;
+	}
+
+	if (!calibrated)
 	{
 		ROS_INFO("Looks like /camera/camera_info or /projection_matrix are not being published.. Please check that both are running..");
 		return;
 	}
-	points2image::PointsImage pub_msg
-		= pointcloud2_to_image(msg, cameraExtrinsicMat,
-				       cameraMat, distCoeff, imageSize);
-	pub.publish(pub_msg);
+
+	// all cameras in one pass over the cloud
+	std::vector<points2image::PointsImage> pub_msgs;
+	PointsImageProjector::projectAll(msg, projectors, threads, &pub_msgs);
+	for (size_t i = 0; i < cameras.size(); ++i) {
+		if (projectors[i].isCalibrated())
+			cameras[i].pub.publish(pub_msgs[i]);
+	}
 }
 
 int main(int argc, char *argv[])
@@ -99,6 +132,7 @@ int main(int argc, char *argv[])
 	private_nh.param<std::string>("camera_info_topic", cameraInfo_topic_name, "/camera/camera_info");
 	std::string projectionMat_topic_name;
 	private_nh.param<std::string>("projection_matrix_topic", projectionMat_topic_name, "/projection_matrix");
+	private_nh.param("threads", threads, 2);
 
 	/*if(argc < 2){
 		std::cout<<"Need calibration filename as the first parameter.";
@@ -118,10 +152,29 @@ int main(int argc, char *argv[])
 	//imageSize.width = IMAGE_WIDTH;
 	//imageSize.height = IMAGE_HEIGHT;
 
-	pub = n.advertise<points2image::PointsImage>("vscan_image", 10);
+	// With camera_ids (e.g. ["/camera0", "/camera1"]) one node serves all
+	// cameras: each id prefixes the calibration topics and the output topic.
+	std::vector<std::string> camera_ids;
+	private_nh.getParam("camera_ids", camera_ids);
+	if (camera_ids.empty())
+		camera_ids.push_back("");
+
+	cameras.resize(camera_ids.size());
+	projectors = std::vector<PointsImageProjector>(camera_ids.size());
+	for (size_t i = 0; i < camera_ids.size(); ++i) {
+		const std::string& id = camera_ids[i];
+		Camera& camera = cameras[i];
+		camera.calibration_updated = false;
+		camera.pub = n.advertise<points2image::PointsImage>(id.empty() ? "vscan_image" : id + "/vscan_image", 10);
+		camera.projection_sub = n.subscribe<calibration_camera_lidar::projection_matrix>(
+			id + projectionMat_topic_name, 1, boost::bind(projection_callback, _1, i));
+		camera.intrinsic_sub = n.subscribe<sensor_msgs::CameraInfo>(
+			id + cameraInfo_topic_name, 1, boost::bind(intrinsic_callback, _1, i));
+		if (!id.empty())
+			ROS_INFO("Projecting into camera %s", id.c_str());
+	}
+
 	ros::Subscriber sub = n.subscribe("vscan_points", 1, callback);
-	ros::Subscriber projection = n.subscribe(projectionMat_topic_name, 1, projection_callback);
-	ros::Subscriber intrinsic = n.subscribe(cameraInfo_topic_name, 1, intrinsic_callback);
 
 	ros::spin();
 	return 0;
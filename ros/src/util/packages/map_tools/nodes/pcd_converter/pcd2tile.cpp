@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2016, Nagoya University
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Autoware nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ *  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Convert PCD files into memory-mappable points map tiles (.pmt) and write
+ * an arealist for them that points_map_loader can use as is.
+ */
+
+#include <cmath>
+
+#include <pcl_conversions/pcl_conversions.h>
+
+#include <map_file/points_map_tile.h>
+
+struct Area {
+	std::string path;
+	double x_min;
+	double y_min;
+	double z_min;
+	double x_max;
+	double y_max;
+	double z_max;
+};
+
+typedef std::vector<Area> AreaList;
+
+std::string fmt(double v)
+{
+	char s[64];
+	snprintf(s, sizeof(s), "%.3f", v);
+	return std::string(s);
+}
+
+void write_arealist(const std::string& path, const AreaList& areas)
+{
+	std::ofstream ofs(path != "-" ? path.c_str() : "/dev/null");
+	std::ostream& os = (path != "-") ? ofs : (std::cout);
+
+	for (const Area& area : areas) {
+		os << area.path << "," << fmt(area.x_min) << "," << fmt(area.y_min) << "," << fmt(area.z_min)
+		   << "," << fmt(area.x_max) << "," << fmt(area.y_max) << "," << fmt(area.z_max) << std::endl;
+	}
+}
+
+int find_field(const sensor_msgs::PointCloud2& pcd, const std::string& name)
+{
+	for (size_t i = 0; i < pcd.fields.size(); ++i) {
+		if (pcd.fields[i].name == name && pcd.fields[i].count == 1)
+			return i;
+	}
+	return -1;
+}
+
+// Repack pcd into the tile layout, dropping points with non-finite
+// coordinates.
+int repack(const sensor_msgs::PointCloud2& in, sensor_msgs::PointCloud2& out, uint32_t *fields)
+{
+	const char *names[] = { "x", "y", "z", "intensity", "rgb" };
+	int idx[5];
+	for (int i = 0; i < 5; ++i)
+		idx[i] = find_field(in, names[i]);
+	for (int i = 0; i < 3; ++i) {
+		if (idx[i] < 0 || in.fields[idx[i]].datatype != sensor_msgs::PointField::FLOAT32)
+			return -1;
+	}
+	if (idx[3] >= 0 && in.fields[idx[3]].datatype != sensor_msgs::PointField::FLOAT32)
+		idx[3] = -1;
+	if (idx[4] >= 0 && in.fields[idx[4]].datatype != sensor_msgs::PointField::FLOAT32 &&
+	    in.fields[idx[4]].datatype != sensor_msgs::PointField::UINT32)
+		idx[4] = -1;
+
+	*fields = 0;
+	if (idx[3] >= 0) *fields |= map_file::TILE_FIELD_INTENSITY;
+	if (idx[4] >= 0) *fields |= map_file::TILE_FIELD_RGB;
+
+	std::vector<uint32_t> offsets;
+	for (int i = 0; i < 5; ++i) {
+		if (idx[i] >= 0)
+			offsets.push_back(in.fields[idx[i]].offset);
+	}
+
+	out.height = 1;
+	out.fields = map_file::tile_point_fields(*fields);
+	out.is_bigendian = false;
+	out.point_step = map_file::tile_point_step(*fields);
+	out.is_dense = true;
+	out.data.resize(static_cast<size_t>(in.width) * in.height * out.point_step);
+
+	size_t n = 0;
+	for (size_t i = 0; i < static_cast<size_t>(in.width) * in.height; ++i) {
+		const uint8_t *src = &in.data[i * in.point_step];
+		uint8_t *dst = &out.data[n * out.point_step];
+		for (size_t j = 0; j < offsets.size(); ++j)
+			std::memcpy(dst + j * sizeof(float), src + offsets[j], sizeof(float));
+		float p[3];
+		std::memcpy(p, dst, sizeof(p));
+		if (std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]))
+			++n;
+	}
+	out.data.resize(n * out.point_step);
+	out.width = n;
+	out.row_step = out.data.size();
+	return 0;
+}
+
+int convert(const std::string& path, struct Area *area)
+{
+	sensor_msgs::PointCloud2 in, out;
+	if (pcl::io::loadPCDFile(path.c_str(), in) == -1) {
+		std::cerr << "load failed " << path << std::endl;
+		return -1;
+	}
+	uint32_t fields;
+	if (repack(in, out, &fields) != 0 || out.width == 0) {
+		std::cerr << "no float x/y/z points in " << path << std::endl;
+		return -1;
+	}
+
+	std::string tile_path = path;
+	std::string::size_type dot = tile_path.find_last_of('.');
+	if (dot != std::string::npos && tile_path.find('/', dot) == std::string::npos)
+		tile_path.erase(dot);
+	tile_path += map_file::TILE_EXTENSION;
+
+	map_file::MappedTile tile;
+	if (!map_file::write_tile(tile_path, out, fields) || !tile.open(tile_path)) {
+		std::cerr << "save failed " << tile_path << std::endl;
+		return -1;
+	}
+	std::cerr << "save " << tile_path << " (" << out.width << " points)" << std::endl;
+
+	const map_file::PointsMapTileHeader& h = tile.header();
+	area->path = tile_path;
+	area->x_min = h.x_min;
+	area->y_min = h.y_min;
+	area->z_min = h.z_min;
+	area->x_max = h.x_max;
+	area->y_max = h.y_max;
+	area->z_max = h.z_max;
+	return 0;
+}
+
+void add_file(const std::string& path, AreaList& areas)
+{
+	struct Area area;
+	if (convert(path, &area) == 0) {
+		areas.push_back(area);
+	}
+}
+
+void add_dir(const std::string& path, AreaList& areas)
+{
+	std::string cmd = "find " + path + " -name '*.pcd' | sort";
+	FILE *fp = popen(cmd.c_str(), "r");
+	char line[ PATH_MAX ];
+
+	while (fgets(line, sizeof(line), fp)) {
+		std::string buf(line);
+		buf.erase(--buf.end()); // cut tail '\n'
+		add_file(buf, areas);
+	}
+	pclose(fp);
+}
+
+int is_dir(const std::string& path)
+{
+	struct stat buf;
+	if (stat(path.c_str(), &buf) != 0) {
+		std::cerr << "not found " << path << std::endl;
+		exit(1);
+	}
+	return S_ISDIR(buf.st_mode);
+}
+
+int main (int argc, char** argv)
+{
+	argc--;
+	argv++;
+	if (argc <= 0) {
+		std::cout << "Usage: rosrun map_tools pcd2tile [ -o AREALIST ] INPUT..." << std::endl;
+		return 0;
+	}
+	std::string out;
+	if (argc >= 2 && strcmp(*argv, "-o") == 0) {
+		argc -= 2;
+		argv++;
+		out = *argv++;
+	}
+	AreaList areas;
+	std::string d1;
+	for (; argc > 0; argc--) {
+		std::string in = *argv++;
+		if (is_dir(in)) {
+			if (d1.empty()) d1 = in;
+			add_dir(in, areas);
+		} else {
+			add_file(in, areas);
+		}
+	}
+	if (out.empty()) {
+		out = d1.empty() ? "-" : d1 + "/tile_arealists.txt";
+	}
+	write_arealist(out, areas);
+	return 0;
+}